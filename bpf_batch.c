@@ -0,0 +1,712 @@
+/*
+ * Copyright (c) 2026 The Tcpdump Group
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Run a BPF program on several packets at once, with AVX2, for
+ * pcap_batchfilter_run().
+ *
+ * The filters people mostly use only look at fields at fixed offsets
+ * from the start of the packet - the link-layer type, the IP protocol
+ * and addresses - so, for programs with no indirect loads, we run the
+ * program for eight packets in lockstep, one in each 32-bit lane of a
+ * vector register; a load from the packets is a gather of a word from
+ * each of them, and a comparison is one vector comparison.
+ *
+ * Each lane has its own program counter.  Jumps only go forward, so
+ * we go through the program in order, running each instruction that
+ * any lane has reached for all of the lanes that are at it, and then
+ * moving on to the lowest instruction any lane is at; lanes that took
+ * different branches are run separately only until their paths join.
+ * A lane leaves the program when it reaches a return, or when a load
+ * runs past the end of its packet's captured data, in which case, as
+ * with bpf_filter(), the packet is rejected.
+ *
+ * The gathers cost more than the loads native code does a packet at a
+ * time, so this is used for programs bpf_jit_compile() can't compile,
+ * or when it's turned off; it's still faster than the interpreters.
+ * Programs with indirect loads, and machines without AVX2, are left to
+ * the interpreters, as are builds with compilers that can't generate
+ * AVX2 code for just some functions; for them, bpf_batch_prepare()
+ * returns NULL.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap-int.h"
+
+#if defined(__x86_64__) && !defined(WIN32) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#define BATCH_LANES	8
+
+#define AVX2	__attribute__((target("avx2")))
+
+struct bpf_batch {
+	u_int len;
+	u_int memwords;			/* scratch memory words it uses */
+	struct bpf_insn *insns;		/* our copy of the program */
+};
+
+/*
+ * The packets being run through the program, one in each lane; lanes
+ * past "n" have none, and are given the first packet, which they
+ * never look at.  The lengths and addresses are put straight into
+ * vectors, as storing them in arrays and loading those as vectors
+ * stalls the processor for longer than it takes to run most filters.
+ */
+struct batch_lanes {
+	const u_char **pkt;
+	int n;
+	__m256i addr[2];	/* addresses of the packets, four to a vector */
+	__m256i buflen;
+	__m256i wirelen;
+};
+
+#define BATCH_LANE(l, i)	((i) < (l)->n ? (i) : 0)
+
+/*
+ * Unsigned "a > b" for each lane; AVX2 only compares signed values,
+ * so flip the sign bits first.
+ */
+static inline AVX2 __m256i
+batch_gt(__m256i a, __m256i b)
+{
+	const __m256i sign = _mm256_set1_epi32((int)0x80000000U);
+
+	return (_mm256_cmpgt_epi32(_mm256_xor_si256(a, sign),
+	    _mm256_xor_si256(b, sign)));
+}
+
+static inline AVX2 __m256i
+batch_blend(__m256i a, __m256i b, __m256i mask)
+{
+	return (_mm256_blendv_epi8(a, b, mask));
+}
+
+/*
+ * A mask of all-ones or all-zeroes lanes as a bit for each lane.
+ */
+static inline AVX2 u_int
+batch_bits(__m256i mask)
+{
+	return ((u_int)_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+}
+
+/*
+ * The lowest value in any lane.
+ */
+static inline AVX2 u_int
+batch_min(__m256i v)
+{
+	v = _mm256_min_epu32(v, _mm256_permute2x128_si256(v, v, 1));
+	v = _mm256_min_epu32(v,
+	    _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm256_min_epu32(v,
+	    _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return ((u_int)_mm256_cvtsi256_si32(v));
+}
+
+static inline AVX2 void
+batch_lanes_init(struct batch_lanes *l, struct pcap_pkthdr **hdrs,
+    const u_char **pkts, int n)
+{
+#define HDR(i)	hdrs[BATCH_LANE(l, i)]
+#define ADDR(i)	(long long)(uintptr_t)pkts[BATCH_LANE(l, i)]
+
+	l->pkt = pkts;
+	l->n = n;
+	l->addr[0] = _mm256_setr_epi64x(ADDR(0), ADDR(1), ADDR(2), ADDR(3));
+	l->addr[1] = _mm256_setr_epi64x(ADDR(4), ADDR(5), ADDR(6), ADDR(7));
+	l->buflen = _mm256_setr_epi32(
+	    (int)HDR(0)->caplen, (int)HDR(1)->caplen,
+	    (int)HDR(2)->caplen, (int)HDR(3)->caplen,
+	    (int)HDR(4)->caplen, (int)HDR(5)->caplen,
+	    (int)HDR(6)->caplen, (int)HDR(7)->caplen);
+	l->wirelen = _mm256_setr_epi32(
+	    (int)HDR(0)->len, (int)HDR(1)->len,
+	    (int)HDR(2)->len, (int)HDR(3)->len,
+	    (int)HDR(4)->len, (int)HDR(5)->len,
+	    (int)HDR(6)->len, (int)HDR(7)->len);
+#undef HDR
+#undef ADDR
+}
+
+/*
+ * Load the "size"-byte big-endian field at "k" from the packets in
+ * the lanes in "mask", all of which have at least k + size bytes.
+ *
+ * Rather than loading from "k", which, for bytes and halfwords, could
+ * read past the end of the packet, load the word that ends where the
+ * field does, and mask off the bytes before the field; if that word
+ * would start before the packet, load the field a lane at a time.
+ */
+static inline AVX2 __m256i
+batch_load(const struct batch_lanes *l, __m256i mask, bpf_u_int32 k,
+    u_int size)
+{
+	const __m256i bswap = _mm256_setr_epi8(
+	    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+	    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i addr, vec;
+	__m128i lo, hi;
+	u_int lanes;
+
+	if (k + size < 4) {
+		lanes = batch_bits(mask);
+#define FIELD(i) \
+	(int)(!(lanes & (1U << (i))) ? 0 : \
+	    size == 1 ? l->pkt[i][k] : \
+	    (u_int)l->pkt[i][k] << 8 | l->pkt[i][k + 1])
+		vec = _mm256_setr_epi32(FIELD(0), FIELD(1), FIELD(2), FIELD(3),
+		    FIELD(4), FIELD(5), FIELD(6), FIELD(7));
+#undef FIELD
+		return (vec);
+	}
+
+	addr = _mm256_add_epi64(l->addr[0],
+	    _mm256_set1_epi64x((long long)(k + size - 4)));
+	lo = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), NULL, addr,
+	    _mm256_castsi256_si128(mask), 1);
+	addr = _mm256_add_epi64(l->addr[1],
+	    _mm256_set1_epi64x((long long)(k + size - 4)));
+	hi = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), NULL, addr,
+	    _mm256_extracti128_si256(mask, 1), 1);
+	vec = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+	vec = _mm256_shuffle_epi8(vec, bswap);
+	if (size == 1)
+		vec = _mm256_and_si256(vec, _mm256_set1_epi32(0xff));
+	else if (size == 2)
+		vec = _mm256_and_si256(vec, _mm256_set1_epi32(0xffff));
+	return (vec);
+}
+
+/*
+ * Divide, or take the remainder of, A by "divisor" in the lanes in
+ * "mask", a lane at a time, as AVX2 can't; returns the mask of the
+ * lanes whose divisor is zero, which are left alone.
+ */
+static inline AVX2 __m256i
+batch_div(__m256i *A, __m256i divisor, __m256i mask, int mod)
+{
+	bpf_u_int32 a[BATCH_LANES], d[BATCH_LANES], zero[BATCH_LANES];
+	u_int lanes;
+	int i;
+
+	_mm256_storeu_si256((__m256i *)a, *A);
+	_mm256_storeu_si256((__m256i *)d, divisor);
+	lanes = batch_bits(mask);
+	for (i = 0; i < BATCH_LANES; i++) {
+		zero[i] = 0;
+		if (!(lanes & (1U << i)))
+			continue;
+		if (d[i] == 0)
+			zero[i] = 0xffffffffU;
+		else if (mod)
+			a[i] %= d[i];
+		else
+			a[i] /= d[i];
+	}
+	*A = _mm256_loadu_si256((const __m256i *)a);
+	return (_mm256_loadu_si256((const __m256i *)zero));
+}
+
+/*
+ * Run the program on the first "n", up to BATCH_LANES, of the packets
+ * in "pkts", and put the value returned for each in "retp".
+ *
+ * While all the lanes still in the program are at the same
+ * instruction, which, for the programs pcap_compile() generates, is
+ * most of the time, we don't keep a program counter for each; which
+ * way a jump goes is decided by comparing the lanes' conditions, as a
+ * bit mask, with the mask of those lanes, so that the processor can
+ * predict where the program goes next as it would for one packet.
+ * Only when the lanes go different ways do we keep the lanes' program
+ * counters in "lanepc", and find the next instruction to run from
+ * them, until the lanes are all at the same instruction again.
+ */
+static AVX2 void
+batch_run(const struct bpf_batch *b, struct pcap_pkthdr **hdrs,
+    const u_char **pkts, int n, bpf_u_int32 *retp)
+{
+	struct batch_lanes lanes, *l = &lanes;
+	const struct bpf_insn *ins;
+	__m256i A, X, mem[BPF_MEMWORDS], ret, lanepc, done, active, bad;
+	__m256i runv, cond;
+	bpf_u_int32 k;
+	u_int pc, size, running, bits, condbits, jt, jf;
+	int together;
+
+	batch_lanes_init(l, hdrs, pkts, n);
+	A = X = ret = _mm256_setzero_si256();
+	for (k = 0; k < b->memwords; k++)
+		mem[k] = _mm256_setzero_si256();
+	done = _mm256_set1_epi32((int)b->len);
+	lanepc = done;
+	runv = _mm256_cmpgt_epi32(_mm256_set1_epi32(n),
+	    _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	running = batch_bits(runv);
+
+/*
+ * Take the lanes in "m" out of the program.
+ */
+#define LEAVE(m) \
+	do { \
+		runv = _mm256_andnot_si256((m), runv); \
+		running &= ~batch_bits(m); \
+		lanepc = batch_blend(lanepc, done, (m)); \
+	} while (0)
+
+	pc = 0;
+	together = 1;
+	while (running != 0) {
+		ins = &b->insns[pc];
+		k = ins->k;
+		if (together)
+			active = runv;
+		else {
+			active = _mm256_cmpeq_epi32(lanepc,
+			    _mm256_set1_epi32((int)pc));
+			if (batch_bits(active) == running)
+				together = 1;
+		}
+
+		switch (ins->code) {
+
+		case BPF_RET|BPF_K:
+			ret = batch_blend(ret, _mm256_set1_epi32((int)k),
+			    active);
+			LEAVE(active);
+			if (running != 0)
+				pc = batch_min(lanepc);
+			continue;
+
+		case BPF_RET|BPF_A:
+			ret = batch_blend(ret, A, active);
+			LEAVE(active);
+			if (running != 0)
+				pc = batch_min(lanepc);
+			continue;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+			size = 4;
+			goto load;
+
+		case BPF_LD|BPF_H|BPF_ABS:
+			size = 2;
+			goto load;
+
+		case BPF_LD|BPF_B|BPF_ABS:
+			size = 1;
+		load:
+			/*
+			 * Lanes whose packets are too short leave the
+			 * program, returning 0.
+			 */
+			if (k > 0xffffffffU - size)
+				bad = active;
+			else
+				bad = _mm256_and_si256(active, batch_gt(
+				    _mm256_set1_epi32((int)(k + size)), l->buflen));
+			if (!_mm256_testz_si256(bad, bad)) {
+				LEAVE(bad);
+				active = _mm256_andnot_si256(bad, active);
+			}
+			A = batch_blend(A, batch_load(l, active, k, size),
+			    active);
+			break;
+
+		case BPF_LD|BPF_W|BPF_LEN:
+			A = batch_blend(A, l->wirelen, active);
+			break;
+
+		case BPF_LDX|BPF_W|BPF_LEN:
+			X = batch_blend(X, l->wirelen, active);
+			break;
+
+		case BPF_LD|BPF_IMM:
+			A = batch_blend(A, _mm256_set1_epi32((int)k), active);
+			break;
+
+		case BPF_LDX|BPF_IMM:
+			X = batch_blend(X, _mm256_set1_epi32((int)k), active);
+			break;
+
+		case BPF_LD|BPF_MEM:
+			A = batch_blend(A, mem[k], active);
+			break;
+
+		case BPF_LDX|BPF_MEM:
+			X = batch_blend(X, mem[k], active);
+			break;
+
+		case BPF_ST:
+			mem[k] = batch_blend(mem[k], A, active);
+			break;
+
+		case BPF_STX:
+			mem[k] = batch_blend(mem[k], X, active);
+			break;
+
+		case BPF_JMP|BPF_JA:
+			pc += 1 + k;
+			if (!together) {
+				lanepc = batch_blend(lanepc,
+				    _mm256_set1_epi32((int)pc), active);
+				pc = batch_min(lanepc);
+			}
+			continue;
+
+		case BPF_JMP|BPF_JGT|BPF_K:
+			cond = batch_gt(A, _mm256_set1_epi32((int)k));
+			goto branch;
+
+		case BPF_JMP|BPF_JGE|BPF_K:
+			cond = batch_gt(_mm256_set1_epi32((int)k), A);
+			cond = _mm256_xor_si256(cond, _mm256_set1_epi32(-1));
+			goto branch;
+
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			cond = _mm256_cmpeq_epi32(A, _mm256_set1_epi32((int)k));
+			goto branch;
+
+		case BPF_JMP|BPF_JSET|BPF_K:
+			cond = _mm256_cmpeq_epi32(_mm256_and_si256(A,
+			    _mm256_set1_epi32((int)k)), _mm256_setzero_si256());
+			cond = _mm256_xor_si256(cond, _mm256_set1_epi32(-1));
+			goto branch;
+
+		case BPF_JMP|BPF_JGT|BPF_X:
+			cond = batch_gt(A, X);
+			goto branch;
+
+		case BPF_JMP|BPF_JGE|BPF_X:
+			cond = batch_gt(X, A);
+			cond = _mm256_xor_si256(cond, _mm256_set1_epi32(-1));
+			goto branch;
+
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			cond = _mm256_cmpeq_epi32(A, X);
+			goto branch;
+
+		case BPF_JMP|BPF_JSET|BPF_X:
+			cond = _mm256_cmpeq_epi32(_mm256_and_si256(A, X),
+			    _mm256_setzero_si256());
+			cond = _mm256_xor_si256(cond, _mm256_set1_epi32(-1));
+		branch:
+			jt = pc + 1 + ins->jt;
+			jf = pc + 1 + ins->jf;
+			if (together) {
+				condbits = batch_bits(cond) & running;
+				if (condbits == running || jt == jf) {
+					pc = jt;
+					continue;
+				}
+				if (condbits == 0) {
+					pc = jf;
+					continue;
+				}
+
+				/*
+				 * The lanes go different ways; from
+				 * now on, keep track of where each is.
+				 */
+				together = 0;
+				lanepc = batch_blend(done, batch_blend(
+				    _mm256_set1_epi32((int)jf),
+				    _mm256_set1_epi32((int)jt), cond), runv);
+				pc = jt < jf ? jt : jf;
+				continue;
+			}
+			lanepc = batch_blend(lanepc, batch_blend(
+			    _mm256_set1_epi32((int)jf),
+			    _mm256_set1_epi32((int)jt), cond), active);
+			pc = batch_min(lanepc);
+			continue;
+
+		case BPF_ALU|BPF_ADD|BPF_K:
+			A = batch_blend(A, _mm256_add_epi32(A,
+			    _mm256_set1_epi32((int)k)), active);
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_K:
+			A = batch_blend(A, _mm256_sub_epi32(A,
+			    _mm256_set1_epi32((int)k)), active);
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_K:
+			A = batch_blend(A, _mm256_mullo_epi32(A,
+			    _mm256_set1_epi32((int)k)), active);
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_K:
+			(void)batch_div(&A, _mm256_set1_epi32((int)k), active,
+			    0);
+			break;
+
+		case BPF_ALU|BPF_MOD|BPF_K:
+			(void)batch_div(&A, _mm256_set1_epi32((int)k), active,
+			    1);
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_K:
+			A = batch_blend(A, _mm256_and_si256(A,
+			    _mm256_set1_epi32((int)k)), active);
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_K:
+			A = batch_blend(A, _mm256_or_si256(A,
+			    _mm256_set1_epi32((int)k)), active);
+			break;
+
+		case BPF_ALU|BPF_XOR|BPF_K:
+			A = batch_blend(A, _mm256_xor_si256(A,
+			    _mm256_set1_epi32((int)k)), active);
+			break;
+
+		/*
+		 * Shift counts are taken modulo 32, as the x86 shift
+		 * instructions used by bpf_filter() and the JIT do.
+		 */
+		case BPF_ALU|BPF_LSH|BPF_K:
+			A = batch_blend(A, _mm256_sll_epi32(A,
+			    _mm_cvtsi32_si128((int)(k & 31))), active);
+			break;
+
+		case BPF_ALU|BPF_RSH|BPF_K:
+			A = batch_blend(A, _mm256_srl_epi32(A,
+			    _mm_cvtsi32_si128((int)(k & 31))), active);
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_X:
+			A = batch_blend(A, _mm256_add_epi32(A, X), active);
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_X:
+			A = batch_blend(A, _mm256_sub_epi32(A, X), active);
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_X:
+			A = batch_blend(A, _mm256_mullo_epi32(A, X), active);
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_X:
+		case BPF_ALU|BPF_MOD|BPF_X:
+			/*
+			 * Lanes dividing by zero leave the program,
+			 * returning 0.
+			 */
+			bad = batch_div(&A, X, active,
+			    BPF_OP(ins->code) == BPF_MOD);
+			if (!_mm256_testz_si256(bad, bad)) {
+				LEAVE(bad);
+				active = _mm256_andnot_si256(bad, active);
+			}
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_X:
+			A = batch_blend(A, _mm256_and_si256(A, X), active);
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_X:
+			A = batch_blend(A, _mm256_or_si256(A, X), active);
+			break;
+
+		case BPF_ALU|BPF_XOR|BPF_X:
+			A = batch_blend(A, _mm256_xor_si256(A, X), active);
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_X:
+			A = batch_blend(A, _mm256_sllv_epi32(A,
+			    _mm256_and_si256(X, _mm256_set1_epi32(31))),
+			    active);
+			break;
+
+		case BPF_ALU|BPF_RSH|BPF_X:
+			A = batch_blend(A, _mm256_srlv_epi32(A,
+			    _mm256_and_si256(X, _mm256_set1_epi32(31))),
+			    active);
+			break;
+
+		case BPF_ALU|BPF_NEG:
+			A = batch_blend(A, _mm256_sub_epi32(
+			    _mm256_setzero_si256(), A), active);
+			break;
+
+		case BPF_MISC|BPF_TAX:
+			X = batch_blend(X, A, active);
+			break;
+
+		case BPF_MISC|BPF_TXA:
+			A = batch_blend(A, X, active);
+			break;
+
+		default:
+			abort();
+		}
+
+		/*
+		 * The lanes that ran the instruction go on to the next
+		 * one, which, unless they all left the program, is the
+		 * lowest instruction any lane is at.
+		 */
+		if (together)
+			pc++;
+		else {
+			bits = batch_bits(active);
+			lanepc = batch_blend(lanepc,
+			    _mm256_set1_epi32((int)(pc + 1)), active);
+			if (bits != 0)
+				pc++;
+			else if (running != 0)
+				pc = batch_min(lanepc);
+		}
+	}
+#undef LEAVE
+	_mm256_storeu_si256((__m256i *)retp, ret);
+}
+
+/*
+ * Make a copy of a program, which must have passed bpf_validate(),
+ * for bpf_filter_batch(), or return NULL if it has instructions we
+ * don't run in lockstep or this machine doesn't have AVX2.
+ */
+struct bpf_batch *
+bpf_batch_prepare(const struct bpf_insn *insns, u_int len)
+{
+	struct bpf_batch *b;
+	u_int i, memwords = 0;
+
+	if (!__builtin_cpu_supports("avx2"))
+		return (NULL);
+	for (i = 0; i < len; i++) {
+		switch (BPF_CLASS(insns[i].code)) {
+
+		case BPF_LD:
+		case BPF_LDX:
+			/*
+			 * Indirect loads - and the loads of the IP
+			 * header length that set up their index - are
+			 * what we leave to the other ways of running
+			 * the program.
+			 */
+			if (BPF_MODE(insns[i].code) == BPF_IND ||
+			    BPF_MODE(insns[i].code) == BPF_MSH)
+				return (NULL);
+			if (BPF_MODE(insns[i].code) == BPF_MEM &&
+			    insns[i].k >= memwords)
+				memwords = insns[i].k + 1;
+			break;
+
+		case BPF_ST:
+		case BPF_STX:
+			if (insns[i].k >= memwords)
+				memwords = insns[i].k + 1;
+			break;
+
+		case BPF_MISC:
+			if (insns[i].code != (BPF_MISC|BPF_TAX) &&
+			    insns[i].code != (BPF_MISC|BPF_TXA))
+				return (NULL);
+			break;
+		}
+	}
+
+	b = malloc(sizeof(*b) + len * sizeof(*insns));
+	if (b == NULL)
+		return (NULL);
+	b->len = len;
+	b->memwords = memwords;
+	b->insns = (struct bpf_insn *)(b + 1);
+	memcpy(b->insns, insns, len * sizeof(*insns));
+	return (b);
+}
+
+/*
+ * Run the program on "n" packets, BATCH_LANES at a time, putting the
+ * value it returns for each in "results", if that's not null; returns
+ * the number of packets for which that's not zero.
+ */
+int
+bpf_filter_batch(const struct bpf_batch *b, struct pcap_pkthdr **hdrs,
+    const u_char **pkts, int n, bpf_u_int32 *results)
+{
+	bpf_u_int32 ret[BATCH_LANES];
+	int base, nlanes, i, nmatch = 0;
+
+	for (base = 0; base < n; base += BATCH_LANES) {
+		nlanes = n - base;
+		if (nlanes > BATCH_LANES)
+			nlanes = BATCH_LANES;
+		batch_run(b, &hdrs[base], &pkts[base], nlanes, ret);
+		for (i = 0; i < nlanes; i++) {
+			if (results != NULL)
+				results[base + i] = ret[i];
+			if (ret[i] != 0)
+				nmatch++;
+		}
+	}
+	return (nmatch);
+}
+
+void
+bpf_batch_free(struct bpf_batch *b)
+{
+	free(b);
+}
+
+#else /* AVX2 */
+
+struct bpf_batch *
+bpf_batch_prepare(const struct bpf_insn *insns _U_, u_int len _U_)
+{
+	return (NULL);
+}
+
+int
+bpf_filter_batch(const struct bpf_batch *b _U_,
+    struct pcap_pkthdr **hdrs _U_, const u_char **pkts _U_, int n _U_,
+    bpf_u_int32 *results _U_)
+{
+	return (0);
+}
+
+void
+bpf_batch_free(struct bpf_batch *b _U_)
+{
+}
+
+#endif /* AVX2 */
@@ -0,0 +1,737 @@
+/*
+ * Copyright (c) 2026 The Tcpdump Group
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compile BPF programs to native code, so that filters we run in
+ * userland - on packets read from savefiles, and on those read live
+ * when the kernel can't run the filter - don't pay for interpreting
+ * each instruction.
+ *
+ * This is currently done only on x86-64; elsewhere, and for programs
+ * we can't compile, bpf_jit_compile() returns NULL and the caller
+ * interprets the program.  The code does exactly what that does,
+ * including rejecting packets when a load runs past the end of the
+ * captured data.
+ *
+ * Configuring with --disable-bpf-jit leaves the compiler out, and
+ * setting PCAP_NO_BPF_JIT in the environment turns it off at run time,
+ * so that all filters are interpreted.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap-int.h"
+
+#if defined(__x86_64__) && !defined(WIN32) && !defined(NO_BPF_JIT)
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <linux/types.h>
+#include <linux/filter.h>
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+/*
+ * The mapping holding the code starts with its size, so that
+ * bpf_jit_free() knows how much to unmap.
+ */
+#define JIT_HDR_LEN	16
+
+/*
+ * The generated code keeps A in %eax, X in %r8d, the packet pointer
+ * in %rdi, the packet length in %esi, the captured length in %r10d,
+ * and the auxiliary data pointer in %r11; %ecx and %edx are scratch.
+ * All of those are caller-saved, and, as the code calls nothing, the
+ * scratch memory words go in the red zone below the stack pointer.
+ */
+#define JIT_MEM_DISP(k)	(-4 * BPF_MEMWORDS + 4 * (int)(k))
+
+/*
+ * Packet offsets must fit in a signed 32-bit displacement, along with
+ * the size of the load; programs with larger ones are left to the
+ * interpreter, which rejects such loads for any real packet anyway.
+ */
+#define JIT_MAX_OFFSET	0x7ffffff0U
+
+/*
+ * Condition codes.
+ */
+#define CC_B	0x2	/* below */
+#define CC_AE	0x3	/* above or equal */
+#define CC_E	0x4	/* equal */
+#define CC_NE	0x5	/* not equal */
+#define CC_BE	0x6	/* below or equal */
+#define CC_A	0x7	/* above */
+#define CC_JMP	-1	/* unconditional */
+
+/*
+ * State of a pass over the program.
+ *
+ * The program is compiled three times.  The first pass uses the long
+ * form of every jump, and just works out where each instruction's code
+ * starts; the second uses the short form of each jump that the first
+ * pass shows can reach its target with one, and works out where each
+ * instruction's code finally starts; the third generates the code.
+ * Code only gets shorter between the first pass and the others, so
+ * a jump short enough after the first is short enough after them.
+ *
+ * If bpf_abs_load_extent() says how much of the packet the program's
+ * absolute loads can look at, the code has two copies of the program,
+ * one whose absolute loads check the packet length and one whose
+ * absolute loads don't, and starts by picking one.  Each copy's
+ * instructions have a slot in the offset arrays, followed by a slot
+ * for the code that rejects the packet.
+ */
+struct jit {
+	u_char	*buf;		/* code, or NULL if not generating it */
+	u_int	pos;		/* offset of the next byte of code */
+	u_int	*addr;		/* offset of each slot's code */
+	const u_int *sizing;	/* offsets from the first pass, or NULL */
+	const u_int *final;	/* offsets from the second pass, or NULL */
+	u_int	cur;		/* instruction being compiled */
+	u_int	len;		/* number of instructions */
+	u_int	base;		/* slot of the copy being compiled */
+	u_int	reject;		/* slot of the code rejecting the packet */
+	int	check;		/* whether absolute loads check the length */
+};
+
+static void
+jit_emit(struct jit *j, u_int n, bpf_u_int32 v)
+{
+	u_int i;
+
+	if (j->buf != NULL) {
+		for (i = 0; i < n; i++)
+			j->buf[j->pos + i] = (u_char)(v >> (8 * i));
+	}
+	j->pos += n;
+}
+
+#define EMIT1(j, a)		jit_emit(j, 1, (a))
+#define EMIT2(j, a, b)		jit_emit(j, 2, (a) | (b) << 8)
+#define EMIT3(j, a, b, c)	jit_emit(j, 3, (a) | (b) << 8 | (c) << 16)
+#define EMIT4(j, a, b, c, d)	jit_emit(j, 4, (a) | (b) << 8 | (c) << 16 | \
+				    (bpf_u_int32)(d) << 24)
+#define EMIT_IMM32(j, v)	jit_emit(j, 4, (v))
+
+/*
+ * Emit a jump, unconditional if "cc" is CC_JMP, from code in slot
+ * "from" to the code in slot "to".
+ */
+static void
+jit_jump_slot(struct jit *j, int cc, u_int from, u_int to)
+{
+	int is_short;
+	bpf_int32 disp;
+
+	if (j->sizing == NULL)
+		is_short = 0;
+	else if (to > from)
+		is_short = j->sizing[to] - j->sizing[from] <= 127;
+	else
+		is_short = j->sizing[from + 1] - j->sizing[to] <= 128;
+
+	if (is_short) {
+		if (cc == CC_JMP)
+			EMIT1(j, 0xeb);
+		else
+			EMIT1(j, 0x70 | cc);
+		disp = j->final != NULL ? j->final[to] - (j->pos + 1) : 0;
+		EMIT1(j, disp & 0xff);
+	} else {
+		if (cc == CC_JMP)
+			EMIT1(j, 0xe9);
+		else
+			EMIT2(j, 0x0f, 0x80 | cc);
+		disp = j->final != NULL ? j->final[to] - (j->pos + 4) : 0;
+		EMIT_IMM32(j, disp);
+	}
+}
+
+/*
+ * Emit a jump from the instruction being compiled to instruction
+ * "target" in the same copy of the program, or, if "target" is the
+ * length of the program, to the code that rejects the packet.
+ */
+static void
+jit_jump(struct jit *j, int cc, u_int target)
+{
+	jit_jump_slot(j, cc, j->base + j->cur,
+	    target == j->len ? j->reject : j->base + target);
+}
+
+/*
+ * Compare the captured length with "need".
+ */
+static void
+jit_cmp_len(struct jit *j, u_int need)
+{
+	if (need <= 127)
+		EMIT4(j, 0x41, 0x83, 0xfa, need);	/* cmp $need, %r10d */
+	else {
+		EMIT3(j, 0x41, 0x81, 0xfa);		/* cmp $need, %r10d */
+		EMIT_IMM32(j, need);
+	}
+}
+
+/*
+ * For an absolute load, reject the packet if fewer than "need" bytes
+ * of it were captured, unless we're compiling the copy of the program
+ * that's only run when enough were captured for every absolute load.
+ */
+static void
+jit_check_len(struct jit *j, u_int need)
+{
+	if (!j->check)
+		return;
+	jit_cmp_len(j, need);
+	jit_jump(j, CC_B, j->len);
+}
+
+/*
+ * Emit the ModRM byte and displacement for the operand k(%rdi), with
+ * register "reg" in the reg field.
+ */
+static void
+jit_rdi_operand(struct jit *j, u_int reg, u_int k)
+{
+	if (k <= 127)
+		EMIT2(j, 0x47 | reg << 3, k);
+	else {
+		EMIT1(j, 0x87 | reg << 3);
+		EMIT_IMM32(j, k);
+	}
+}
+
+/*
+ * Likewise, for the operand k(%rdi,%rdx).
+ */
+static void
+jit_rdi_rdx_operand(struct jit *j, u_int reg, u_int k)
+{
+	if (k <= 127)
+		EMIT3(j, 0x44 | reg << 3, 0x17, k);
+	else {
+		EMIT2(j, 0x84 | reg << 3, 0x17);
+		EMIT_IMM32(j, k);
+	}
+}
+
+/*
+ * For an indexed load of "size" bytes at X + k, reject the packet if
+ * they weren't all captured, and leave X in %rdx.
+ */
+static void
+jit_check_ind(struct jit *j, u_int k, u_int size)
+{
+	EMIT3(j, 0x44, 0x89, 0xc2);		/* mov %r8d, %edx */
+	EMIT3(j, 0x48, 0x8d, 0x8a);		/* lea k+size(%rdx), %rcx */
+	EMIT_IMM32(j, k + size);
+	EMIT3(j, 0x4c, 0x39, 0xd1);		/* cmp %r10, %rcx */
+	jit_jump(j, CC_A, j->len);
+}
+
+/*
+ * Emit the jumps for a conditional jump instruction, after the
+ * comparison; "cc" is the condition for "jt" and "ncc" its negation.
+ */
+static void
+jit_branch(struct jit *j, const struct bpf_insn *ins, int cc, int ncc)
+{
+	u_int jt = j->cur + 1 + ins->jt;
+	u_int jf = j->cur + 1 + ins->jf;
+
+	if (ins->jt == ins->jf) {
+		if (ins->jt != 0)
+			jit_jump(j, CC_JMP, jt);
+	} else if (ins->jt == 0)
+		jit_jump(j, ncc, jf);
+	else if (ins->jf == 0)
+		jit_jump(j, cc, jt);
+	else {
+		jit_jump(j, cc, jt);
+		jit_jump(j, CC_JMP, jf);
+	}
+}
+
+/*
+ * Emit an ALU instruction on A with an immediate operand; "op" is the
+ * opcode of the form taking a 32-bit immediate and %eax.
+ */
+static void
+jit_alu_k(struct jit *j, u_int op, bpf_u_int32 k)
+{
+	EMIT1(j, op);
+	EMIT_IMM32(j, k);
+}
+
+/*
+ * Compile one copy of the program; returns -1 if it has an instruction
+ * we can't compile.
+ */
+static int
+jit_copy(struct jit *j, const struct bpf_insn *insns)
+{
+	const struct bpf_insn *ins;
+	u_int k;
+
+	for (j->cur = 0; j->cur < j->len; j->cur++) {
+		ins = &insns[j->cur];
+		k = ins->k;
+		j->addr[j->base + j->cur] = j->pos;
+
+		switch (ins->code) {
+
+		case BPF_RET|BPF_K:
+			if (k == 0)
+				EMIT2(j, 0x31, 0xc0);	/* xor %eax, %eax */
+			else
+				jit_alu_k(j, 0xb8, k);	/* mov $k, %eax */
+			EMIT1(j, 0xc3);			/* ret */
+			break;
+
+		case BPF_RET|BPF_A:
+			EMIT1(j, 0xc3);			/* ret */
+			break;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+			if (k > JIT_MAX_OFFSET)
+				return -1;
+			jit_check_len(j, k + 4);
+			EMIT1(j, 0x8b);			/* mov k(%rdi), %eax */
+			jit_rdi_operand(j, 0, k);
+			EMIT2(j, 0x0f, 0xc8);		/* bswap %eax */
+			break;
+
+		case BPF_LD|BPF_H|BPF_ABS:
+			if (k > JIT_MAX_OFFSET)
+				return -1;
+			jit_check_len(j, k + 2);
+			EMIT2(j, 0x0f, 0xb7);		/* movzwl k(%rdi), %eax */
+			jit_rdi_operand(j, 0, k);
+			EMIT4(j, 0x66, 0xc1, 0xc0, 8);	/* rol $8, %ax */
+			break;
+
+		case BPF_LD|BPF_B|BPF_ABS:
+#if defined(SKF_AD_VLAN_TAG) && defined(SKF_AD_VLAN_TAG_PRESENT)
+			if (k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG) ||
+			    k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT)) {
+				EMIT3(j, 0x4d, 0x85, 0xdb); /* test %r11, %r11 */
+				jit_jump(j, CC_E, j->len);
+				/* movzwl offset(%r11), %eax */
+				EMIT4(j, 0x41, 0x0f, 0xb7, 0x43);
+				EMIT1(j, k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG) ?
+				    offsetof(struct bpf_aux_data, vlan_tag) :
+				    offsetof(struct bpf_aux_data, vlan_tag_present));
+				break;
+			}
+#endif
+			if (k > JIT_MAX_OFFSET)
+				return -1;
+			jit_check_len(j, k + 1);
+			EMIT2(j, 0x0f, 0xb6);		/* movzbl k(%rdi), %eax */
+			jit_rdi_operand(j, 0, k);
+			break;
+
+		case BPF_LD|BPF_W|BPF_IND:
+			if (k > JIT_MAX_OFFSET)
+				return -1;
+			jit_check_ind(j, k, 4);
+			EMIT1(j, 0x8b);			/* mov k(%rdi,%rdx), %eax */
+			jit_rdi_rdx_operand(j, 0, k);
+			EMIT2(j, 0x0f, 0xc8);		/* bswap %eax */
+			break;
+
+		case BPF_LD|BPF_H|BPF_IND:
+			if (k > JIT_MAX_OFFSET)
+				return -1;
+			jit_check_ind(j, k, 2);
+			EMIT2(j, 0x0f, 0xb7);		/* movzwl k(%rdi,%rdx), %eax */
+			jit_rdi_rdx_operand(j, 0, k);
+			EMIT4(j, 0x66, 0xc1, 0xc0, 8);	/* rol $8, %ax */
+			break;
+
+		case BPF_LD|BPF_B|BPF_IND:
+			if (k > JIT_MAX_OFFSET)
+				return -1;
+			jit_check_ind(j, k, 1);
+			EMIT2(j, 0x0f, 0xb6);		/* movzbl k(%rdi,%rdx), %eax */
+			jit_rdi_rdx_operand(j, 0, k);
+			break;
+
+		case BPF_LDX|BPF_MSH|BPF_B:
+			if (k > JIT_MAX_OFFSET)
+				return -1;
+			jit_check_len(j, k + 1);
+			EMIT3(j, 0x44, 0x0f, 0xb6);	/* movzbl k(%rdi), %r8d */
+			jit_rdi_operand(j, 0, k);
+			EMIT4(j, 0x41, 0x83, 0xe0, 0x0f); /* and $0xf, %r8d */
+			EMIT4(j, 0x41, 0xc1, 0xe0, 2);	/* shl $2, %r8d */
+			break;
+
+		case BPF_LD|BPF_W|BPF_LEN:
+			EMIT2(j, 0x89, 0xf0);		/* mov %esi, %eax */
+			break;
+
+		case BPF_LDX|BPF_W|BPF_LEN:
+			EMIT3(j, 0x41, 0x89, 0xf0);	/* mov %esi, %r8d */
+			break;
+
+		case BPF_LD|BPF_IMM:
+			jit_alu_k(j, 0xb8, k);		/* mov $k, %eax */
+			break;
+
+		case BPF_LDX|BPF_IMM:
+			EMIT1(j, 0x41);			/* mov $k, %r8d */
+			jit_alu_k(j, 0xb8, k);
+			break;
+
+		case BPF_LD|BPF_MEM:
+			/* mov mem[k], %eax */
+			EMIT4(j, 0x8b, 0x44, 0x24, JIT_MEM_DISP(k) & 0xff);
+			break;
+
+		case BPF_LDX|BPF_MEM:
+			/* mov mem[k], %r8d */
+			EMIT4(j, 0x44, 0x8b, 0x44, 0x24);
+			EMIT1(j, JIT_MEM_DISP(k) & 0xff);
+			break;
+
+		case BPF_ST:
+			/* mov %eax, mem[k] */
+			EMIT4(j, 0x89, 0x44, 0x24, JIT_MEM_DISP(k) & 0xff);
+			break;
+
+		case BPF_STX:
+			/* mov %r8d, mem[k] */
+			EMIT4(j, 0x44, 0x89, 0x44, 0x24);
+			EMIT1(j, JIT_MEM_DISP(k) & 0xff);
+			break;
+
+		case BPF_JMP|BPF_JA:
+			/*
+			 * Sign-extend k, as the interpreter does, for
+			 * the backward jumps of "ip6 protochain".
+			 */
+			jit_jump(j, CC_JMP, j->cur + 1 + (bpf_int32)k);
+			break;
+
+		case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_K:
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			if (k == 0)
+				EMIT2(j, 0x85, 0xc0);	/* test %eax, %eax */
+			else if (k <= 127)
+				EMIT3(j, 0x83, 0xf8, k); /* cmp $k, %eax */
+			else
+				jit_alu_k(j, 0x3d, k);	/* cmp $k, %eax */
+			switch (BPF_OP(ins->code)) {
+			case BPF_JGT:
+				jit_branch(j, ins, CC_A, CC_BE);
+				break;
+			case BPF_JGE:
+				jit_branch(j, ins, CC_AE, CC_B);
+				break;
+			default:
+				jit_branch(j, ins, CC_E, CC_NE);
+				break;
+			}
+			break;
+
+		case BPF_JMP|BPF_JSET|BPF_K:
+			jit_alu_k(j, 0xa9, k);		/* test $k, %eax */
+			jit_branch(j, ins, CC_NE, CC_E);
+			break;
+
+		case BPF_JMP|BPF_JGT|BPF_X:
+			EMIT3(j, 0x44, 0x39, 0xc0);	/* cmp %r8d, %eax */
+			jit_branch(j, ins, CC_A, CC_BE);
+			break;
+
+		case BPF_JMP|BPF_JGE|BPF_X:
+			EMIT3(j, 0x44, 0x39, 0xc0);	/* cmp %r8d, %eax */
+			jit_branch(j, ins, CC_AE, CC_B);
+			break;
+
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			EMIT3(j, 0x44, 0x39, 0xc0);	/* cmp %r8d, %eax */
+			jit_branch(j, ins, CC_E, CC_NE);
+			break;
+
+		case BPF_JMP|BPF_JSET|BPF_X:
+			EMIT3(j, 0x44, 0x85, 0xc0);	/* test %r8d, %eax */
+			jit_branch(j, ins, CC_NE, CC_E);
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_X:
+			EMIT3(j, 0x44, 0x01, 0xc0);	/* add %r8d, %eax */
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_X:
+			EMIT3(j, 0x44, 0x29, 0xc0);	/* sub %r8d, %eax */
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_X:
+			EMIT4(j, 0x41, 0x0f, 0xaf, 0xc0); /* imul %r8d, %eax */
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_X:
+		case BPF_ALU|BPF_MOD|BPF_X:
+			EMIT3(j, 0x45, 0x85, 0xc0);	/* test %r8d, %r8d */
+			jit_jump(j, CC_E, j->len);
+			EMIT2(j, 0x31, 0xd2);		/* xor %edx, %edx */
+			EMIT3(j, 0x41, 0xf7, 0xf0);	/* div %r8d */
+			if (BPF_OP(ins->code) == BPF_MOD)
+				EMIT2(j, 0x89, 0xd0);	/* mov %edx, %eax */
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_X:
+			EMIT3(j, 0x44, 0x21, 0xc0);	/* and %r8d, %eax */
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_X:
+			EMIT3(j, 0x44, 0x09, 0xc0);	/* or %r8d, %eax */
+			break;
+
+		case BPF_ALU|BPF_XOR|BPF_X:
+			EMIT3(j, 0x44, 0x31, 0xc0);	/* xor %r8d, %eax */
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_X:
+			EMIT3(j, 0x44, 0x89, 0xc1);	/* mov %r8d, %ecx */
+			EMIT2(j, 0xd3, 0xe0);		/* shl %cl, %eax */
+			break;
+
+		case BPF_ALU|BPF_RSH|BPF_X:
+			EMIT3(j, 0x44, 0x89, 0xc1);	/* mov %r8d, %ecx */
+			EMIT2(j, 0xd3, 0xe8);		/* shr %cl, %eax */
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_K:
+			jit_alu_k(j, 0x05, k);		/* add $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_K:
+			jit_alu_k(j, 0x2d, k);		/* sub $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_K:
+			EMIT1(j, 0x69);			/* imul $k, %eax, %eax */
+			jit_alu_k(j, 0xc0, k);
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_K:
+		case BPF_ALU|BPF_MOD|BPF_K:
+			/*
+			 * bpf_validate() rejects division by a constant 0.
+			 */
+			EMIT2(j, 0x31, 0xd2);		/* xor %edx, %edx */
+			jit_alu_k(j, 0xb9, k);		/* mov $k, %ecx */
+			EMIT2(j, 0xf7, 0xf1);		/* div %ecx */
+			if (BPF_OP(ins->code) == BPF_MOD)
+				EMIT2(j, 0x89, 0xd0);	/* mov %edx, %eax */
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_K:
+			jit_alu_k(j, 0x25, k);		/* and $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_K:
+			jit_alu_k(j, 0x0d, k);		/* or $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_XOR|BPF_K:
+			jit_alu_k(j, 0x35, k);		/* xor $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_K:
+			EMIT3(j, 0xc1, 0xe0, k & 0xff);	/* shl $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_RSH|BPF_K:
+			EMIT3(j, 0xc1, 0xe8, k & 0xff);	/* shr $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_NEG:
+			EMIT2(j, 0xf7, 0xd8);		/* neg %eax */
+			break;
+
+		case BPF_MISC|BPF_TAX:
+			EMIT3(j, 0x41, 0x89, 0xc0);	/* mov %eax, %r8d */
+			break;
+
+		case BPF_MISC|BPF_TXA:
+			EMIT3(j, 0x44, 0x89, 0xc0);	/* mov %r8d, %eax */
+			break;
+
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Compile the whole program; "extent" is what bpf_abs_load_extent()
+ * returned for it, or 0 if we're making only the copy that checks.
+ */
+static int
+jit_pass(struct jit *j, const struct bpf_insn *insns, u_int extent)
+{
+	j->pos = 0;
+	EMIT3(j, 0x41, 0x89, 0xd2);		/* mov %edx, %r10d */
+	EMIT3(j, 0x49, 0x89, 0xcb);		/* mov %rcx, %r11 */
+	EMIT2(j, 0x31, 0xc0);			/* xor %eax, %eax */
+	EMIT3(j, 0x45, 0x31, 0xc0);		/* xor %r8d, %r8d */
+
+	if (extent != 0) {
+		/*
+		 * Run the copy without checks if there's enough of
+		 * the packet, and otherwise the one with them, which
+		 * follows it.
+		 */
+		jit_cmp_len(j, extent);
+		jit_jump_slot(j, CC_B, 0, j->len);
+		j->base = 0;
+		j->check = 0;
+		if (jit_copy(j, insns) == -1)
+			return -1;
+		j->base = j->len;
+	} else
+		j->base = 0;
+	j->check = 1;
+	if (jit_copy(j, insns) == -1)
+		return -1;
+
+	/*
+	 * Packets whose loads run off the end of the captured data
+	 * come here, and are rejected.
+	 */
+	j->addr[j->reject] = j->pos;
+	EMIT2(j, 0x31, 0xc0);			/* xor %eax, %eax */
+	EMIT1(j, 0xc3);				/* ret */
+	return 0;
+}
+
+/*
+ * Compile a program that has passed bpf_validate().  Returns NULL if
+ * the program can't be compiled, memory for it can't be made
+ * executable, or the compiler has been turned off, in which case it
+ * has to be interpreted.
+ */
+bpf_jit_filter_t
+bpf_jit_compile(const struct bpf_insn *insns, u_int len)
+{
+	struct jit j;
+	u_int extent, nslots, *sizing, *final, *addr;
+	size_t size;
+	u_char *mem;
+	bpf_jit_filter_t filter = NULL;
+
+	if (getenv("PCAP_NO_BPF_JIT") != NULL)
+		return NULL;
+
+	extent = bpf_abs_load_extent(insns, len);
+	if (extent > JIT_MAX_OFFSET)
+		extent = 0;
+	nslots = (extent != 0 ? 2 * len : len) + 1;
+	sizing = malloc(3 * nslots * sizeof(u_int));
+	if (sizing == NULL)
+		return NULL;
+	final = sizing + nslots;
+	addr = final + nslots;
+
+	memset(&j, 0, sizeof(j));
+	j.len = len;
+	j.reject = nslots - 1;
+	j.addr = sizing;
+	if (jit_pass(&j, insns, extent) == -1)
+		goto done;
+
+	j.sizing = sizing;
+	j.addr = final;
+	(void)jit_pass(&j, insns, extent);
+
+	size = JIT_HDR_LEN + j.pos;
+	mem = mmap(NULL, size, PROT_READ|PROT_WRITE,
+	    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		goto done;
+	memcpy(mem, &size, sizeof(size));
+
+	j.buf = mem + JIT_HDR_LEN;
+	j.final = final;
+	j.addr = addr;
+	(void)jit_pass(&j, insns, extent);
+	if (JIT_HDR_LEN + j.pos != size ||
+	    memcmp(addr, final, nslots * sizeof(u_int)) != 0 ||
+	    mprotect(mem, size, PROT_READ|PROT_EXEC) == -1) {
+		munmap(mem, size);
+		goto done;
+	}
+	filter = (bpf_jit_filter_t)(void *)j.buf;
+done:
+	free(sizing);
+	return filter;
+}
+
+void
+bpf_jit_free(bpf_jit_filter_t filter)
+{
+	u_char *mem = (u_char *)(void *)filter - JIT_HDR_LEN;
+	size_t size;
+
+	memcpy(&size, mem, sizeof(size));
+	munmap(mem, size);
+}
+
+#else /* defined(__x86_64__) && !defined(WIN32) && !defined(NO_BPF_JIT) */
+
+bpf_jit_filter_t
+bpf_jit_compile(const struct bpf_insn *insns _U_, u_int len _U_)
+{
+	return NULL;
+}
+
+void
+bpf_jit_free(bpf_jit_filter_t filter _U_)
+{
+}
+
+#endif /* defined(__x86_64__) && !defined(WIN32) && !defined(NO_BPF_JIT) */
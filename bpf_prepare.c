@@ -0,0 +1,660 @@
+/*
+ * Copyright (c) 2026 The Tcpdump Group
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Prepare BPF programs for a faster interpreter, for when they can't
+ * be compiled to native code by bpf_jit_compile(), because we don't
+ * have a compiler for the architecture, or because the system won't
+ * let us make memory executable.
+ *
+ * The program is decoded once, into an array of instructions each
+ * holding the address of the code that executes it and, for jumps,
+ * pointers to their targets, so that running it costs one indirect
+ * jump per instruction rather than a switch on the opcode.
+ *
+ * Decoding also does a simple data flow analysis, working out how many
+ * bytes of the packet the loads on every path to an instruction have
+ * already shown to be present; loads that don't need any more than
+ * that don't check the length again.
+ *
+ * If bpf_abs_load_extent() says how much of the packet the program's
+ * absolute loads can look at, there's also a copy of the decoded
+ * program in which none of those loads check the length, run when
+ * that much of the packet was captured.
+ *
+ * This needs the GCC "labels as values" extension; without it,
+ * bpf_prepare() returns NULL, and the caller uses
+ * bpf_filter_with_aux_data().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap-int.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <linux/types.h>
+#include <linux/filter.h>
+#endif
+
+#ifdef __GNUC__
+
+#define EXTRACT_SHORT(p) \
+	((u_int)(p)[0] << 8 | (u_int)(p)[1])
+#define EXTRACT_LONG(p) \
+	((bpf_u_int32)(p)[0] << 24 | (bpf_u_int32)(p)[1] << 16 | \
+	 (bpf_u_int32)(p)[2] << 8 | (bpf_u_int32)(p)[3])
+
+/*
+ * Operations of the decoded program.  Loads with a "_NC" suffix don't
+ * check the packet length.
+ */
+enum bpf_prep_op {
+	OP_RET_K, OP_RET_A,
+	OP_LD_W_ABS, OP_LD_H_ABS, OP_LD_B_ABS,
+	OP_LD_W_ABS_NC, OP_LD_H_ABS_NC, OP_LD_B_ABS_NC,
+	OP_LD_VLAN_TAG, OP_LD_VLAN_TAG_PRESENT,
+	OP_LD_W_IND, OP_LD_H_IND, OP_LD_B_IND,
+	OP_LDX_MSH, OP_LDX_MSH_NC,
+	OP_LD_LEN, OP_LDX_LEN, OP_LD_IMM, OP_LDX_IMM,
+	OP_LD_MEM, OP_LDX_MEM, OP_ST, OP_STX,
+	OP_JA,
+	OP_JGT_K, OP_JGE_K, OP_JEQ_K, OP_JSET_K,
+	OP_JGT_X, OP_JGE_X, OP_JEQ_X, OP_JSET_X,
+	OP_ADD_K, OP_SUB_K, OP_MUL_K, OP_DIV_K, OP_MOD_K,
+	OP_AND_K, OP_OR_K, OP_XOR_K, OP_LSH_K, OP_RSH_K,
+	OP_ADD_X, OP_SUB_X, OP_MUL_X, OP_DIV_X, OP_MOD_X,
+	OP_AND_X, OP_OR_X, OP_XOR_X, OP_LSH_X, OP_RSH_X,
+	OP_NEG, OP_TAX, OP_TXA,
+	OP_COUNT
+};
+
+struct bpf_prep_insn {
+	const void *handler;		/* code that executes it */
+	bpf_u_int32 k;
+	const struct bpf_prep_insn *jt;	/* targets, for jumps */
+	const struct bpf_prep_insn *jf;
+};
+
+struct bpf_prepared {
+	u_int len;
+	u_int fast_len;		/* captured length "fast" needs, if any */
+	const struct bpf_prep_insn *fast; /* copy without checks, or NULL */
+	struct bpf_prep_insn insns[1];	/* actually "len", or twice that */
+};
+
+/*
+ * Run a prepared program; if "handlersp" isn't null, just hand back
+ * the table of addresses of the code for each operation, which can't
+ * be had from outside the function.
+ */
+static u_int
+bpf_run_prepared(const struct bpf_prepared *prog, const u_char *p,
+    u_int wirelen, u_int buflen, const struct bpf_aux_data *aux_data,
+    const void *const **handlersp)
+{
+	static const void *const handlers[OP_COUNT] = {
+		[OP_RET_K] = &&op_ret_k,
+		[OP_RET_A] = &&op_ret_a,
+		[OP_LD_W_ABS] = &&op_ld_w_abs,
+		[OP_LD_H_ABS] = &&op_ld_h_abs,
+		[OP_LD_B_ABS] = &&op_ld_b_abs,
+		[OP_LD_W_ABS_NC] = &&op_ld_w_abs_nc,
+		[OP_LD_H_ABS_NC] = &&op_ld_h_abs_nc,
+		[OP_LD_B_ABS_NC] = &&op_ld_b_abs_nc,
+		[OP_LD_VLAN_TAG] = &&op_ld_vlan_tag,
+		[OP_LD_VLAN_TAG_PRESENT] = &&op_ld_vlan_tag_present,
+		[OP_LD_W_IND] = &&op_ld_w_ind,
+		[OP_LD_H_IND] = &&op_ld_h_ind,
+		[OP_LD_B_IND] = &&op_ld_b_ind,
+		[OP_LDX_MSH] = &&op_ldx_msh,
+		[OP_LDX_MSH_NC] = &&op_ldx_msh_nc,
+		[OP_LD_LEN] = &&op_ld_len,
+		[OP_LDX_LEN] = &&op_ldx_len,
+		[OP_LD_IMM] = &&op_ld_imm,
+		[OP_LDX_IMM] = &&op_ldx_imm,
+		[OP_LD_MEM] = &&op_ld_mem,
+		[OP_LDX_MEM] = &&op_ldx_mem,
+		[OP_ST] = &&op_st,
+		[OP_STX] = &&op_stx,
+		[OP_JA] = &&op_ja,
+		[OP_JGT_K] = &&op_jgt_k,
+		[OP_JGE_K] = &&op_jge_k,
+		[OP_JEQ_K] = &&op_jeq_k,
+		[OP_JSET_K] = &&op_jset_k,
+		[OP_JGT_X] = &&op_jgt_x,
+		[OP_JGE_X] = &&op_jge_x,
+		[OP_JEQ_X] = &&op_jeq_x,
+		[OP_JSET_X] = &&op_jset_x,
+		[OP_ADD_K] = &&op_add_k,
+		[OP_SUB_K] = &&op_sub_k,
+		[OP_MUL_K] = &&op_mul_k,
+		[OP_DIV_K] = &&op_div_k,
+		[OP_MOD_K] = &&op_mod_k,
+		[OP_AND_K] = &&op_and_k,
+		[OP_OR_K] = &&op_or_k,
+		[OP_XOR_K] = &&op_xor_k,
+		[OP_LSH_K] = &&op_lsh_k,
+		[OP_RSH_K] = &&op_rsh_k,
+		[OP_ADD_X] = &&op_add_x,
+		[OP_SUB_X] = &&op_sub_x,
+		[OP_MUL_X] = &&op_mul_x,
+		[OP_DIV_X] = &&op_div_x,
+		[OP_MOD_X] = &&op_mod_x,
+		[OP_AND_X] = &&op_and_x,
+		[OP_OR_X] = &&op_or_x,
+		[OP_XOR_X] = &&op_xor_x,
+		[OP_LSH_X] = &&op_lsh_x,
+		[OP_RSH_X] = &&op_rsh_x,
+		[OP_NEG] = &&op_neg,
+		[OP_TAX] = &&op_tax,
+		[OP_TXA] = &&op_txa,
+	};
+	const struct bpf_prep_insn *pc;
+	bpf_u_int32 A = 0, X = 0, k;
+	bpf_u_int32 mem[BPF_MEMWORDS];
+
+	if (handlersp != NULL) {
+		*handlersp = handlers;
+		return 0;
+	}
+
+#define NEXT()		goto *(++pc)->handler
+#define BRANCH(c)	do { pc = (c) ? pc->jt : pc->jf; \
+			     goto *pc->handler; } while (0)
+
+	if (prog->fast != NULL && buflen >= prog->fast_len)
+		pc = prog->fast;
+	else
+		pc = prog->insns;
+	goto *pc->handler;
+
+op_ret_k:
+	return pc->k;
+op_ret_a:
+	return A;
+
+op_ld_w_abs:
+	k = pc->k;
+	if (k > buflen || sizeof(int32_t) > buflen - k)
+		return 0;
+	A = EXTRACT_LONG(&p[k]);
+	NEXT();
+op_ld_h_abs:
+	k = pc->k;
+	if (k > buflen || sizeof(int16_t) > buflen - k)
+		return 0;
+	A = EXTRACT_SHORT(&p[k]);
+	NEXT();
+op_ld_b_abs:
+	k = pc->k;
+	if (k >= buflen)
+		return 0;
+	A = p[k];
+	NEXT();
+op_ld_w_abs_nc:
+	A = EXTRACT_LONG(&p[pc->k]);
+	NEXT();
+op_ld_h_abs_nc:
+	A = EXTRACT_SHORT(&p[pc->k]);
+	NEXT();
+op_ld_b_abs_nc:
+	A = p[pc->k];
+	NEXT();
+op_ld_vlan_tag:
+	if (aux_data == NULL)
+		return 0;
+	A = aux_data->vlan_tag;
+	NEXT();
+op_ld_vlan_tag_present:
+	if (aux_data == NULL)
+		return 0;
+	A = aux_data->vlan_tag_present;
+	NEXT();
+
+op_ld_w_ind:
+	k = X + pc->k;
+	if (pc->k > buflen || X > buflen - pc->k ||
+	    sizeof(int32_t) > buflen - k)
+		return 0;
+	A = EXTRACT_LONG(&p[k]);
+	NEXT();
+op_ld_h_ind:
+	k = X + pc->k;
+	if (X > buflen || pc->k > buflen - X ||
+	    sizeof(int16_t) > buflen - k)
+		return 0;
+	A = EXTRACT_SHORT(&p[k]);
+	NEXT();
+op_ld_b_ind:
+	k = X + pc->k;
+	if (pc->k >= buflen || X >= buflen - pc->k)
+		return 0;
+	A = p[k];
+	NEXT();
+op_ldx_msh:
+	k = pc->k;
+	if (k >= buflen)
+		return 0;
+	X = (p[k] & 0xf) << 2;
+	NEXT();
+op_ldx_msh_nc:
+	X = (p[pc->k] & 0xf) << 2;
+	NEXT();
+
+op_ld_len:
+	A = wirelen;
+	NEXT();
+op_ldx_len:
+	X = wirelen;
+	NEXT();
+op_ld_imm:
+	A = pc->k;
+	NEXT();
+op_ldx_imm:
+	X = pc->k;
+	NEXT();
+op_ld_mem:
+	A = mem[pc->k];
+	NEXT();
+op_ldx_mem:
+	X = mem[pc->k];
+	NEXT();
+op_st:
+	mem[pc->k] = A;
+	NEXT();
+op_stx:
+	mem[pc->k] = X;
+	NEXT();
+
+op_ja:
+	pc = pc->jt;
+	goto *pc->handler;
+op_jgt_k:
+	BRANCH(A > pc->k);
+op_jge_k:
+	BRANCH(A >= pc->k);
+op_jeq_k:
+	BRANCH(A == pc->k);
+op_jset_k:
+	BRANCH(A & pc->k);
+op_jgt_x:
+	BRANCH(A > X);
+op_jge_x:
+	BRANCH(A >= X);
+op_jeq_x:
+	BRANCH(A == X);
+op_jset_x:
+	BRANCH(A & X);
+
+op_add_k:
+	A += pc->k;
+	NEXT();
+op_sub_k:
+	A -= pc->k;
+	NEXT();
+op_mul_k:
+	A *= pc->k;
+	NEXT();
+op_div_k:
+	A /= pc->k;
+	NEXT();
+op_mod_k:
+	A %= pc->k;
+	NEXT();
+op_and_k:
+	A &= pc->k;
+	NEXT();
+op_or_k:
+	A |= pc->k;
+	NEXT();
+op_xor_k:
+	A ^= pc->k;
+	NEXT();
+op_lsh_k:
+	A <<= pc->k;
+	NEXT();
+op_rsh_k:
+	A >>= pc->k;
+	NEXT();
+op_add_x:
+	A += X;
+	NEXT();
+op_sub_x:
+	A -= X;
+	NEXT();
+op_mul_x:
+	A *= X;
+	NEXT();
+op_div_x:
+	if (X == 0)
+		return 0;
+	A /= X;
+	NEXT();
+op_mod_x:
+	if (X == 0)
+		return 0;
+	A %= X;
+	NEXT();
+op_and_x:
+	A &= X;
+	NEXT();
+op_or_x:
+	A |= X;
+	NEXT();
+op_xor_x:
+	A ^= X;
+	NEXT();
+op_lsh_x:
+	A <<= X;
+	NEXT();
+op_rsh_x:
+	A >>= X;
+	NEXT();
+op_neg:
+	A = -A;
+	NEXT();
+op_tax:
+	X = A;
+	NEXT();
+op_txa:
+	A = X;
+	NEXT();
+
+#undef NEXT
+#undef BRANCH
+}
+
+u_int
+bpf_filter_prepared(const struct bpf_prepared *prog, const u_char *p,
+    u_int wirelen, u_int buflen, const struct bpf_aux_data *aux_data)
+{
+	return bpf_run_prepared(prog, p, wirelen, buflen, aux_data, NULL);
+}
+
+/*
+ * Note that an instruction can be reached with the first "known"
+ * bytes of the packet shown to be present.
+ */
+static void
+bpf_prep_reach(u_int *known, u_int to, u_int len)
+{
+	if (known[to] > len)
+		known[to] = len;
+}
+
+/*
+ * Decode a program that has passed bpf_validate().  Returns NULL if
+ * it has an instruction we don't handle, or we run out of memory, in
+ * which case it has to be run by bpf_filter_with_aux_data().
+ */
+struct bpf_prepared *
+bpf_prepare(const struct bpf_insn *insns, u_int len)
+{
+	const void *const *handlers;
+	struct bpf_prepared *prog;
+	struct bpf_prep_insn *pi, *fi;
+	const struct bpf_insn *ins;
+	u_int *known, i, size, have, op, fast_op, target, extent;
+
+	(void)bpf_run_prepared(NULL, NULL, 0, 0, NULL, &handlers);
+
+	extent = bpf_abs_load_extent(insns, len);
+	prog = malloc(sizeof(*prog) +
+	    (extent != 0 ? 2 * len : len) * sizeof(prog->insns[0]));
+	known = malloc(len * sizeof(*known));
+	if (prog == NULL || known == NULL) {
+		free(prog);
+		free(known);
+		return NULL;
+	}
+	prog->len = len;
+	prog->fast_len = extent;
+	prog->fast = extent != 0 ? &prog->insns[len] : NULL;
+
+	/*
+	 * Until we've seen a path to an instruction, nothing is known
+	 * to be present on the way to it (it may not be reachable);
+	 * we never know anything on the way to the target of a backward
+	 * jump, as we haven't seen every path to it before we get to it.
+	 */
+	for (i = 0; i < len; i++)
+		known[i] = UINT_MAX;
+	known[0] = 0;
+	for (i = 0; i < len; i++) {
+		ins = &insns[i];
+		if (ins->code == (BPF_JMP|BPF_JA) && (bpf_int32)ins->k < 0)
+			known[i + 1 + (bpf_int32)ins->k] = 0;
+	}
+
+	for (i = 0; i < len; i++) {
+		ins = &insns[i];
+		pi = &prog->insns[i];
+		pi->k = ins->k;
+		pi->jt = pi->jf = NULL;
+		have = known[i] == UINT_MAX ? 0 : known[i];
+		size = 0;
+
+		switch (ins->code) {
+
+		case BPF_RET|BPF_K:		op = OP_RET_K; break;
+		case BPF_RET|BPF_A:		op = OP_RET_A; break;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+			op = OP_LD_W_ABS;
+			size = 4;
+			break;
+
+		case BPF_LD|BPF_H|BPF_ABS:
+			op = OP_LD_H_ABS;
+			size = 2;
+			break;
+
+		case BPF_LD|BPF_B|BPF_ABS:
+#if defined(SKF_AD_VLAN_TAG) && defined(SKF_AD_VLAN_TAG_PRESENT)
+			if (ins->k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG)) {
+				op = OP_LD_VLAN_TAG;
+				break;
+			}
+			if (ins->k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT)) {
+				op = OP_LD_VLAN_TAG_PRESENT;
+				break;
+			}
+#endif
+			op = OP_LD_B_ABS;
+			size = 1;
+			break;
+
+		/*
+		 * An indexed load that succeeds shows that at least
+		 * the bytes it would have loaded with X 0 are present.
+		 */
+		case BPF_LD|BPF_W|BPF_IND:
+			op = OP_LD_W_IND;
+			size = 4;
+			break;
+
+		case BPF_LD|BPF_H|BPF_IND:
+			op = OP_LD_H_IND;
+			size = 2;
+			break;
+
+		case BPF_LD|BPF_B|BPF_IND:
+			op = OP_LD_B_IND;
+			size = 1;
+			break;
+
+		case BPF_LDX|BPF_MSH|BPF_B:
+			op = OP_LDX_MSH;
+			size = 1;
+			break;
+
+		case BPF_LD|BPF_W|BPF_LEN:	op = OP_LD_LEN; break;
+		case BPF_LDX|BPF_W|BPF_LEN:	op = OP_LDX_LEN; break;
+		case BPF_LD|BPF_IMM:		op = OP_LD_IMM; break;
+		case BPF_LDX|BPF_IMM:		op = OP_LDX_IMM; break;
+		case BPF_LD|BPF_MEM:		op = OP_LD_MEM; break;
+		case BPF_LDX|BPF_MEM:		op = OP_LDX_MEM; break;
+		case BPF_ST:			op = OP_ST; break;
+		case BPF_STX:			op = OP_STX; break;
+		case BPF_JMP|BPF_JA:		op = OP_JA; break;
+		case BPF_JMP|BPF_JGT|BPF_K:	op = OP_JGT_K; break;
+		case BPF_JMP|BPF_JGE|BPF_K:	op = OP_JGE_K; break;
+		case BPF_JMP|BPF_JEQ|BPF_K:	op = OP_JEQ_K; break;
+		case BPF_JMP|BPF_JSET|BPF_K:	op = OP_JSET_K; break;
+		case BPF_JMP|BPF_JGT|BPF_X:	op = OP_JGT_X; break;
+		case BPF_JMP|BPF_JGE|BPF_X:	op = OP_JGE_X; break;
+		case BPF_JMP|BPF_JEQ|BPF_X:	op = OP_JEQ_X; break;
+		case BPF_JMP|BPF_JSET|BPF_X:	op = OP_JSET_X; break;
+		case BPF_ALU|BPF_ADD|BPF_K:	op = OP_ADD_K; break;
+		case BPF_ALU|BPF_SUB|BPF_K:	op = OP_SUB_K; break;
+		case BPF_ALU|BPF_MUL|BPF_K:	op = OP_MUL_K; break;
+		case BPF_ALU|BPF_DIV|BPF_K:	op = OP_DIV_K; break;
+		case BPF_ALU|BPF_MOD|BPF_K:	op = OP_MOD_K; break;
+		case BPF_ALU|BPF_AND|BPF_K:	op = OP_AND_K; break;
+		case BPF_ALU|BPF_OR|BPF_K:	op = OP_OR_K; break;
+		case BPF_ALU|BPF_XOR|BPF_K:	op = OP_XOR_K; break;
+		case BPF_ALU|BPF_LSH|BPF_K:	op = OP_LSH_K; break;
+		case BPF_ALU|BPF_RSH|BPF_K:	op = OP_RSH_K; break;
+		case BPF_ALU|BPF_ADD|BPF_X:	op = OP_ADD_X; break;
+		case BPF_ALU|BPF_SUB|BPF_X:	op = OP_SUB_X; break;
+		case BPF_ALU|BPF_MUL|BPF_X:	op = OP_MUL_X; break;
+		case BPF_ALU|BPF_DIV|BPF_X:	op = OP_DIV_X; break;
+		case BPF_ALU|BPF_MOD|BPF_X:	op = OP_MOD_X; break;
+		case BPF_ALU|BPF_AND|BPF_X:	op = OP_AND_X; break;
+		case BPF_ALU|BPF_OR|BPF_X:	op = OP_OR_X; break;
+		case BPF_ALU|BPF_XOR|BPF_X:	op = OP_XOR_X; break;
+		case BPF_ALU|BPF_LSH|BPF_X:	op = OP_LSH_X; break;
+		case BPF_ALU|BPF_RSH|BPF_X:	op = OP_RSH_X; break;
+		case BPF_ALU|BPF_NEG:		op = OP_NEG; break;
+		case BPF_MISC|BPF_TAX:		op = OP_TAX; break;
+		case BPF_MISC|BPF_TXA:		op = OP_TXA; break;
+
+		default:
+			free(prog);
+			free(known);
+			return NULL;
+		}
+
+		/*
+		 * An absolute load of bytes already shown to be present
+		 * needn't check; a load that does check shows its bytes
+		 * to be present to everything after it.
+		 */
+		switch (op) {
+		case OP_LD_W_ABS: fast_op = OP_LD_W_ABS_NC; break;
+		case OP_LD_H_ABS: fast_op = OP_LD_H_ABS_NC; break;
+		case OP_LD_B_ABS: fast_op = OP_LD_B_ABS_NC; break;
+		case OP_LDX_MSH: fast_op = OP_LDX_MSH_NC; break;
+		default: fast_op = op; break;
+		}
+		if (size != 0 && ins->k <= UINT_MAX - size) {
+			if (ins->k + size <= have)
+				op = fast_op;
+			else
+				have = ins->k + size;
+		}
+		pi->handler = handlers[op];
+
+		switch (BPF_CLASS(ins->code)) {
+
+		case BPF_RET:
+			break;
+
+		case BPF_JMP:
+			if (op == OP_JA) {
+				target = i + 1 + (bpf_int32)ins->k;
+				pi->jt = &prog->insns[target];
+				bpf_prep_reach(known, target, have);
+			} else {
+				pi->jt = &prog->insns[i + 1 + ins->jt];
+				pi->jf = &prog->insns[i + 1 + ins->jf];
+				bpf_prep_reach(known, i + 1 + ins->jt, have);
+				bpf_prep_reach(known, i + 1 + ins->jf, have);
+			}
+			break;
+
+		default:
+			/*
+			 * bpf_validate() makes sure the program ends with
+			 * a return, so there's always a next instruction.
+			 */
+			bpf_prep_reach(known, i + 1, have);
+			break;
+		}
+
+		/*
+		 * The copy in which no absolute load checks jumps
+		 * within itself.
+		 */
+		if (prog->fast != NULL) {
+			fi = &prog->insns[len + i];
+			fi->handler = handlers[fast_op];
+			fi->k = pi->k;
+			fi->jt = pi->jt != NULL ? pi->jt + len : NULL;
+			fi->jf = pi->jf != NULL ? pi->jf + len : NULL;
+		}
+	}
+	free(known);
+	return prog;
+}
+
+void
+bpf_prepared_free(struct bpf_prepared *prog)
+{
+	free(prog);
+}
+
+#else /* __GNUC__ */
+
+struct bpf_prepared *
+bpf_prepare(const struct bpf_insn *insns _U_, u_int len _U_)
+{
+	return NULL;
+}
+
+u_int
+bpf_filter_prepared(const struct bpf_prepared *prog _U_,
+    const u_char *p _U_, u_int wirelen _U_, u_int buflen _U_,
+    const struct bpf_aux_data *aux_data _U_)
+{
+	return 0;
+}
+
+void
+bpf_prepared_free(struct bpf_prepared *prog _U_)
+{
+}
+
+#endif /* __GNUC__ */
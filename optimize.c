@@ -45,11 +45,17 @@
 #include <string.h>
 
 #include <errno.h>
+#include <limits.h>
 
 #include "pcap-int.h"
 
 #include "gencode.h"
 
+#ifdef __linux__
+#include <linux/types.h>
+#include <linux/filter.h>
+#endif
+
 #ifdef HAVE_OS_PROTO_H
 #include "os-proto.h"
 #endif
@@ -2203,6 +2209,107 @@ icode_to_fcode(struct block *root, u_int *lenp)
 	return fp;
 }
 
+/*
+ * Work out how many bytes of a packet have to have been captured for
+ * none of the absolute loads in a BPF program - the ones at a fixed
+ * offset - to run off the end of it, on any path through the program.
+ *
+ * Most filters look only at the first few dozen bytes of a packet, so,
+ * for most packets, the loads needn't check the length; bpf_jit_compile()
+ * and bpf_prepare() make a variant of the program whose absolute loads
+ * don't, and run it instead, after checking the length once, if at
+ * least this much of the packet was captured.
+ *
+ * Returns 0 if there are no absolute loads, or if they can't all
+ * succeed.
+ */
+u_int
+bpf_abs_load_extent(const struct bpf_insn *insns, u_int len)
+{
+	const struct bpf_insn *ins;
+	u_int *extent, i, e, size, changed;
+
+	extent = (u_int *)calloc(len, sizeof(*extent));
+	if (extent == NULL)
+		return 0;
+
+	/*
+	 * The extent for an instruction is the largest of the extents
+	 * of its own load, if any, and those for the instructions that
+	 * can follow it; go backwards through the program, and, as
+	 * "ip6 protochain" has backward jumps, repeat until nothing
+	 * changes.
+	 */
+	do {
+		changed = 0;
+		for (i = len; i-- != 0;) {
+			ins = &insns[i];
+			e = 0;
+			size = 0;
+			switch (ins->code) {
+
+			case BPF_LD|BPF_W|BPF_ABS:
+				size = 4;
+				break;
+
+			case BPF_LD|BPF_H|BPF_ABS:
+				size = 2;
+				break;
+
+			case BPF_LD|BPF_B|BPF_ABS:
+#if defined(SKF_AD_VLAN_TAG) && defined(SKF_AD_VLAN_TAG_PRESENT)
+				/*
+				 * These don't load from the packet.
+				 */
+				if (ins->k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG) ||
+				    ins->k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT))
+					break;
+#endif
+				size = 1;
+				break;
+
+			case BPF_LDX|BPF_MSH|BPF_B:
+				size = 1;
+				break;
+			}
+			if (size != 0) {
+				if (ins->k > UINT_MAX - size) {
+					free(extent);
+					return 0;
+				}
+				e = ins->k + size;
+			}
+
+			switch (BPF_CLASS(ins->code)) {
+
+			case BPF_RET:
+				break;
+
+			case BPF_JMP:
+				if (BPF_OP(ins->code) == BPF_JA)
+					e = MAX(e, extent[i + 1 + (bpf_int32)ins->k]);
+				else {
+					e = MAX(e, extent[i + 1 + ins->jt]);
+					e = MAX(e, extent[i + 1 + ins->jf]);
+				}
+				break;
+
+			default:
+				e = MAX(e, extent[i + 1]);
+				break;
+			}
+			if (e != extent[i]) {
+				extent[i] = e;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	e = extent[0];
+	free(extent);
+	return e;
+}
+
 /*
  * Make a copy of a BPF program and put it in the "fcode" member of
  * a "pcap_t".
@@ -2228,7 +2335,7 @@ install_bpf_program(pcap_t *p, struct bpf_program *fp)
 	/*
 	 * Free up any already installed program.
 	 */
-	pcap_freecode(&p->fcode);
+	free_bpf_program(p);
 
 	prog_size = sizeof(*fp->bf_insns) * fp->bf_len;
 	p->fcode.bf_len = fp->bf_len;
@@ -2239,9 +2346,37 @@ install_bpf_program(pcap_t *p, struct bpf_program *fp)
 		return (-1);
 	}
 	memcpy(p->fcode.bf_insns, fp->bf_insns, prog_size);
+
+	/*
+	 * Compile it to native code if we can; if we can't, decode it
+	 * for the threaded interpreter, and, if we can't do that
+	 * either, it's run by bpf_filter_with_aux_data().
+	 */
+	p->fcode_jit = bpf_jit_compile(p->fcode.bf_insns, p->fcode.bf_len);
+	if (p->fcode_jit == NULL)
+		p->fcode_prepared = bpf_prepare(p->fcode.bf_insns,
+		    p->fcode.bf_len);
 	return (0);
 }
 
+/*
+ * Free the program installed by install_bpf_program(), if any, and
+ * the native code or decoded form of it.
+ */
+void
+free_bpf_program(pcap_t *p)
+{
+	if (p->fcode_jit != NULL) {
+		bpf_jit_free(p->fcode_jit);
+		p->fcode_jit = NULL;
+	}
+	if (p->fcode_prepared != NULL) {
+		bpf_prepared_free(p->fcode_prepared);
+		p->fcode_prepared = NULL;
+	}
+	pcap_freecode(&p->fcode);
+}
+
 #ifdef BDEBUG
 static void
 opt_dump(struct block *root)
@@ -2636,7 +2636,7 @@ pcap_setfilter_bpf(pcap_t *p, struct bpf_program *fp)
 	/*
 	 * Free any user-mode filter we might happen to have installed.
 	 */
-	pcap_freecode(&p->fcode);
+	free_bpf_program(p);
 
 	/*
 	 * Try to install the kernel filter.
@@ -0,0 +1,858 @@
+/*
+ * Copyright (c) 2026 The Tcpdump Group
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Match packets against a set of BPF programs at once.
+ *
+ * Filters written for different purposes mostly start the same way -
+ * checking the link-layer type, then the network-layer protocol, then
+ * the transport-layer protocol - so, rather than running each program
+ * in turn, we merge them into one graph in which instructions that
+ * several programs have in common are run once.
+ *
+ * Each node of the graph stands for a group of programs that are all
+ * at the same instruction, having got there by running the same
+ * instructions from the start; they thus have the same accumulator,
+ * index register and scratch memory, and the node runs the instruction
+ * once for all of them.  The programs then go on to their next
+ * instructions; those whose next instructions are the same stay
+ * together, and, if they aren't all the same, the group splits, and
+ * each part is run in turn, starting with the same registers and
+ * memory.  A return instruction marks all of the programs in its group
+ * as matching if the value returned isn't zero, and a load beyond the
+ * end of the packet rejects the packet for all of them.
+ *
+ * A node is identified by the programs in its group and the instruction
+ * each of them is at, so where paths through the programs join, paths
+ * through the graph join too.  That keeps the graph about the size of
+ * the programs for the programs pcap_compile() generates; if, for some
+ * set of programs, it doesn't, we give up on merging, and run each
+ * program separately.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap-int.h"
+
+#ifdef NEED_STRERROR_H
+#include "strerror.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXTRACT_SHORT(p) \
+	((u_int)(p)[0] << 8 | (u_int)(p)[1])
+#define EXTRACT_LONG(p) \
+	((bpf_u_int32)(p)[0] << 24 | (bpf_u_int32)(p)[1] << 16 | \
+	 (bpf_u_int32)(p)[2] << 8 | (bpf_u_int32)(p)[3])
+
+/*
+ * Largest number of nodes, as a multiple of the total number of
+ * instructions in the programs, that we'll let merging produce.
+ */
+#define FS_MAX_GROWTH	4
+
+/*
+ * A node of the graph; "next" are offsets in the set's list array.
+ * For a conditional jump, next[0] is the list of nodes to run if the
+ * condition is true and next[1] the list if it's false; for a return,
+ * next[0] is the list of programs in the group; for anything else,
+ * next[0] is the list of nodes to run next.  Each list is a count
+ * followed by that many node or program indices.
+ */
+struct fs_node {
+	u_short code;
+	bpf_u_int32 k;
+	u_int next[2];
+};
+
+struct pcap_filterset {
+	struct bpf_program *progs;
+	u_int nprogs;
+	u_int maxprogs;
+	struct fs_node *nodes;	/* NULL if the programs aren't merged */
+	u_int *lists;
+	u_int start;		/* list of nodes with which to start */
+	char errbuf[PCAP_ERRBUF_SIZE];
+};
+
+/*
+ * A program in a group, and the instruction it's at.
+ */
+struct fs_pair {
+	u_short code;		/* instruction, for grouping */
+	bpf_u_int32 k;
+	u_int prog;
+	u_int pc;
+};
+
+/*
+ * State while making the graph.
+ */
+struct fs_build {
+	pcap_filterset_t *fs;
+	struct fs_node *nodes;
+	u_int nnodes;
+	u_int maxnodes;
+	u_int limit;		/* most nodes we'll make */
+	u_int *lists;
+	u_int nlists;
+	u_int maxlists;
+	struct fs_pair *keys;	/* the groups of the nodes, one after another */
+	u_int nkeys;
+	u_int maxkeys;
+	u_int *keyoff;		/* where each node's group starts in "keys" */
+	u_int *hash;		/* node index plus 1 for each group, or 0 */
+	u_int hashsize;
+	struct fs_pair *scratch; /* successors of the node being done */
+};
+
+/*
+ * The registers and memory of a group.
+ */
+struct fs_regs {
+	bpf_u_int32 A;
+	bpf_u_int32 X;
+	bpf_u_int32 mem[BPF_MEMWORDS];
+};
+
+pcap_filterset_t *
+pcap_filterset_create(char *errbuf)
+{
+	pcap_filterset_t *fs;
+
+	fs = calloc(1, sizeof(*fs));
+	if (fs == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	return (fs);
+}
+
+static void
+fs_free_graph(pcap_filterset_t *fs)
+{
+	free(fs->nodes);
+	free(fs->lists);
+	fs->nodes = NULL;
+	fs->lists = NULL;
+}
+
+void
+pcap_filterset_close(pcap_filterset_t *fs)
+{
+	u_int i;
+
+	for (i = 0; i < fs->nprogs; i++)
+		free(fs->progs[i].bf_insns);
+	free(fs->progs);
+	fs_free_graph(fs);
+	free(fs);
+}
+
+char *
+pcap_filterset_geterr(pcap_filterset_t *fs)
+{
+	return (fs->errbuf);
+}
+
+/*
+ * Add a copy of a program to the set; returns its index in the bitmaps
+ * pcap_filterset_match() fills in.
+ */
+int
+pcap_filterset_add(pcap_filterset_t *fs, const struct bpf_program *fp)
+{
+	struct bpf_program *progs;
+	struct bpf_insn *insns;
+	u_int maxprogs;
+	size_t prog_size;
+
+	if (!bpf_validate(fp->bf_insns, fp->bf_len)) {
+		snprintf(fs->errbuf, sizeof(fs->errbuf),
+		    "BPF program is not valid");
+		return (PCAP_ERROR);
+	}
+	if (fs->nprogs == fs->maxprogs) {
+		maxprogs = fs->maxprogs == 0 ? 16 : 2 * fs->maxprogs;
+		progs = realloc(fs->progs, maxprogs * sizeof(*progs));
+		if (progs == NULL) {
+			snprintf(fs->errbuf, sizeof(fs->errbuf),
+			    "malloc: %s", pcap_strerror(errno));
+			return (PCAP_ERROR);
+		}
+		fs->progs = progs;
+		fs->maxprogs = maxprogs;
+	}
+	prog_size = sizeof(*fp->bf_insns) * fp->bf_len;
+	insns = malloc(prog_size);
+	if (insns == NULL) {
+		snprintf(fs->errbuf, sizeof(fs->errbuf),
+		    "malloc: %s", pcap_strerror(errno));
+		return (PCAP_ERROR);
+	}
+	memcpy(insns, fp->bf_insns, prog_size);
+	fs->progs[fs->nprogs].bf_len = fp->bf_len;
+	fs->progs[fs->nprogs].bf_insns = insns;
+
+	/*
+	 * The graph doesn't include this program; it's run one by one
+	 * with the others until pcap_filterset_compile() is called.
+	 */
+	fs_free_graph(fs);
+	return (fs->nprogs++);
+}
+
+/*
+ * Make sure there's room for "n" more elements of size "size" in the
+ * array "*arrayp", which has "used" of "*maxp" elements in use.
+ */
+static int
+fs_reserve(void *arrayp, u_int *maxp, u_int used, u_int n, size_t size)
+{
+	void *array;
+	u_int max;
+
+	if (used + n <= *maxp)
+		return (0);
+	max = *maxp == 0 ? 64 : *maxp;
+	while (used + n > max)
+		max *= 2;
+	array = realloc(*(void **)arrayp, max * size);
+	if (array == NULL)
+		return (-1);
+	*(void **)arrayp = array;
+	*maxp = max;
+	return (0);
+}
+
+/*
+ * Fill in the pair for program "prog" at instruction "pc", skipping
+ * forward unconditional jumps, which do nothing but move on.
+ */
+static void
+fs_pair(const pcap_filterset_t *fs, struct fs_pair *pair, u_int prog,
+    u_int pc)
+{
+	const struct bpf_insn *insns = fs->progs[prog].bf_insns;
+
+	while (insns[pc].code == (BPF_JMP|BPF_JA) &&
+	    (bpf_int32)insns[pc].k >= 0)
+		pc += 1 + insns[pc].k;
+	pair->code = insns[pc].code;
+	/*
+	 * Backward jumps from different programs do the same thing
+	 * whatever their offsets.
+	 */
+	pair->k = pair->code == (BPF_JMP|BPF_JA) ? 0 : insns[pc].k;
+	pair->prog = prog;
+	pair->pc = pc;
+}
+
+/*
+ * Order pairs by instruction, so that programs at the same instruction
+ * are next to each other, and then by program, so that each group's
+ * pairs are always in the same order.
+ */
+static int
+fs_pair_cmp(const void *a, const void *b)
+{
+	const struct fs_pair *pa = a, *pb = b;
+
+	if (pa->code != pb->code)
+		return (pa->code < pb->code ? -1 : 1);
+	if (pa->k != pb->k)
+		return (pa->k < pb->k ? -1 : 1);
+	if (pa->prog != pb->prog)
+		return (pa->prog < pb->prog ? -1 : 1);
+	return (0);
+}
+
+static u_int
+fs_hash(const struct fs_pair *pairs, u_int n)
+{
+	u_int i, h = 2166136261U;
+
+	for (i = 0; i < n; i++) {
+		h = (h ^ pairs[i].prog) * 16777619U;
+		h = (h ^ pairs[i].pc) * 16777619U;
+	}
+	return (h);
+}
+
+static int
+fs_same_group(const struct fs_pair *a, const struct fs_pair *b, u_int n)
+{
+	u_int i;
+
+	for (i = 0; i < n; i++) {
+		if (a[i].prog != b[i].prog || a[i].pc != b[i].pc)
+			return (0);
+	}
+	return (1);
+}
+
+/*
+ * Find the node for the group of "n" pairs at "pairs", making it if
+ * there isn't one yet; returns its index, or -1 if there's no memory
+ * or we'd have too many nodes.
+ */
+static int
+fs_node(struct fs_build *b, const struct fs_pair *pairs, u_int n)
+{
+	u_int *hash, hashsize, h, i, node, off;
+
+	/*
+	 * Keep the hash table at most half full.
+	 */
+	if (2 * (b->nnodes + 1) > b->hashsize) {
+		hashsize = b->hashsize == 0 ? 256 : 2 * b->hashsize;
+		hash = calloc(hashsize, sizeof(*hash));
+		if (hash == NULL)
+			return (-1);
+		for (node = 0; node < b->nnodes; node++) {
+			off = b->keyoff[node];
+			h = fs_hash(&b->keys[off], b->keyoff[node + 1] - off);
+			for (i = h & (hashsize - 1); hash[i] != 0;
+			    i = (i + 1) & (hashsize - 1))
+				;
+			hash[i] = node + 1;
+		}
+		free(b->hash);
+		b->hash = hash;
+		b->hashsize = hashsize;
+	}
+
+	h = fs_hash(pairs, n);
+	for (i = h & (b->hashsize - 1); b->hash[i] != 0;
+	    i = (i + 1) & (b->hashsize - 1)) {
+		node = b->hash[i] - 1;
+		off = b->keyoff[node];
+		if (b->keyoff[node + 1] - off == n &&
+		    fs_same_group(&b->keys[off], pairs, n))
+			return (node);
+	}
+
+	if (b->nnodes == b->limit)
+		return (-1);
+	if (fs_reserve(&b->nodes, &b->maxnodes, b->nnodes, 1,
+	    sizeof(*b->nodes)) == -1 ||
+	    fs_reserve(&b->keys, &b->maxkeys, b->nkeys, n,
+	    sizeof(*b->keys)) == -1)
+		return (-1);
+	node = b->nnodes++;
+	b->nodes[node].code = pairs[0].code;
+	b->nodes[node].k = pairs[0].k;
+	memcpy(&b->keys[b->nkeys], pairs, n * sizeof(*pairs));
+	b->nkeys += n;
+	b->keyoff[node + 1] = b->nkeys;
+	b->hash[i] = node + 1;
+	return (node);
+}
+
+/*
+ * Split "n" pairs into groups of programs at the same instruction, and
+ * make a list of the nodes for the groups; returns the list's offset,
+ * or -1 on failure.
+ */
+static int
+fs_split(struct fs_build *b, struct fs_pair *pairs, u_int n)
+{
+	u_int off, start, end;
+	int node;
+
+	if (fs_reserve(&b->lists, &b->maxlists, b->nlists, 1 + n,
+	    sizeof(*b->lists)) == -1)
+		return (-1);
+	off = b->nlists;
+	b->lists[off] = 0;
+
+	qsort(pairs, n, sizeof(*pairs), fs_pair_cmp);
+	for (start = 0; start < n; start = end) {
+		for (end = start + 1; end < n &&
+		    pairs[end].code == pairs[start].code &&
+		    pairs[end].k == pairs[start].k; end++)
+			;
+		node = fs_node(b, &pairs[start], end - start);
+		if (node == -1)
+			return (-1);
+		b->lists[off + 1 + b->lists[off]++] = node;
+	}
+	b->nlists = off + 1 + b->lists[off];
+	return (off);
+}
+
+/*
+ * Make the graph; returns -1 if there's no memory or it'd be too big.
+ */
+static int
+fs_build_graph(struct fs_build *b)
+{
+	pcap_filterset_t *fs = b->fs;
+	const struct fs_pair *group;
+	const struct bpf_insn *ins;
+	struct fs_node *node;
+	u_int i, n, j, nextpc, total;
+	int off;
+
+	total = 0;
+	for (i = 0; i < fs->nprogs; i++)
+		total += fs->progs[i].bf_len;
+	b->limit = FS_MAX_GROWTH * total;
+	b->keyoff = malloc((b->limit + 1) * sizeof(*b->keyoff));
+	b->scratch = malloc(fs->nprogs * sizeof(*b->scratch));
+	if (b->keyoff == NULL || b->scratch == NULL)
+		return (-1);
+	b->keyoff[0] = 0;
+
+	for (i = 0; i < fs->nprogs; i++)
+		fs_pair(fs, &b->scratch[i], i, 0);
+	off = fs_split(b, b->scratch, fs->nprogs);
+	if (off == -1)
+		return (-1);
+	fs->start = off;
+
+	/*
+	 * Nodes are made as they're first reached; work out where
+	 * each goes from in the order they were made, until there
+	 * aren't any new ones.
+	 */
+	for (i = 0; i < b->nnodes; i++) {
+		node = &b->nodes[i];
+		n = b->keyoff[i + 1] - b->keyoff[i];
+		switch (BPF_CLASS(node->code)) {
+
+		case BPF_RET:
+			if (fs_reserve(&b->lists, &b->maxlists, b->nlists,
+			    1 + n, sizeof(*b->lists)) == -1)
+				return (-1);
+			group = &b->keys[b->keyoff[i]];
+			node->next[0] = b->nlists;
+			b->lists[b->nlists++] = n;
+			for (j = 0; j < n; j++)
+				b->lists[b->nlists++] = group[j].prog;
+			break;
+
+		case BPF_JMP:
+			/*
+			 * "keys" and "nodes" can move as nodes are added,
+			 * so copy the group, and look the node up again
+			 * after adding them.
+			 */
+			memcpy(b->scratch, &b->keys[b->keyoff[i]],
+			    n * sizeof(*b->scratch));
+			for (j = 0; j < n; j++) {
+				ins = &fs->progs[b->scratch[j].prog].bf_insns[b->scratch[j].pc];
+				nextpc = b->scratch[j].pc + 1;
+				if (BPF_OP(ins->code) == BPF_JA)
+					nextpc += (bpf_int32)ins->k;
+				else
+					nextpc += ins->jt;
+				fs_pair(fs, &b->scratch[j], b->scratch[j].prog,
+				    nextpc);
+			}
+			off = fs_split(b, b->scratch, n);
+			if (off == -1)
+				return (-1);
+			b->nodes[i].next[0] = off;
+			if (BPF_OP(b->nodes[i].code) == BPF_JA)
+				break;
+
+			memcpy(b->scratch, &b->keys[b->keyoff[i]],
+			    n * sizeof(*b->scratch));
+			for (j = 0; j < n; j++) {
+				ins = &fs->progs[b->scratch[j].prog].bf_insns[b->scratch[j].pc];
+				fs_pair(fs, &b->scratch[j], b->scratch[j].prog,
+				    b->scratch[j].pc + 1 + ins->jf);
+			}
+			off = fs_split(b, b->scratch, n);
+			if (off == -1)
+				return (-1);
+			b->nodes[i].next[1] = off;
+			break;
+
+		default:
+			memcpy(b->scratch, &b->keys[b->keyoff[i]],
+			    n * sizeof(*b->scratch));
+			for (j = 0; j < n; j++)
+				fs_pair(fs, &b->scratch[j], b->scratch[j].prog,
+				    b->scratch[j].pc + 1);
+			off = fs_split(b, b->scratch, n);
+			if (off == -1)
+				return (-1);
+			b->nodes[i].next[0] = off;
+			break;
+		}
+	}
+	return (0);
+}
+
+/*
+ * Merge the programs in the set.  Returns 0, or PCAP_WARNING if we
+ * can't, in which case pcap_filterset_match() runs them one by one.
+ */
+int
+pcap_filterset_compile(pcap_filterset_t *fs)
+{
+	struct fs_build b;
+	int status;
+
+	fs_free_graph(fs);
+	if (fs->nprogs == 0)
+		return (0);
+	memset(&b, 0, sizeof(b));
+	b.fs = fs;
+	status = fs_build_graph(&b);
+	free(b.keys);
+	free(b.keyoff);
+	free(b.hash);
+	free(b.scratch);
+	if (status == -1) {
+		free(b.nodes);
+		free(b.lists);
+		snprintf(fs->errbuf, sizeof(fs->errbuf),
+		    "Filters can't be merged; they'll be run one by one");
+		return (PCAP_WARNING);
+	}
+	fs->nodes = b.nodes;
+	fs->lists = b.lists;
+	return (0);
+}
+
+/*
+ * Run the graph from "node", for a group with registers and memory
+ * "r", setting the bits of the matching programs in "bitmap".
+ */
+static void
+fs_run(const pcap_filterset_t *fs, u_int node, struct fs_regs *r,
+    const u_char *p, u_int wirelen, u_int buflen, bpf_u_int32 *bitmap)
+{
+	const struct fs_node *n;
+	const u_int *list;
+	struct fs_regs copy;
+	bpf_u_int32 k, ret;
+	u_int i, next;
+
+	for (;;) {
+		n = &fs->nodes[node];
+		k = n->k;
+		next = n->next[0];
+
+		switch (n->code) {
+
+		default:
+			return;
+
+		case BPF_RET|BPF_K:
+			ret = k;
+			goto ret;
+
+		case BPF_RET|BPF_A:
+			ret = r->A;
+		ret:
+			if (ret != 0) {
+				list = &fs->lists[next];
+				for (i = 1; i <= list[0]; i++)
+					bitmap[list[i] / 32] |=
+					    1U << (list[i] % 32);
+			}
+			return;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+			if (k > buflen || sizeof(int32_t) > buflen - k)
+				return;
+			r->A = EXTRACT_LONG(&p[k]);
+			break;
+
+		case BPF_LD|BPF_H|BPF_ABS:
+			if (k > buflen || sizeof(int16_t) > buflen - k)
+				return;
+			r->A = EXTRACT_SHORT(&p[k]);
+			break;
+
+		/*
+		 * With no auxiliary data, the Linux ancillary loads,
+		 * at offsets near the top of the range, fail, as they
+		 * do in bpf_filter().
+		 */
+		case BPF_LD|BPF_B|BPF_ABS:
+			if (k >= buflen)
+				return;
+			r->A = p[k];
+			break;
+
+		case BPF_LD|BPF_W|BPF_LEN:
+			r->A = wirelen;
+			break;
+
+		case BPF_LDX|BPF_W|BPF_LEN:
+			r->X = wirelen;
+			break;
+
+		case BPF_LD|BPF_W|BPF_IND:
+			if (k > buflen || r->X > buflen - k ||
+			    sizeof(int32_t) > buflen - k - r->X)
+				return;
+			r->A = EXTRACT_LONG(&p[r->X + k]);
+			break;
+
+		case BPF_LD|BPF_H|BPF_IND:
+			if (k > buflen || r->X > buflen - k ||
+			    sizeof(int16_t) > buflen - k - r->X)
+				return;
+			r->A = EXTRACT_SHORT(&p[r->X + k]);
+			break;
+
+		case BPF_LD|BPF_B|BPF_IND:
+			if (k >= buflen || r->X >= buflen - k)
+				return;
+			r->A = p[r->X + k];
+			break;
+
+		case BPF_LDX|BPF_MSH|BPF_B:
+			if (k >= buflen)
+				return;
+			r->X = (p[k] & 0xf) << 2;
+			break;
+
+		case BPF_LD|BPF_IMM:
+			r->A = k;
+			break;
+
+		case BPF_LDX|BPF_IMM:
+			r->X = k;
+			break;
+
+		case BPF_LD|BPF_MEM:
+			r->A = r->mem[k];
+			break;
+
+		case BPF_LDX|BPF_MEM:
+			r->X = r->mem[k];
+			break;
+
+		case BPF_ST:
+			r->mem[k] = r->A;
+			break;
+
+		case BPF_STX:
+			r->mem[k] = r->X;
+			break;
+
+		case BPF_JMP|BPF_JA:
+			break;
+
+		case BPF_JMP|BPF_JGT|BPF_K:
+			next = n->next[r->A > k ? 0 : 1];
+			break;
+
+		case BPF_JMP|BPF_JGE|BPF_K:
+			next = n->next[r->A >= k ? 0 : 1];
+			break;
+
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			next = n->next[r->A == k ? 0 : 1];
+			break;
+
+		case BPF_JMP|BPF_JSET|BPF_K:
+			next = n->next[(r->A & k) ? 0 : 1];
+			break;
+
+		case BPF_JMP|BPF_JGT|BPF_X:
+			next = n->next[r->A > r->X ? 0 : 1];
+			break;
+
+		case BPF_JMP|BPF_JGE|BPF_X:
+			next = n->next[r->A >= r->X ? 0 : 1];
+			break;
+
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			next = n->next[r->A == r->X ? 0 : 1];
+			break;
+
+		case BPF_JMP|BPF_JSET|BPF_X:
+			next = n->next[(r->A & r->X) ? 0 : 1];
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_X:
+			r->A += r->X;
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_X:
+			r->A -= r->X;
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_X:
+			r->A *= r->X;
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_X:
+			if (r->X == 0)
+				return;
+			r->A /= r->X;
+			break;
+
+		case BPF_ALU|BPF_MOD|BPF_X:
+			if (r->X == 0)
+				return;
+			r->A %= r->X;
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_X:
+			r->A &= r->X;
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_X:
+			r->A |= r->X;
+			break;
+
+		case BPF_ALU|BPF_XOR|BPF_X:
+			r->A ^= r->X;
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_X:
+			r->A <<= r->X;
+			break;
+
+		case BPF_ALU|BPF_RSH|BPF_X:
+			r->A >>= r->X;
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_K:
+			r->A += k;
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_K:
+			r->A -= k;
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_K:
+			r->A *= k;
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_K:
+			r->A /= k;
+			break;
+
+		case BPF_ALU|BPF_MOD|BPF_K:
+			r->A %= k;
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_K:
+			r->A &= k;
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_K:
+			r->A |= k;
+			break;
+
+		case BPF_ALU|BPF_XOR|BPF_K:
+			r->A ^= k;
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_K:
+			r->A <<= k;
+			break;
+
+		case BPF_ALU|BPF_RSH|BPF_K:
+			r->A >>= k;
+			break;
+
+		case BPF_ALU|BPF_NEG:
+			r->A = -r->A;
+			break;
+
+		case BPF_MISC|BPF_TAX:
+			r->X = r->A;
+			break;
+
+		case BPF_MISC|BPF_TXA:
+			r->A = r->X;
+			break;
+		}
+
+		/*
+		 * If the group splits, run all but the last part with
+		 * copies of the registers and memory, and carry on
+		 * with the last.
+		 */
+		list = &fs->lists[next];
+		for (i = 1; i < list[0]; i++) {
+			copy = *r;
+			fs_run(fs, list[i], &copy, p, wirelen, buflen, bitmap);
+		}
+		node = list[list[0]];
+	}
+}
+
+/*
+ * Set, in "bitmap", the bits for the programs in the set that match
+ * the packet, and clear the others; returns the number that match.
+ */
+int
+pcap_filterset_match(const pcap_filterset_t *fs, const struct pcap_pkthdr *h,
+    const u_char *pkt, bpf_u_int32 *bitmap)
+{
+	struct fs_regs r;
+	const u_int *list;
+	u_int i, nwords;
+	int count;
+
+	nwords = (fs->nprogs + 31) / 32;
+	memset(bitmap, 0, nwords * sizeof(*bitmap));
+	if (fs->nodes != NULL) {
+		list = &fs->lists[fs->start];
+		for (i = 1; i <= list[0]; i++) {
+			memset(&r, 0, sizeof(r));
+			fs_run(fs, list[i], &r, pkt, h->len, h->caplen,
+			    bitmap);
+		}
+	} else {
+		for (i = 0; i < fs->nprogs; i++) {
+			if (bpf_filter(fs->progs[i].bf_insns, pkt, h->len,
+			    h->caplen) != 0)
+				bitmap[i / 32] |= 1U << (i % 32);
+		}
+	}
+
+	count = 0;
+	for (i = 0; i < nwords; i++) {
+		bpf_u_int32 w = bitmap[i];
+
+		for (; w != 0; w &= w - 1)
+			count++;
+	}
+	return (count);
+}
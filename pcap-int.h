@@ -109,23 +109,46 @@ struct pcap_opt {
 	char	*source;
 	int	timeout;	/* timeout for buffering */
 	int	buffer_size;
+	int	tx_buffer_size;	/* size of buffer for queued packets to send */
 	int	promisc;
 	int	rfmon;		/* monitor mode */
 	int	immediate;	/* immediate mode - deliver packets as soon as they arrive */
+	int	hold_mode;	/* hold mode - packets stay valid until pcap_release() */
 	int	tstamp_type;
 	int	tstamp_precision;
+#ifdef __linux__
+	int	fanout_enabled;	/* join a PACKET_FANOUT group */
+	int	fanout_group;	/* PACKET_FANOUT group ID */
+	int	fanout_mode;	/* PCAP_FANOUT_ mode */
+	int	fanout_flags;	/* PCAP_FANOUT_FLAG_ flags */
+	int	busy_poll;	/* microseconds to spin before blocking; 0 = don't spin */
+	int	ring_block_size; /* TPACKET_V3 block size; 0 = default, -1 = auto */
+	int	ring_block_nr;	/* TPACKET_V3 block count; 0 = default, -1 = auto */
+	int	ring_retire_tov; /* TPACKET_V3 retire timeout in ms; 0 = default, -1 = auto */
+	int	numa_node;	/* NUMA node for the capture buffer, or PCAP_NUMA_NODE_ value */
+	int	hugepages;	/* use huge pages for capture buffers if possible */
+	int	vlan_metadata;	/* report VLAN tags as metadata, not in the packet */
+	int	multi_consumer;	/* several threads may read from the ring at once */
+	int	vnet_hdr;	/* get a virtio-net header with each packet */
+	int	resegment;	/* split aggregated packets into wire-sized segments */
+#endif
 };
 
 typedef int	(*activate_op_t)(pcap_t *);
 typedef int	(*can_set_rfmon_op_t)(pcap_t *);
 typedef int	(*read_op_t)(pcap_t *, int cnt, pcap_handler, u_char *);
 typedef int	(*inject_op_t)(pcap_t *, const void *, size_t);
+typedef int	(*inject_flush_op_t)(pcap_t *);
+typedef int	(*release_op_t)(pcap_t *, const u_char *);
 typedef int	(*setfilter_op_t)(pcap_t *, struct bpf_program *);
 typedef int	(*setdirection_op_t)(pcap_t *, pcap_direction_t);
 typedef int	(*set_datalink_op_t)(pcap_t *, int);
 typedef int	(*getnonblock_op_t)(pcap_t *, char *);
 typedef int	(*setnonblock_op_t)(pcap_t *, int, char *);
 typedef int	(*stats_op_t)(pcap_t *, struct pcap_stat *);
+typedef u_int	(*bpf_jit_filter_t)(const u_char *, u_int, u_int,
+		    const struct bpf_aux_data *);
+struct bpf_prepared;
 #ifdef WIN32
 typedef int	(*setbuff_op_t)(pcap_t *, int);
 typedef int	(*setmode_op_t)(pcap_t *, int);
@@ -211,6 +234,8 @@ struct pcap {
 	 * Placeholder for filter code if bpf not in kernel.
 	 */
 	struct bpf_program fcode;
+	bpf_jit_filter_t fcode_jit;	/* native code for it, if any */
+	struct bpf_prepared *fcode_prepared; /* else, decoded form, if any */
 
 	char errbuf[PCAP_ERRBUF_SIZE + 1];
 	int dlt_count;
@@ -222,12 +247,25 @@ struct pcap {
 
 	struct pcap_pkthdr pcap_header;	/* This is needed for the pcap_next_ex() to work */
 
+	/*
+	 * Storage for pcap_next_batch(): the headers of the packets in
+	 * the current batch and, if the packet data has to be copied,
+	 * the copies.
+	 */
+	struct pcap_pkthdr *batch_hdrs;
+	int batch_max;			/* number of headers allocated */
+	u_char *batch_buffer;
+	size_t batch_bufsize;
+
 	/*
 	 * More methods.
 	 */
 	activate_op_t activate_op;
 	can_set_rfmon_op_t can_set_rfmon_op;
 	inject_op_t inject_op;
+	inject_op_t inject_queue_op;
+	inject_flush_op_t inject_flush_op;
+	release_op_t release_op;
 	setfilter_op_t setfilter_op;
 	setdirection_op_t setdirection_op;
 	set_datalink_op_t set_datalink_op;
@@ -240,6 +278,13 @@ struct pcap {
 	 */
 	pcap_handler oneshot_callback;
 
+	/*
+	 * Routine to read packets for pcap_next_batch() on a live
+	 * capture, and routine to use as its callback.
+	 */
+	read_op_t read_batch_op;
+	pcap_handler batch_callback;
+
 #ifdef WIN32
 	/*
 	 * These are, at least currently, specific to the Win32 NPF
@@ -338,6 +383,18 @@ struct oneshot_userdata {
 	pcap_t *pd;
 };
 
+/*
+ * User data structure for the callback used for pcap_next_batch().
+ */
+struct batch_userdata {
+	struct pcap_pkthdr *hdrs;	/* headers of the packets in the batch */
+	const u_char **pkts;		/* data of the packets in the batch */
+	int cnt;			/* number of packets in the batch so far */
+	size_t used;			/* amount of p->batch_buffer used so far */
+	int nomem_errno;		/* errno from a failed realloc, or 0 */
+	pcap_t *pd;
+};
+
 int	yylex(void);
 
 #ifndef min
@@ -448,11 +505,62 @@ void	sf_cleanup(pcap_t *p);
  */
 void	pcap_oneshot(u_char *, const struct pcap_pkthdr *, const u_char *);
 
+/*
+ * "pcap_batch()" is the standard callback for "pcap_next_batch()"; it
+ * copies the packet data, so that it survives the reading of the
+ * following packets.
+ */
+void	pcap_batch(u_char *, const struct pcap_pkthdr *, const u_char *);
+
 #ifdef WIN32
 char	*pcap_win32strerror(void);
 #endif
 
 int	install_bpf_program(pcap_t *, struct bpf_program *);
+void	free_bpf_program(pcap_t *);
+u_int	bpf_abs_load_extent(const struct bpf_insn *, u_int);
+
+/*
+ * Run the filter installed by install_bpf_program() on a packet, using
+ * the native code it was compiled to if there is any, and otherwise
+ * the decoded form prepared for it if there is one.
+ */
+#define pcap_run_filter(p, pkt, wirelen, buflen, aux_data) \
+	((p)->fcode_jit != NULL ? \
+	    (p)->fcode_jit((pkt), (wirelen), (buflen), (aux_data)) : \
+	 (p)->fcode_prepared != NULL ? \
+	    bpf_filter_prepared((p)->fcode_prepared, (pkt), (wirelen), \
+	    (buflen), (aux_data)) : \
+	    bpf_filter_with_aux_data((p)->fcode.bf_insns, (pkt), (wirelen), \
+	    (buflen), (aux_data)))
+
+/*
+ * Routines in bpf_jit.c.  bpf_jit_compile() returns a function that
+ * does what bpf_filter_with_aux_data() does with the program handed
+ * to it, or NULL if it can't make one.
+ */
+bpf_jit_filter_t bpf_jit_compile(const struct bpf_insn *, u_int);
+void	bpf_jit_free(bpf_jit_filter_t);
+
+/*
+ * Routines in bpf_prepare.c.  bpf_prepare() decodes a program for
+ * bpf_filter_prepared(), which does what bpf_filter_with_aux_data()
+ * does with it, or returns NULL if it can't.
+ */
+struct bpf_prepared *bpf_prepare(const struct bpf_insn *, u_int);
+u_int	bpf_filter_prepared(const struct bpf_prepared *, const u_char *,
+	    u_int, u_int, const struct bpf_aux_data *);
+void	bpf_prepared_free(struct bpf_prepared *);
+
+/*
+ * Routines in bpf_batch.c.  bpf_batch_prepare() readies a program for
+ * bpf_filter_batch(), which does what bpf_filter() does with it for
+ * several packets at once, or returns NULL if it can't.
+ */
+struct bpf_batch *bpf_batch_prepare(const struct bpf_insn *, u_int);
+int	bpf_filter_batch(const struct bpf_batch *, struct pcap_pkthdr **,
+	    const u_char **, int, bpf_u_int32 *);
+void	bpf_batch_free(struct bpf_batch *);
 
 int	pcap_strcasecmp(const char *, const char *);
 
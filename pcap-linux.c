@@ -124,6 +124,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -136,7 +137,10 @@
 #include <linux/if_ether.h>
 #include <net/if_arp.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <dirent.h>
+#include <sys/syscall.h>
 
 #include "pcap-int.h"
 #include "pcap/sll.h"
@@ -185,6 +189,17 @@
 #  ifdef PACKET_AUXDATA
 #   define HAVE_PACKET_AUXDATA
 #  endif /* PACKET_AUXDATA */
+#  ifdef PACKET_FANOUT
+#   define HAVE_PACKET_FANOUT
+#  endif /* PACKET_FANOUT */
+#  if defined(HAVE_PACKET_AUXDATA) && defined(MSG_WAITFORONE)
+    /*
+     * recvmmsg() showed up at the same time as MSG_WAITFORONE,
+     * and we need that flag to use it.  We only use it on sockets
+     * that deliver PACKET_AUXDATA.
+     */
+#   define HAVE_RECVMMSG
+#  endif
 # endif /* PACKET_HOST */
 
 
@@ -213,6 +228,10 @@
 #include <linux/net_tstamp.h>
 #endif
 
+#ifdef PACKET_VNET_HDR
+#include <linux/virtio_net.h>
+#endif
+
 /*
  * Got Wireless Extensions?
  */
@@ -233,6 +252,31 @@
 #include <netlink/attr.h>
 #endif /* HAVE_LIBNL */
 
+/*
+ * We set NUMA memory policies with the system calls, rather than
+ * with libnuma.
+ */
+#if defined(__NR_set_mempolicy) && defined(__NR_get_mempolicy) && defined(__NR_mbind)
+#include <linux/mempolicy.h>
+#define HAVE_NUMA_SYSCALLS
+
+/*
+ * Node mask big enough for all the nodes the kernel can have.
+ */
+#define NUMA_MASK_LONGS	(1024 / (8 * sizeof(unsigned long)))
+#endif
+
+/*
+ * A thread's NUMA memory policy, saved so it can be restored.
+ */
+struct numa_policy {
+	int		set;	/* we changed the policy */
+#ifdef HAVE_NUMA_SYSCALLS
+	int		mode;
+	unsigned long	mask[NUMA_MASK_LONGS];
+#endif
+};
+
 /*
  * Got ethtool support?
  */
@@ -275,6 +319,84 @@ typedef int		socklen_t;
  */
 #define BIGGER_THAN_ALL_MTUS	(64*1024)
 
+#ifdef HAVE_RECVMMSG
+/*
+ * When reading packets with recvmmsg(), read at most RECV_BATCH_MAX
+ * packets per call, into at most RECV_BATCH_BUFSIZE bytes worth of
+ * packet slots.  Each slot is big enough for a snapshot-length
+ * packet, but the pages of a slot are only touched as far as the
+ * packets read into it go.
+ */
+#define RECV_BATCH_MAX		64
+#define RECV_BATCH_BUFSIZE	(16*1024*1024)
+#endif
+
+/*
+ * Space for the control messages we ask for when reading packets
+ * with recvmsg() or recvmmsg(); the time stamp, if we've asked for
+ * it, comes before the auxiliary data.
+ */
+#ifdef HAVE_PACKET_AUXDATA
+#define RECV_CMSG_SPACE \
+	(CMSG_SPACE(sizeof(struct timespec)) + \
+	 CMSG_SPACE(sizeof(struct tpacket_auxdata)))
+#endif
+
+/*
+ * Get the TPID of a packet's VLAN tag, given the ring frame header or
+ * auxiliary data holding its status, and the structure holding its
+ * VLAN tag fields.
+ */
+#ifdef TP_STATUS_VLAN_TPID_VALID
+#define VLAN_TPID(hdr, vlan_hdr) \
+	(((hdr)->tp_status & TP_STATUS_VLAN_TPID_VALID) ? \
+	    (vlan_hdr)->tp_vlan_tpid : ETH_P_8021Q)
+#else
+#define VLAN_TPID(hdr, vlan_hdr)	ETH_P_8021Q
+#endif
+
+/*
+ * Get the PCAP_META_ flags for a ring frame's time stamp, given its
+ * status.
+ */
+#ifdef TP_STATUS_TS_RAW_HARDWARE
+#define TS_META_FLAGS(status) \
+	(((status) & TP_STATUS_TS_RAW_HARDWARE) ? PCAP_META_HWTSTAMP : 0)
+#else
+#define TS_META_FLAGS(status)	0
+#endif
+
+#ifdef HAVE_RECVMMSG
+/*
+ * Per-message data for recvmmsg().
+ */
+struct recv_msg_aux {
+	struct sockaddr_ll	from;
+	struct iovec		iov;
+	union {
+		struct cmsghdr	cmsg;
+		char		buf[RECV_CMSG_SPACE];
+	} cmsg_buf;
+};
+#endif
+
+/*
+ * A segment of an aggregated packet split by pcap_resegment().
+ */
+struct reseg_seg {
+	struct pcap_pkthdr	hdr;
+	u_char			*data;
+};
+
+/*
+ * Limits for pcap_resegment(): the most segments we split a packet
+ * into, and the most bytes of link-layer, network-layer and transport-
+ * layer headers we copy into each of them.  Packets that would exceed
+ * them are handed to the callback unsplit.
+ */
+#define RESEG_MAX_SEGS	256
+#define RESEG_MAX_HDR	128
+
 /*
  * Private data for capturing on Linux SOCK_PACKET or PF_PACKET sockets.
  */
@@ -286,6 +408,7 @@ struct pcap_linux {
 	char	*device;	/* device name */
 	int	filter_in_userland; /* must filter in userland */
 	int	blocks_to_filter_in_userland;
+	__u64	filter_seq_num;	/* TPACKET_V3: last block that may need filtering in userland, or 0 */
 	int	must_do_on_close; /* stuff we must do when we close */
 	int	timeout;	/* timeout for buffering */
 	int	sock_packet;	/* using Linux 2.0 compatible interface */
@@ -300,6 +423,47 @@ struct pcap_linux {
 	u_int	tp_version;	/* version of tpacket_hdr for mmaped ring */
 	u_int	tp_hdrlen;	/* hdrlen of tpacket_hdr for mmaped ring */
 	u_char	*oneshot_buffer; /* buffer for copy of packet */
+	u_char	*tx_ring;	/* memory-mapped transmit ring, or NULL if none */
+	u_int	tx_block_size;	/* size of a block in the transmit ring */
+	u_int	tx_frame_size;	/* size of a frame in the transmit ring */
+	u_int	tx_frames_per_block;
+	u_int	tx_frame_nr;	/* number of frames in the transmit ring */
+	u_int	tx_offset;	/* index of the next frame to fill */
+	u_int	tx_queued;	/* frames queued since the last flush */
+	int	hold_frames;	/* keep frames we've read out of the kernel's hands */
+	int	held_offset;	/* ring position of the first frame we're holding */
+	int	held_count;	/* number of frames we're holding */
+	int	held_lock;	/* lock for held_offset and held_count */
+	int	release_fd;	/* in hold mode, eventfd signalled when frames are released */
+	u_int	busy_poll_hits;	/* waits satisfied while busy-polling */
+	u_int	busy_poll_sleeps; /* waits that blocked after busy-polling */
+	int	numa_node;	/* node on which to put buffers, or -1 */
+	struct pcap_pkt_meta pkt_meta; /* metadata for the last packet handed to the callback */
+	struct pcap_pkt_meta *batch_metas; /* metadata for pcap_next_batch_meta() */
+	int	batch_metas_max; /* number of entries allocated in batch_metas */
+	int	batch_metas_wanted; /* collecting metadata for a batch */
+	u_char	*mc_claimed;	/* per block, in multi-consumer mode: 1 if a thread has claimed it */
+	int	mc_next_block;	/* in multi-consumer mode, the next block to claim */
+	struct pcap_ring_stat ring_stat; /* statistics gathered from the ring */
+	int	ring_losing;	/* the last block read had TP_STATUS_LOSING set */
+	int	ring_full;	/* the ring was full when we started the last block */
+	u_int	block_meta_flags; /* PCAP_META_ flags for the next packet in the block */
+	u_int	vnet_hdr_len;	/* length of the virtio-net header before each packet in the ring, or 0 */
+	read_op_t reseg_read_op; /* routine pcap_read_linux_resegment() reads the ring with */
+	u_char	*reseg_arena;	/* segments of the last packet we split */
+	struct reseg_seg *reseg_segs; /* headers of, and pointers to, those segments */
+	int	reseg_count;	/* number of those segments */
+	int	reseg_next;	/* next of them to hand to the callback */
+	struct pcap_pkt_meta reseg_meta; /* metadata for those segments */
+#ifdef HAVE_RECVMMSG
+	int	recv_nr;	/* number of packets to read per recvmmsg(), or 0 */
+	size_t	recv_slot_size;	/* size of a packet slot in recv_buffer */
+	u_char	*recv_buffer;	/* packet slots for recvmmsg() */
+	size_t	recv_buffer_len; /* size of the mapping for those slots */
+	int	recv_buffer_huge; /* that mapping uses explicit huge pages */
+	struct mmsghdr *recv_msgs; /* message headers for recvmmsg() */
+	struct recv_msg_aux *recv_aux; /* addresses etc. for those headers */
+#endif
 #ifdef HAVE_TPACKET3
 	unsigned char *current_packet; /* Current packet within the TPACKET_V3 block. Move to next block if NULL. */
 	int packets_left; /* Unhandled packets left within the block from previous call to pcap_read_linux_mmap_v3 in case of TPACKET_V3. */
@@ -324,15 +488,24 @@ static int pcap_activate_linux(pcap_t *);
 static int activate_old(pcap_t *);
 static int activate_new(pcap_t *);
 static int activate_mmap(pcap_t *, int *);
+static int join_fanout_group(pcap_t *);
 static int pcap_can_set_rfmon_linux(pcap_t *);
 static int pcap_read_linux(pcap_t *, int, pcap_handler, u_char *);
 static int pcap_read_packet(pcap_t *, pcap_handler, u_char *);
+#ifdef HAVE_RECVMMSG
+static int pcap_read_packets_recvmmsg(pcap_t *, int, pcap_handler, u_char *);
+static int create_recv_batch(pcap_t *);
+#endif
+static int pcap_handle_packet_recv(pcap_t *, u_char *, int, struct msghdr *,
+    pcap_handler, u_char *);
 static int pcap_inject_linux(pcap_t *, const void *, size_t);
 static int pcap_stats_linux(pcap_t *, struct pcap_stat *);
 static int pcap_setfilter_linux(pcap_t *, struct bpf_program *);
 static int pcap_setdirection_linux(pcap_t *, pcap_direction_t);
 static int pcap_set_datalink_linux(pcap_t *, int);
 static void pcap_cleanup_linux(pcap_t *);
+static void pcap_batch_linux(u_char *, const struct pcap_pkthdr *,
+    const u_char *);
 
 union thdr {
 	struct tpacket_hdr		*h1;
@@ -346,24 +519,35 @@ union thdr {
 };
 
 #ifdef HAVE_PACKET_RING
-#define RING_GET_FRAME(h) (((union thdr **)h->buffer)[h->offset])
+#define RING_GET_FRAME_AT(h, offset) (((union thdr **)h->buffer)[offset])
+#define RING_GET_FRAME(h) RING_GET_FRAME_AT(h, h->offset)
 
 static void destroy_ring(pcap_t *handle);
 static int create_ring(pcap_t *handle, int *status);
+static int init_multi_consumer(pcap_t *handle);
+static int init_resegment(pcap_t *handle);
+#ifdef HAVE_TPACKET3
+static void set_ring_geometry_v3(pcap_t *, struct tpacket_req3 *,
+    unsigned int *);
+#endif
+static int create_tx_ring(pcap_t *handle, size_t *tx_len);
 static int prepare_tpacket_socket(pcap_t *handle);
 static void pcap_cleanup_linux_mmap(pcap_t *);
 static int pcap_read_linux_mmap_v1(pcap_t *, int, pcap_handler , u_char *);
-#ifdef HAVE_TPACKET2
-static int pcap_read_linux_mmap_v2(pcap_t *, int, pcap_handler , u_char *);
-#endif
-#ifdef HAVE_TPACKET3
-static int pcap_read_linux_mmap_v3(pcap_t *, int, pcap_handler , u_char *);
-#endif
+static int pcap_mmap_features(pcap_t *);
+static void pcap_set_read_op_mmap(pcap_t *);
 static int pcap_setfilter_linux_mmap(pcap_t *, struct bpf_program *);
 static int pcap_setnonblock_mmap(pcap_t *p, int nonblock, char *errbuf);
 static int pcap_getnonblock_mmap(pcap_t *p, char *errbuf);
 static void pcap_oneshot_mmap(u_char *user, const struct pcap_pkthdr *h,
     const u_char *bytes);
+static int pcap_inject_linux_mmap(pcap_t *, const void *, size_t);
+static int pcap_inject_queue_linux_mmap(pcap_t *, const void *, size_t);
+static int pcap_inject_flush_linux_mmap(pcap_t *);
+static int pcap_read_batch_linux_mmap(pcap_t *, int, pcap_handler, u_char *);
+static int pcap_release_linux_mmap(pcap_t *, const u_char *);
+static void pcap_batch_mmap(u_char *user, const struct pcap_pkthdr *h,
+    const u_char *bytes);
 #endif
 
 /*
@@ -386,13 +570,25 @@ static int	enter_rfmon_mode(pcap_t *handle, int sock_fd,
 static int	iface_ethtool_get_ts_info(pcap_t *handle, char *ebuf);
 #endif
 static int	iface_get_offload(pcap_t *handle);
+static int	iface_get_speed(pcap_t *handle);
+static int	iface_get_numa_node(const char *device);
+static int	set_numa_policy(pcap_t *handle, struct numa_policy *old);
+static void	restore_numa_policy(pcap_t *handle, struct numa_policy *old);
+static int	get_buffer_numa_node(void *buf);
+static int	bind_thread_to_numa_node(int node, char *errbuf);
+#ifdef HAVE_RECVMMSG
+static u_char	*alloc_packet_buffer(pcap_t *handle, size_t *len, int *huge);
+static u_long	get_transparent_huge_size(void *buf);
+#endif
 static int 	iface_bind_old(int fd, const char *device, char *ebuf);
 
 #ifdef SO_ATTACH_FILTER
 static int	fix_program(pcap_t *handle, struct sock_fprog *fcode,
     int is_mapped);
 static int	fix_offset(struct bpf_insn *p);
-static int	set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode);
+static int	set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode,
+    int is_mmapped);
+static int	set_kernel_snaplen_filter(pcap_t *handle);
 static int	reset_kernel_filter(pcap_t *handle);
 
 static struct sock_filter	total_insn
@@ -412,6 +608,7 @@ pcap_create_interface(const char *device, char *ebuf)
 
 	handle->activate_op = pcap_activate_linux;
 	handle->can_set_rfmon_op = pcap_can_set_rfmon_linux;
+	handle->opt.numa_node = PCAP_NUMA_NODE_ANY;
 
 #if defined(HAVE_LINUX_NET_TSTAMP_H) && defined(PACKET_TIMESTAMP)
 	/*
@@ -449,169 +646,897 @@ pcap_create_interface(const char *device, char *ebuf)
 	return handle;
 }
 
-#ifdef HAVE_LIBNL
-/*
- * If interface {if} is a mac80211 driver, the file
- * /sys/class/net/{if}/phy80211 is a symlink to
- * /sys/class/ieee80211/{phydev}, for some {phydev}.
- *
- * On Fedora 9, with a 2.6.26.3-29 kernel, my Zydas stick, at
- * least, has a "wmaster0" device and a "wlan0" device; the
- * latter is the one with the IP address.  Both show up in
- * "tcpdump -D" output.  Capturing on the wmaster0 device
- * captures with 802.11 headers.
- *
- * airmon-ng searches through /sys/class/net for devices named
- * monN, starting with mon0; as soon as one *doesn't* exist,
- * it chooses that as the monitor device name.  If the "iw"
- * command exists, it does "iw dev {if} interface add {monif}
- * type monitor", where {monif} is the monitor device.  It
- * then (sigh) sleeps .1 second, and then configures the
- * device up.  Otherwise, if /sys/class/ieee80211/{phydev}/add_iface
- * is a file, it writes {mondev}, without a newline, to that file,
- * and again (sigh) sleeps .1 second, and then iwconfig's that
- * device into monitor mode and configures it up.  Otherwise,
- * you can't do monitor mode.
- *
- * All these devices are "glued" together by having the
- * /sys/class/net/{device}/phy80211 links pointing to the same
- * place, so, given a wmaster, wlan, or mon device, you can
- * find the other devices by looking for devices with
- * the same phy80211 link.
- *
- * To turn monitor mode off, delete the monitor interface,
- * either with "iw dev {monif} interface del" or by sending
- * {monif}, with no NL, down /sys/class/ieee80211/{phydev}/remove_iface
- *
- * Note: if you try to create a monitor device named "monN", and
- * there's already a "monN" device, it fails, as least with
- * the netlink interface (which is what iw uses), with a return
- * value of -ENFILE.  (Return values are negative errnos.)  We
- * could probably use that to find an unused device.
- *
- * Yes, you can have multiple monitor devices for a given
- * physical device.
-*/
-
 /*
- * Is this a mac80211 device?  If so, fill in the physical device path and
- * return 1; if not, return 0.  On an error, fill in handle->errbuf and
- * return PCAP_ERROR.
+ * Ask that, when the capture is activated, its socket join the
+ * PACKET_FANOUT group with the given ID, so that the packets seen
+ * by the group are spread over all the sockets in the group, using
+ * the given mode, rather than every socket seeing every packet.
  */
-static int
-get_mac80211_phydev(pcap_t *handle, const char *device, char *phydev_path,
-    size_t phydev_max_pathlen)
+int
+pcap_set_fanout(pcap_t *p, int group_id, int mode, int flags)
 {
-	char *pathstr;
-	ssize_t bytes_read;
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
 
 	/*
-	 * Generate the path string for the symlink to the physical device.
+	 * The group ID is the low-order 16 bits of the PACKET_FANOUT
+	 * argument.
 	 */
-	if (asprintf(&pathstr, "/sys/class/net/%s/phy80211", device) == -1) {
-		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
-		    "%s: Can't generate path name string for /sys/class/net device",
-		    device);
-		return PCAP_ERROR;
-	}
-	bytes_read = readlink(pathstr, phydev_path, phydev_max_pathlen);
-	if (bytes_read == -1) {
-		if (errno == ENOENT || errno == EINVAL) {
-			/*
-			 * Doesn't exist, or not a symlink; assume that
-			 * means it's not a mac80211 device.
-			 */
-			free(pathstr);
-			return 0;
-		}
-		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
-		    "%s: Can't readlink %s: %s", device, pathstr,
-		    strerror(errno));
-		free(pathstr);
-		return PCAP_ERROR;
-	}
-	free(pathstr);
-	phydev_path[bytes_read] = '\0';
-	return 1;
+	if (group_id < 0 || group_id > 65535) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Fanout group ID %d is not in the range 0-65535",
+		    group_id);
+		return (PCAP_ERROR);
+	}
+	switch (mode) {
+
+	case PCAP_FANOUT_HASH:
+	case PCAP_FANOUT_LB:
+	case PCAP_FANOUT_CPU:
+	case PCAP_FANOUT_ROLLOVER:
+	case PCAP_FANOUT_QM:
+		break;
+
+	default:
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Unknown fanout mode %d", mode);
+		return (PCAP_ERROR);
+	}
+	if (flags & ~(PCAP_FANOUT_FLAG_DEFRAG|PCAP_FANOUT_FLAG_ROLLOVER)) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Unknown fanout flags 0x%08x", flags);
+		return (PCAP_ERROR);
+	}
+	p->opt.fanout_enabled = 1;
+	p->opt.fanout_group = group_id;
+	p->opt.fanout_mode = mode;
+	p->opt.fanout_flags = flags;
+	return (0);
 }
 
-#ifdef HAVE_LIBNL_SOCKETS
-#define get_nl_errmsg	nl_geterror
-#else
-/* libnl 2.x compatibility code */
+/*
+ * Set the size and number of the blocks of a TPACKET_V3 ring, and the
+ * time after which the kernel hands a block that isn't full to us.
+ * For each of them, 0 means "the default" and PCAP_RING_AUTO means
+ * "pick one from the interface speed and snapshot length".
+ */
+int
+pcap_set_ring_geometry(pcap_t *p, int block_size, int block_nr,
+    int retire_tov)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
 
-#define nl_sock nl_handle
+	/*
+	 * The kernel requires blocks to be a multiple of the page
+	 * size; we compute the block size for a ring by doubling the
+	 * page size, so require a power of 2.
+	 */
+	if (block_size != 0 && block_size != PCAP_RING_AUTO &&
+	    (block_size < getpagesize() ||
+	     (block_size & (block_size - 1)) != 0)) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Ring block size %d is not a power of 2 at least as large as the page size (%d)",
+		    block_size, getpagesize());
+		return (PCAP_ERROR);
+	}
+	if (block_nr < PCAP_RING_AUTO) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Ring block count %d is negative", block_nr);
+		return (PCAP_ERROR);
+	}
+	if (retire_tov < PCAP_RING_AUTO) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Ring block retire timeout %d is negative", retire_tov);
+		return (PCAP_ERROR);
+	}
+	p->opt.ring_block_size = block_size;
+	p->opt.ring_block_nr = block_nr;
+	p->opt.ring_retire_tov = retire_tov;
+	return (0);
+}
 
-static inline struct nl_handle *
-nl_socket_alloc(void)
+/*
+ * Ask that, when waiting for packets on a memory-mapped capture, we
+ * spin checking the ring for up to usec microseconds before blocking.
+ */
+int
+pcap_set_busy_poll(pcap_t *p, int usec)
 {
-	return nl_handle_alloc();
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	if (usec < 0) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Busy-poll time %d is negative", usec);
+		return (PCAP_ERROR);
+	}
+	p->opt.busy_poll = usec;
+	return (0);
 }
 
-static inline void
-nl_socket_free(struct nl_handle *h)
+/*
+ * Get the counts of waits for packets that spinning satisfied and
+ * that ended up blocking.
+ */
+int
+pcap_get_busy_poll_stats(pcap_t *p, struct pcap_busy_poll_stat *stats)
 {
-	nl_handle_destroy(h);
+	struct pcap_linux *handlep = p->priv;
+
+	if (!p->activated)
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	if (p->activate_op != pcap_activate_linux) {
+		strlcpy(p->errbuf,
+		    "Busy-poll statistics aren't supported on this device",
+		    PCAP_ERRBUF_SIZE);
+		return (PCAP_ERROR);
+	}
+	stats->bp_spin_hits = handlep->busy_poll_hits;
+	stats->bp_sleeps = handlep->busy_poll_sleeps;
+	return (0);
 }
 
-#define get_nl_errmsg	strerror
+/*
+ * Get the statistics gathered from the ring as packets were read.
+ */
+int
+pcap_get_ring_stats(pcap_t *p, struct pcap_ring_stat *stats)
+{
+	struct pcap_linux *handlep = p->priv;
 
-static inline int
-__genl_ctrl_alloc_cache(struct nl_handle *h, struct nl_cache **cache)
+	if (!p->activated)
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	if (p->activate_op != pcap_activate_linux) {
+		strlcpy(p->errbuf,
+		    "Ring statistics aren't supported on this device",
+		    PCAP_ERRBUF_SIZE);
+		return (PCAP_ERROR);
+	}
+	*stats = handlep->ring_stat;
+#ifdef HAVE_TPACKET3
+	if (handlep->mmapbuf != NULL && handlep->tp_version == TPACKET_V3)
+		stats->rs_ring_blocks = p->cc;
+	else
+#endif
+		stats->rs_ring_blocks = 0;
+	return (0);
+}
+
+/*
+ * Ask that the capture buffer be allocated on the given NUMA node.
+ */
+int
+pcap_set_numa_node(pcap_t *p, int node)
 {
-	struct nl_cache *tmp = genl_ctrl_alloc_cache(h);
-	if (!tmp)
-		return -ENOMEM;
-	*cache = tmp;
-	return 0;
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	if (node < PCAP_NUMA_NODE_DEVICE) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "NUMA node %d is not valid", node);
+		return (PCAP_ERROR);
+	}
+	p->opt.numa_node = node;
+	return (0);
 }
-#define genl_ctrl_alloc_cache __genl_ctrl_alloc_cache
-#endif /* !HAVE_LIBNL_SOCKETS */
 
-struct nl80211_state {
-	struct nl_sock *nl_sock;
-	struct nl_cache *nl_cache;
-	struct genl_family *nl80211;
-};
+/*
+ * Ask that capture buffers we allocate ourselves be put in huge pages
+ * if possible.
+ */
+int
+pcap_set_hugepages(pcap_t *p, int hugepages)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.hugepages = hugepages;
+	return (0);
+}
 
-static int
-nl80211_init(pcap_t *handle, struct nl80211_state *state, const char *device)
+/*
+ * Report where the capture buffer ended up.
+ */
+int
+pcap_get_buffer_stats(pcap_t *p, struct pcap_buffer_stat *stats)
 {
-	int err;
+	struct pcap_linux *handlep = p->priv;
+	u_char *buf;
 
-	state->nl_sock = nl_socket_alloc();
-	if (!state->nl_sock) {
-		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
-		    "%s: failed to allocate netlink handle", device);
-		return PCAP_ERROR;
+	if (!p->activated)
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	if (p->activate_op != pcap_activate_linux) {
+		strlcpy(p->errbuf,
+		    "Buffer statistics aren't supported on this device",
+		    PCAP_ERRBUF_SIZE);
+		return (PCAP_ERROR);
 	}
 
-	if (genl_connect(state->nl_sock)) {
-		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
-		    "%s: failed to connect to generic netlink", device);
-		goto out_handle_destroy;
+	/*
+	 * The memory-mapped ring is allocated by the kernel, and
+	 * mapped with ordinary pages.
+	 */
+	if (handlep->mmapbuf != NULL) {
+		buf = handlep->mmapbuf;
+		stats->pb_size = handlep->mmapbuflen;
+		stats->pb_huge_size = 0;
+	}
+#ifdef HAVE_RECVMMSG
+	else if (handlep->recv_buffer != NULL) {
+		buf = handlep->recv_buffer;
+		stats->pb_size = handlep->recv_buffer_len;
+		if (handlep->recv_buffer_huge)
+			stats->pb_huge_size = handlep->recv_buffer_len;
+		else
+			stats->pb_huge_size = get_transparent_huge_size(buf);
 	}
-
-	err = genl_ctrl_alloc_cache(state->nl_sock, &state->nl_cache);
-	if (err < 0) {
-		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
-		    "%s: failed to allocate generic netlink cache: %s",
-		    device, get_nl_errmsg(-err));
-		goto out_handle_destroy;
+#endif
+	else {
+		buf = p->buffer;
+		stats->pb_size = p->bufsize + p->offset;
+		stats->pb_huge_size = 0;
 	}
+	stats->pb_numa_node = get_buffer_numa_node(buf);
+	return (0);
+}
 
-	state->nl80211 = genl_ctrl_search_by_name(state->nl_cache, "nl80211");
-	if (!state->nl80211) {
-		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
-		    "%s: nl80211 not found", device);
-		goto out_cache_free;
-	}
+/*
+ * Run the calling thread, and allocate its memory, on the NUMA node on
+ * which the capture buffer was put.
+ */
+int
+pcap_bind_numa_node(pcap_t *p)
+{
+	struct pcap_linux *handlep = p->priv;
 
-	return 0;
+	if (!p->activated)
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	if (p->activate_op != pcap_activate_linux) {
+		strlcpy(p->errbuf,
+		    "NUMA node selection isn't supported on this device",
+		    PCAP_ERRBUF_SIZE);
+		return (PCAP_ERROR);
+	}
+	if (handlep->numa_node < 0)
+		return (0);
+	if (bind_thread_to_numa_node(handlep->numa_node, p->errbuf) == -1)
+		return (PCAP_ERROR);
+	return (0);
+}
 
-out_cache_free:
-	nl_cache_free(state->nl_cache);
-out_handle_destroy:
+/*
+ * Ask that VLAN tags stripped by the adapter or the kernel be reported
+ * as metadata rather than put back into the packet.
+ */
+int
+pcap_set_vlan_metadata(pcap_t *p, int vlan_metadata)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.vlan_metadata = vlan_metadata;
+	return (0);
+}
+
+/*
+ * Ask for the kernel's virtio-net header, describing the offloads
+ * applied to the packet, with each packet.
+ */
+int
+pcap_set_vnet_hdr(pcap_t *p, int vnet_hdr)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.vnet_hdr = vnet_hdr;
+	return (0);
+}
+
+/*
+ * Ask that aggregated packets be split into the packets seen on the
+ * wire.
+ */
+int
+pcap_set_resegment(pcap_t *p, int resegment)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.resegment = resegment;
+	return (0);
+}
+
+/*
+ * Ask that several threads be allowed to read from the ring at once.
+ */
+int
+pcap_set_multi_consumer(pcap_t *p, int multi_consumer)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.multi_consumer = multi_consumer;
+	return (0);
+}
+
+/*
+ * Check whether packet metadata is available for the handle.
+ */
+static int
+check_pkt_meta(pcap_t *p)
+{
+	if (!p->activated)
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	if (p->activate_op != pcap_activate_linux) {
+		strlcpy(p->errbuf,
+		    "Packet metadata isn't supported on this device",
+		    PCAP_ERRBUF_SIZE);
+		return (PCAP_ERROR);
+	}
+	if (p->opt.multi_consumer) {
+		/*
+		 * There's no single "last packet" when several
+		 * threads are reading.
+		 */
+		strlcpy(p->errbuf,
+		    "Packet metadata isn't supported in multi-consumer mode",
+		    PCAP_ERRBUF_SIZE);
+		return (PCAP_ERROR);
+	}
+	return (0);
+}
+
+/*
+ * Get the metadata for the last packet handed to the callback.
+ */
+int
+pcap_get_pkt_meta(pcap_t *p, struct pcap_pkt_meta *meta)
+{
+	struct pcap_linux *handlep = p->priv;
+	int status;
+
+	if ((status = check_pkt_meta(p)) != 0)
+		return (status);
+	*meta = handlep->pkt_meta;
+	return (0);
+}
+
+struct meta_userdata {
+	pcap_t *p;
+	pcap_meta_handler callback;
+	u_char *user;
+};
+
+static void
+pcap_meta_callback(u_char *user, const struct pcap_pkthdr *h,
+    const u_char *bytes)
+{
+	struct meta_userdata *mu = (struct meta_userdata *)user;
+	struct pcap_linux *handlep = mu->p->priv;
+
+	mu->callback(mu->user, h, &handlep->pkt_meta, bytes);
+}
+
+/*
+ * Like pcap_dispatch(), but also hand the callback each packet's
+ * metadata.
+ */
+int
+pcap_dispatch_meta(pcap_t *p, int cnt, pcap_meta_handler callback,
+    u_char *user)
+{
+	struct meta_userdata mu;
+	int status;
+
+	if ((status = check_pkt_meta(p)) != 0)
+		return (status);
+	mu.p = p;
+	mu.callback = callback;
+	mu.user = user;
+	return (p->read_op(p, cnt, pcap_meta_callback, (u_char *)&mu));
+}
+
+/*
+ * For pcap_next_batch() on a handle not using a ring buffer, save the
+ * metadata for the packet pcap_batch() has just copied, if it kept it.
+ */
+static void
+pcap_batch_linux(u_char *user, const struct pcap_pkthdr *h,
+    const u_char *bytes)
+{
+	struct batch_userdata *sp = (struct batch_userdata *)user;
+	struct pcap_linux *handlep = sp->pd->priv;
+	int cnt = sp->cnt;
+
+	pcap_batch(user, h, bytes);
+	if (handlep->batch_metas_wanted && sp->cnt != cnt)
+		handlep->batch_metas[cnt] = handlep->pkt_meta;
+}
+
+/*
+ * Like pcap_next_batch(), but also hand back pointers to each packet's
+ * metadata in "metas"; the metadata remains valid until the next
+ * attempt to read packets from "p".
+ */
+int
+pcap_next_batch_meta(pcap_t *p, struct pcap_pkthdr **hdrs,
+    struct pcap_pkt_meta **metas, const u_char **pkts, int max)
+{
+	struct pcap_linux *handlep = p->priv;
+	struct pcap_pkt_meta *batch_metas;
+	int status, i;
+
+	if ((status = check_pkt_meta(p)) != 0)
+		return (status);
+	if (max > handlep->batch_metas_max) {
+		batch_metas = realloc(handlep->batch_metas,
+		    max * sizeof(struct pcap_pkt_meta));
+		if (batch_metas == NULL) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			return (PCAP_ERROR);
+		}
+		handlep->batch_metas = batch_metas;
+		handlep->batch_metas_max = max;
+	}
+
+	handlep->batch_metas_wanted = 1;
+	status = pcap_next_batch(p, hdrs, pkts, max);
+	handlep->batch_metas_wanted = 0;
+
+	for (i = 0; i < status; i++)
+		metas[i] = &handlep->batch_metas[i];
+	return (status);
+}
+
+/*
+ * Event sets: a set of capture handles, registered with one epoll
+ * instance, so that a single thread can read from many handles and
+ * only look at the ones that have packets to read.
+ */
+
+/*
+ * Maximum number of times we call a handle's read routine for one
+ * wakeup, so that a busy handle can't keep us from getting to the
+ * others; if it still has packets, epoll will report it again.
+ */
+#define EVSET_MAX_READS	16
+
+struct pcap_evset_entry {
+	pcap_t	*p;
+	pcap_handler callback;
+	u_char	*user;
+	int	was_nonblock;	/* the handle was non-blocking when added */
+};
+
+struct pcap_evset {
+	int	epfd;
+	struct pcap_evset_entry **entries; /* the handles in the set */
+	int	nentries;
+	int	maxentries;
+	struct epoll_event *events; /* one per handle, for epoll_wait() */
+	int	break_loop;	/* pcap_evset_breakloop() was called */
+	int	pending_error;	/* error to report on the next dispatch, or 0 */
+	char	errbuf[PCAP_ERRBUF_SIZE];
+};
+
+pcap_evset_t *
+pcap_evset_create(char *errbuf)
+{
+	pcap_evset_t *es;
+
+	es = calloc(1, sizeof(*es));
+	if (es == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	es->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (es->epfd == -1) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "epoll_create1: %s",
+		    pcap_strerror(errno));
+		free(es);
+		return (NULL);
+	}
+	return (es);
+}
+
+void
+pcap_evset_close(pcap_evset_t *es)
+{
+	int i;
+
+	for (i = 0; i < es->nentries; i++)
+		free(es->entries[i]);
+	free(es->entries);
+	free(es->events);
+	close(es->epfd);
+	free(es);
+}
+
+/*
+ * Add a handle to the set; packets read from it are handed to
+ * "callback", with "user" as its first argument.  The handle is put
+ * into non-blocking mode, as we only read from it when epoll says
+ * there's something to read; it's put back into the mode it was in
+ * when it's removed from the set.
+ */
+int
+pcap_evset_add(pcap_evset_t *es, pcap_t *p, pcap_handler callback,
+    u_char *user)
+{
+	struct pcap_evset_entry *entry, **entries;
+	struct epoll_event *events, ev;
+	int maxentries;
+
+	if (!p->activated) {
+		strlcpy(es->errbuf, "The capture handle hasn't been activated",
+		    PCAP_ERRBUF_SIZE);
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	}
+	if (p->selectable_fd == -1) {
+		strlcpy(es->errbuf,
+		    "The capture handle has no descriptor to wait on",
+		    PCAP_ERRBUF_SIZE);
+		return (PCAP_ERROR);
+	}
+	if (es->nentries == es->maxentries) {
+		maxentries = es->maxentries != 0 ? es->maxentries * 2 : 16;
+		entries = realloc(es->entries, maxentries * sizeof(*entries));
+		if (entries == NULL) {
+			snprintf(es->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			return (PCAP_ERROR);
+		}
+		es->entries = entries;
+		events = realloc(es->events, maxentries * sizeof(*events));
+		if (events == NULL) {
+			snprintf(es->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			return (PCAP_ERROR);
+		}
+		es->events = events;
+		es->maxentries = maxentries;
+	}
+	entry = malloc(sizeof(*entry));
+	if (entry == NULL) {
+		snprintf(es->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (PCAP_ERROR);
+	}
+	entry->p = p;
+	entry->callback = callback;
+	entry->user = user;
+
+	entry->was_nonblock = pcap_getnonblock(p, es->errbuf);
+	if (entry->was_nonblock == -1 ||
+	    pcap_setnonblock(p, 1, es->errbuf) == -1) {
+		free(entry);
+		return (PCAP_ERROR);
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = entry;
+	if (epoll_ctl(es->epfd, EPOLL_CTL_ADD, p->selectable_fd, &ev) == -1) {
+		snprintf(es->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't add capture handle to epoll set: %s",
+		    pcap_strerror(errno));
+		(void)pcap_setnonblock(p, entry->was_nonblock, es->errbuf);
+		free(entry);
+		return (PCAP_ERROR);
+	}
+	es->entries[es->nentries++] = entry;
+	return (0);
+}
+
+/*
+ * Remove a handle from the set, and put it back into the blocking mode
+ * it was in when it was added.  This must not be called from a
+ * callback.
+ */
+int
+pcap_evset_remove(pcap_evset_t *es, pcap_t *p)
+{
+	int i;
+
+	for (i = 0; i < es->nentries; i++) {
+		if (es->entries[i]->p == p)
+			break;
+	}
+	if (i == es->nentries) {
+		strlcpy(es->errbuf, "The capture handle isn't in the set",
+		    PCAP_ERRBUF_SIZE);
+		return (PCAP_ERROR);
+	}
+	if (pcap_setnonblock(p, es->entries[i]->was_nonblock,
+	    es->errbuf) == -1)
+		return (PCAP_ERROR);
+	if (epoll_ctl(es->epfd, EPOLL_CTL_DEL, p->selectable_fd, NULL) == -1) {
+		snprintf(es->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't remove capture handle from epoll set: %s",
+		    pcap_strerror(errno));
+		(void)pcap_setnonblock(p, 1, p->errbuf);
+		return (PCAP_ERROR);
+	}
+	free(es->entries[i]);
+	es->entries[i] = es->entries[--es->nentries];
+	return (0);
+}
+
+/*
+ * Wait up to "timeout" milliseconds, or forever if "timeout" is -1,
+ * for any of the handles in the set to have packets, and read all the
+ * packets available from each handle that does.  Returns the number of
+ * packets read, 0 on a timeout, or a PCAP_ERROR_ value.
+ *
+ * If reading from a handle fails, or the loop is broken out of, after
+ * we've handed packets to callbacks, we return the number of those
+ * packets, so the caller can count them, and return the error or
+ * PCAP_ERROR_BREAK on the next call.
+ */
+int
+pcap_evset_dispatch(pcap_evset_t *es, int timeout)
+{
+	struct pcap_evset_entry *entry;
+	int nready, i, reads, n;
+	int pkts = 0;
+	size_t len;
+
+	if (es->pending_error != 0) {
+		n = es->pending_error;
+		es->pending_error = 0;
+		return (n);
+	}
+	if (es->nentries == 0) {
+		strlcpy(es->errbuf, "There are no capture handles in the set",
+		    PCAP_ERRBUF_SIZE);
+		return (PCAP_ERROR);
+	}
+	nready = epoll_wait(es->epfd, es->events, es->nentries, timeout);
+	if (nready == -1) {
+		if (errno == EINTR)
+			return (0);
+		snprintf(es->errbuf, PCAP_ERRBUF_SIZE, "epoll_wait: %s",
+		    pcap_strerror(errno));
+		return (PCAP_ERROR);
+	}
+	for (i = 0; i < nready; i++) {
+		entry = es->events[i].data.ptr;
+
+		/*
+		 * Read until the handle has no more packets for us; if
+		 * epoll reported an error or hangup, the read routine
+		 * will report it.
+		 */
+		for (reads = 0; reads < EVSET_MAX_READS; reads++) {
+			n = entry->p->read_op(entry->p, -1, entry->callback,
+			    entry->user);
+			if (n < 0) {
+				if (n == PCAP_ERROR) {
+					strlcpy(es->errbuf,
+					    entry->p->opt.source,
+					    PCAP_ERRBUF_SIZE);
+					len = strlen(es->errbuf);
+					snprintf(es->errbuf + len,
+					    PCAP_ERRBUF_SIZE - len, ": %s",
+					    entry->p->errbuf);
+				}
+				if (pkts != 0) {
+					es->pending_error = n;
+					return (pkts);
+				}
+				return (n);
+			}
+			if (n == 0)
+				break;
+			pkts += n;
+		}
+		if (es->break_loop) {
+			es->break_loop = 0;
+			if (pkts != 0) {
+				es->pending_error = PCAP_ERROR_BREAK;
+				return (pkts);
+			}
+			return (PCAP_ERROR_BREAK);
+		}
+	}
+	return (pkts);
+}
+
+/*
+ * Read packets from the handles in the set until "cnt" packets have
+ * been read, or forever if "cnt" is -1 or 0, as pcap_loop() does.
+ */
+int
+pcap_loop_many(pcap_evset_t *es, int cnt)
+{
+	int n;
+
+	for (;;) {
+		n = pcap_evset_dispatch(es, -1);
+		if (n < 0)
+			return (n);
+		if (!PACKET_COUNT_IS_UNLIMITED(cnt)) {
+			cnt -= n;
+			if (cnt <= 0)
+				return (0);
+		}
+	}
+}
+
+/*
+ * Force pcap_evset_dispatch() or pcap_loop_many() to return after it's
+ * finished with the handle it's reading from.
+ */
+void
+pcap_evset_breakloop(pcap_evset_t *es)
+{
+	es->break_loop = 1;
+}
+
+char *
+pcap_evset_geterr(pcap_evset_t *es)
+{
+	return (es->errbuf);
+}
+
+#ifdef HAVE_LIBNL
+/*
+ * If interface {if} is a mac80211 driver, the file
+ * /sys/class/net/{if}/phy80211 is a symlink to
+ * /sys/class/ieee80211/{phydev}, for some {phydev}.
+ *
+ * On Fedora 9, with a 2.6.26.3-29 kernel, my Zydas stick, at
+ * least, has a "wmaster0" device and a "wlan0" device; the
+ * latter is the one with the IP address.  Both show up in
+ * "tcpdump -D" output.  Capturing on the wmaster0 device
+ * captures with 802.11 headers.
+ *
+ * airmon-ng searches through /sys/class/net for devices named
+ * monN, starting with mon0; as soon as one *doesn't* exist,
+ * it chooses that as the monitor device name.  If the "iw"
+ * command exists, it does "iw dev {if} interface add {monif}
+ * type monitor", where {monif} is the monitor device.  It
+ * then (sigh) sleeps .1 second, and then configures the
+ * device up.  Otherwise, if /sys/class/ieee80211/{phydev}/add_iface
+ * is a file, it writes {mondev}, without a newline, to that file,
+ * and again (sigh) sleeps .1 second, and then iwconfig's that
+ * device into monitor mode and configures it up.  Otherwise,
+ * you can't do monitor mode.
+ *
+ * All these devices are "glued" together by having the
+ * /sys/class/net/{device}/phy80211 links pointing to the same
+ * place, so, given a wmaster, wlan, or mon device, you can
+ * find the other devices by looking for devices with
+ * the same phy80211 link.
+ *
+ * To turn monitor mode off, delete the monitor interface,
+ * either with "iw dev {monif} interface del" or by sending
+ * {monif}, with no NL, down /sys/class/ieee80211/{phydev}/remove_iface
+ *
+ * Note: if you try to create a monitor device named "monN", and
+ * there's already a "monN" device, it fails, as least with
+ * the netlink interface (which is what iw uses), with a return
+ * value of -ENFILE.  (Return values are negative errnos.)  We
+ * could probably use that to find an unused device.
+ *
+ * Yes, you can have multiple monitor devices for a given
+ * physical device.
+*/
+
+/*
+ * Is this a mac80211 device?  If so, fill in the physical device path and
+ * return 1; if not, return 0.  On an error, fill in handle->errbuf and
+ * return PCAP_ERROR.
+ */
+static int
+get_mac80211_phydev(pcap_t *handle, const char *device, char *phydev_path,
+    size_t phydev_max_pathlen)
+{
+	char *pathstr;
+	ssize_t bytes_read;
+
+	/*
+	 * Generate the path string for the symlink to the physical device.
+	 */
+	if (asprintf(&pathstr, "/sys/class/net/%s/phy80211", device) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: Can't generate path name string for /sys/class/net device",
+		    device);
+		return PCAP_ERROR;
+	}
+	bytes_read = readlink(pathstr, phydev_path, phydev_max_pathlen);
+	if (bytes_read == -1) {
+		if (errno == ENOENT || errno == EINVAL) {
+			/*
+			 * Doesn't exist, or not a symlink; assume that
+			 * means it's not a mac80211 device.
+			 */
+			free(pathstr);
+			return 0;
+		}
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: Can't readlink %s: %s", device, pathstr,
+		    strerror(errno));
+		free(pathstr);
+		return PCAP_ERROR;
+	}
+	free(pathstr);
+	phydev_path[bytes_read] = '\0';
+	return 1;
+}
+
+#ifdef HAVE_LIBNL_SOCKETS
+#define get_nl_errmsg	nl_geterror
+#else
+/* libnl 2.x compatibility code */
+
+#define nl_sock nl_handle
+
+static inline struct nl_handle *
+nl_socket_alloc(void)
+{
+	return nl_handle_alloc();
+}
+
+static inline void
+nl_socket_free(struct nl_handle *h)
+{
+	nl_handle_destroy(h);
+}
+
+#define get_nl_errmsg	strerror
+
+static inline int
+__genl_ctrl_alloc_cache(struct nl_handle *h, struct nl_cache **cache)
+{
+	struct nl_cache *tmp = genl_ctrl_alloc_cache(h);
+	if (!tmp)
+		return -ENOMEM;
+	*cache = tmp;
+	return 0;
+}
+#define genl_ctrl_alloc_cache __genl_ctrl_alloc_cache
+#endif /* !HAVE_LIBNL_SOCKETS */
+
+struct nl80211_state {
+	struct nl_sock *nl_sock;
+	struct nl_cache *nl_cache;
+	struct genl_family *nl80211;
+};
+
+static int
+nl80211_init(pcap_t *handle, struct nl80211_state *state, const char *device)
+{
+	int err;
+
+	state->nl_sock = nl_socket_alloc();
+	if (!state->nl_sock) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: failed to allocate netlink handle", device);
+		return PCAP_ERROR;
+	}
+
+	if (genl_connect(state->nl_sock)) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: failed to connect to generic netlink", device);
+		goto out_handle_destroy;
+	}
+
+	err = genl_ctrl_alloc_cache(state->nl_sock, &state->nl_cache);
+	if (err < 0) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: failed to allocate generic netlink cache: %s",
+		    device, get_nl_errmsg(-err));
+		goto out_handle_destroy;
+	}
+
+	state->nl80211 = genl_ctrl_search_by_name(state->nl_cache, "nl80211");
+	if (!state->nl80211) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: nl80211 not found", device);
+		goto out_cache_free;
+	}
+
+	return 0;
+
+out_cache_free:
+	nl_cache_free(state->nl_cache);
+out_handle_destroy:
 	nl_socket_free(state->nl_sock);
 	return PCAP_ERROR;
 }
@@ -1207,6 +2132,26 @@ static void	pcap_cleanup_linux( pcap_t *handle )
 		free(handlep->device);
 		handlep->device = NULL;
 	}
+	if (handlep->batch_metas != NULL) {
+		free(handlep->batch_metas);
+		handlep->batch_metas = NULL;
+		handlep->batch_metas_max = 0;
+	}
+#ifdef HAVE_RECVMMSG
+	if (handlep->recv_buffer != NULL) {
+		munmap(handlep->recv_buffer, handlep->recv_buffer_len);
+		handlep->recv_buffer = NULL;
+	}
+	if (handlep->recv_msgs != NULL) {
+		free(handlep->recv_msgs);
+		handlep->recv_msgs = NULL;
+	}
+	if (handlep->recv_aux != NULL) {
+		free(handlep->recv_aux);
+		handlep->recv_aux = NULL;
+	}
+	handlep->recv_nr = 0;
+#endif
 	pcap_cleanup_live_common(handle);
 }
 
@@ -1253,6 +2198,7 @@ pcap_activate_linux(pcap_t *handle)
 	handle->setnonblock_op = pcap_setnonblock_fd;
 	handle->cleanup_op = pcap_cleanup_linux;
 	handle->read_op = pcap_read_linux;
+	handle->batch_callback = pcap_batch_linux;
 	handle->stats_op = pcap_stats_linux;
 
 	/*
@@ -1280,6 +2226,14 @@ pcap_activate_linux(pcap_t *handle)
 	/* copy timeout value */
 	handlep->timeout = handle->opt.timeout;
 
+	/*
+	 * Find out on which NUMA node, if any, to put our buffers.
+	 */
+	if (handle->opt.numa_node == PCAP_NUMA_NODE_DEVICE)
+		handlep->numa_node = iface_get_numa_node(device);
+	else
+		handlep->numa_node = handle->opt.numa_node;
+
 	/*
 	 * If we're in promiscuous mode, then we probably want
 	 * to see when the interface drops packets too, so get an
@@ -1310,6 +2264,17 @@ pcap_activate_linux(pcap_t *handle)
 	if (ret == 1) {
 		/*
 		 * Success.
+		 * If we were asked to join a fanout group, do so
+		 * before setting up the ring.
+		 */
+		if (handle->opt.fanout_enabled) {
+			if (join_fanout_group(handle) == -1) {
+				status = PCAP_ERROR;
+				goto fail;
+			}
+		}
+
+		/*
 		 * Try to use memory-mapped access.
 		 */
 		switch (activate_mmap(handle, &status)) {
@@ -1334,11 +2299,10 @@ pcap_activate_linux(pcap_t *handle)
 			/*
 			 * We failed to set up to use it, or the kernel
 			 * supports it, but we failed to enable it.
-			 * ret has been set to the error status to
+			 * status has been set to the error status to
 			 * return and, if it's PCAP_ERROR, handle->errbuf
 			 * contains the error message.
 			 */
-			status = ret;
 			goto fail;
 		}
 	}
@@ -1353,6 +2317,17 @@ pcap_activate_linux(pcap_t *handle)
 			status = ret;
 			goto fail;
 		}
+
+		/*
+		 * join_fanout_group() will report that SOCK_PACKET
+		 * sockets can't be put into a fanout group.
+		 */
+		if (handle->opt.fanout_enabled) {
+			if (join_fanout_group(handle) == -1) {
+				status = PCAP_ERROR;
+				goto fail;
+			}
+		}
 	}
 
 	/*
@@ -1382,6 +2357,19 @@ pcap_activate_linux(pcap_t *handle)
 		goto fail;
 	}
 
+#ifdef HAVE_RECVMMSG
+	/*
+	 * If we can, read packets in batches rather than making a
+	 * system call for each packet.
+	 */
+	if (!handlep->sock_packet) {
+		if (create_recv_batch(handle) == -1) {
+			status = PCAP_ERROR;
+			goto fail;
+		}
+	}
+#endif
+
 	/*
 	 * "handle->fd" is a socket, so "select()" and "poll()"
 	 * should work on it.
@@ -1395,20 +2383,109 @@ fail:
 	return status;
 }
 
-/*
- *  Read at most max_packets from the capture stream and call the callback
- *  for each of them. Returns the number of packets handled or -1 if an
- *  error occured.
- */
-static int
-pcap_read_linux(pcap_t *handle, int max_packets _U_, pcap_handler callback, u_char *user)
-{
-	/*
-	 * Currently, on Linux only one packet is delivered per read,
-	 * so we don't loop.
-	 */
-	return pcap_read_packet(handle, callback, user);
+/*
+ *  Read at most max_packets from the capture stream and call the callback
+ *  for each of them. Returns the number of packets handled or -1 if an
+ *  error occured.
+ */
+static int
+pcap_read_linux(pcap_t *handle, int max_packets, pcap_handler callback, u_char *user)
+{
+#ifdef HAVE_RECVMMSG
+	struct pcap_linux *handlep = handle->priv;
+
+	if (handlep->recv_nr != 0)
+		return pcap_read_packets_recvmmsg(handle, max_packets,
+		    callback, user);
+#endif
+
+	/*
+	 * Without recvmmsg(), only one packet is delivered per read,
+	 * so we don't loop.
+	 */
+	return pcap_read_packet(handle, callback, user);
+}
+
+#ifdef HAVE_RECVMMSG
+/*
+ * Set up to read batches of packets with recvmmsg().
+ *
+ * Returns 1 on success, 0 if we can't read packets in batches on
+ * this socket (in which case we read them one at a time), and -1,
+ * with handle->errbuf set, on error.
+ */
+static int
+create_recv_batch(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct recv_msg_aux *aux;
+	struct msghdr *hdr;
+	int offset, nr, i;
+	int one = 1;
+
+	/*
+	 * Each packet's time stamp has to come with the packet,
+	 * as SIOCGSTAMP only gets the time stamp of the last
+	 * packet read.
+	 */
+#ifdef SO_TIMESTAMPNS
+	if (handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) {
+		if (setsockopt(handle->fd, SOL_SOCKET, SO_TIMESTAMPNS, &one,
+		    sizeof(one)) == -1)
+			return 0;
+	} else
+#endif
+	{
+		if (setsockopt(handle->fd, SOL_SOCKET, SO_TIMESTAMP, &one,
+		    sizeof(one)) == -1)
+			return 0;
+	}
+
+	/*
+	 * Each slot has the same layout as handle->buffer: room to
+	 * insert a VLAN tag, then room for a fake header if this is
+	 * a cooked device, then the packet.
+	 */
+	handlep->recv_slot_size = (handle->offset + handle->bufsize + 15) & ~15;
+	nr = RECV_BATCH_BUFSIZE / handlep->recv_slot_size;
+	if (nr > RECV_BATCH_MAX)
+		nr = RECV_BATCH_MAX;
+	if (nr < 2)
+		return 0;
+	if (handlep->cooked)
+		offset = SLL_HDR_LEN;
+	else
+		offset = 0;
+
+	handlep->recv_buffer_len = nr * handlep->recv_slot_size;
+	handlep->recv_buffer = alloc_packet_buffer(handle,
+	    &handlep->recv_buffer_len, &handlep->recv_buffer_huge);
+	if (handlep->recv_buffer == NULL)
+		return -1;
+	handlep->recv_msgs = calloc(nr, sizeof(struct mmsghdr));
+	handlep->recv_aux = calloc(nr, sizeof(struct recv_msg_aux));
+	if (handlep->recv_msgs == NULL || handlep->recv_aux == NULL) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			 "malloc: %s", pcap_strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		aux = &handlep->recv_aux[i];
+		aux->iov.iov_base = handlep->recv_buffer +
+		    i * handlep->recv_slot_size + handle->offset + offset;
+		aux->iov.iov_len = handle->bufsize - offset;
+
+		hdr = &handlep->recv_msgs[i].msg_hdr;
+		hdr->msg_name = &aux->from;
+		hdr->msg_iov = &aux->iov;
+		hdr->msg_iovlen = 1;
+		hdr->msg_control = &aux->cmsg_buf;
+	}
+	handlep->recv_nr = nr;
+	return 1;
 }
+#endif /* HAVE_RECVMMSG */
 
 static int
 pcap_set_datalink_linux(pcap_t *handle, int dlt)
@@ -1466,25 +2543,21 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 	int			offset;
 #ifdef HAVE_PF_PACKET_SOCKETS
 	struct sockaddr_ll	from;
-	struct sll_header	*hdrp;
 #else
 	struct sockaddr		from;
 #endif
-#if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI)
 	struct iovec		iov;
 	struct msghdr		msg;
-	struct cmsghdr		*cmsg;
+#if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI)
 	union {
 		struct cmsghdr	cmsg;
-		char		buf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
+		char		buf[RECV_CMSG_SPACE];
 	} cmsg_buf;
 #else /* defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI) */
 	socklen_t		fromlen;
 #endif /* defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI) */
-	int			packet_len, caplen;
-	struct pcap_pkthdr	pcap_header;
+	int			packet_len;
 
-        struct bpf_aux_data     aux_data;
 #ifdef HAVE_PF_PACKET_SOCKETS
 	/*
 	 * If this is a cooked device, leave extra room for a
@@ -1519,18 +2592,21 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 	 */
 	bp = handle->buffer + handle->offset;
 
-#if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI)
 	msg.msg_name		= &from;
 	msg.msg_namelen		= sizeof(from);
 	msg.msg_iov		= &iov;
 	msg.msg_iovlen		= 1;
+#if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI)
 	msg.msg_control		= &cmsg_buf;
 	msg.msg_controllen	= sizeof(cmsg_buf);
+#else /* defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI) */
+	msg.msg_control		= NULL;
+	msg.msg_controllen	= 0;
+#endif /* defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI) */
 	msg.msg_flags		= 0;
 
 	iov.iov_len		= handle->bufsize - offset;
 	iov.iov_base		= bp + offset;
-#endif /* defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI) */
 
 	do {
 		/*
@@ -1584,6 +2660,127 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 		}
 	}
 
+	return pcap_handle_packet_recv(handle, bp, packet_len, &msg,
+	    callback, userdata);
+}
+
+#ifdef HAVE_RECVMMSG
+/*
+ *  Read up to max_packets packets from the socket with one recvmmsg()
+ *  call, calling the handler provided by the user for each of them.
+ *  Returns the number of packets handed to the callback or -1 if an
+ *  error occured.
+ */
+static int
+pcap_read_packets_recvmmsg(pcap_t *handle, int max_packets,
+    pcap_handler callback, u_char *userdata)
+{
+	struct pcap_linux	*handlep = handle->priv;
+	struct mmsghdr		*msgs = handlep->recv_msgs;
+	int			vlen, n, i, ret, pkts;
+
+	vlen = handlep->recv_nr;
+	if (!PACKET_COUNT_IS_UNLIMITED(max_packets) && max_packets < vlen)
+		vlen = max_packets;
+	for (i = 0; i < vlen; i++) {
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+		msgs[i].msg_hdr.msg_controllen = RECV_CMSG_SPACE;
+		msgs[i].msg_hdr.msg_flags = 0;
+	}
+
+	/*
+	 * As with pcap_read_packet(), ignore EINTR.  MSG_WAITFORONE
+	 * means we only block waiting for the first packet.
+	 */
+	do {
+		/*
+		 * Has "pcap_breakloop()" been called?
+		 */
+		if (handle->break_loop) {
+			handle->break_loop = 0;
+			return PCAP_ERROR_BREAK;
+		}
+		n = recvmmsg(handle->fd, msgs, vlen, MSG_TRUNC|MSG_WAITFORONE,
+		    NULL);
+	} while (n == -1 && errno == EINTR);
+
+	if (n == -1) {
+		switch (errno) {
+
+		case EAGAIN:
+			return 0;	/* no packet there */
+
+		case ENOSYS:
+			/*
+			 * The C library has recvmmsg(), but the
+			 * kernel doesn't; read one packet at a
+			 * time from now on.
+			 */
+			handlep->recv_nr = 0;
+			return pcap_read_packet(handle, callback, userdata);
+
+		case ENETDOWN:
+			/*
+			 * The device on which we're capturing went away.
+			 *
+			 * XXX - we should really return
+			 * PCAP_ERROR_IFACE_NOT_UP, but pcap_dispatch()
+			 * etc. aren't defined to return that.
+			 */
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				"The interface went down");
+			return PCAP_ERROR;
+
+		default:
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				 "recvmmsg: %s", pcap_strerror(errno));
+			return PCAP_ERROR;
+		}
+	}
+
+	/*
+	 * The packets have all been taken off the socket, so hand
+	 * them all to the callback even if pcap_breakloop() is
+	 * called while we're doing so; we'll notice that on the
+	 * next call.
+	 */
+	pkts = 0;
+	for (i = 0; i < n; i++) {
+		ret = pcap_handle_packet_recv(handle,
+		    handlep->recv_buffer + i * handlep->recv_slot_size +
+		      handle->offset,
+		    msgs[i].msg_len, &msgs[i].msg_hdr, callback, userdata);
+		if (ret == -1)
+			return ret;
+		pkts += ret;
+	}
+	return pkts;
+}
+#endif /* HAVE_RECVMMSG */
+
+/*
+ *  Handle a packet read from the socket into bp (which has room for
+ *  a VLAN tag before it), as described by msg, calling the handler
+ *  provided by the user if it passes the filter.  Returns 1 if the
+ *  callback was called, 0 if the packet was discarded, or -1 if an
+ *  error occured.
+ */
+static int
+pcap_handle_packet_recv(pcap_t *handle, u_char *bp, int packet_len,
+    struct msghdr *msg, pcap_handler callback, u_char *userdata)
+{
+	struct pcap_linux	*handlep = handle->priv;
+#ifdef HAVE_PF_PACKET_SOCKETS
+	struct sockaddr_ll	*from = msg->msg_name;
+	struct sll_header	*hdrp;
+#endif
+	struct cmsghdr		*cmsg;
+	int			caplen;
+	int			have_ts;
+	struct pcap_pkthdr	pcap_header;
+
+        struct bpf_aux_data     aux_data;
+
 #ifdef HAVE_PF_PACKET_SOCKETS
 	if (!handlep->sock_packet) {
 		/*
@@ -1599,7 +2796,7 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 		 * It would save some instructions per packet, however.)
 		 */
 		if (handlep->ifindex != -1 &&
-		    from.sll_ifindex != handlep->ifindex)
+		    from->sll_ifindex != handlep->ifindex)
 			return 0;
 
 		/*
@@ -1608,9 +2805,20 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 		 * address returned for SOCK_PACKET is a "sockaddr_pkt"
 		 * which lacks the relevant packet type information.
 		 */
-		if (!linux_check_direction(handle, &from))
+		if (!linux_check_direction(handle, from))
 			return 0;
-	}
+
+		/*
+		 * Save the packet's metadata for pcap_get_pkt_meta()
+		 * and pcap_dispatch_meta(); the VLAN tag, if any, is
+		 * added below.
+		 */
+		handlep->pkt_meta.pm_flags = PCAP_META_IFINFO;
+		handlep->pkt_meta.pm_ifindex = from->sll_ifindex;
+		handlep->pkt_meta.pm_pkttype = from->sll_pkttype;
+		handlep->pkt_meta.pm_protocol = ntohs(from->sll_protocol);
+	} else
+		handlep->pkt_meta.pm_flags = 0;
 #endif
 
 #ifdef HAVE_PF_PACKET_SOCKETS
@@ -1625,19 +2833,19 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 		packet_len += SLL_HDR_LEN;
 
 		hdrp = (struct sll_header *)bp;
-		hdrp->sll_pkttype = map_packet_type_to_sll_type(from.sll_pkttype);
-		hdrp->sll_hatype = htons(from.sll_hatype);
-		hdrp->sll_halen = htons(from.sll_halen);
-		memcpy(hdrp->sll_addr, from.sll_addr,
-		    (from.sll_halen > SLL_ADDRLEN) ?
+		hdrp->sll_pkttype = map_packet_type_to_sll_type(from->sll_pkttype);
+		hdrp->sll_hatype = htons(from->sll_hatype);
+		hdrp->sll_halen = htons(from->sll_halen);
+		memcpy(hdrp->sll_addr, from->sll_addr,
+		    (from->sll_halen > SLL_ADDRLEN) ?
 		      SLL_ADDRLEN :
-		      from.sll_halen);
-		hdrp->sll_protocol = from.sll_protocol;
+		      from->sll_halen);
+		hdrp->sll_protocol = from->sll_protocol;
 	}
 
 #if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI)
-	if (handlep->vlan_offset != -1) {
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	if (handlep->vlan_offset != -1 || handle->opt.vlan_metadata) {
+		for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
 			struct tpacket_auxdata *aux;
 			unsigned int len;
 			struct vlan_tag *tag;
@@ -1657,7 +2865,21 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 #endif
 				continue;
 
-			len = packet_len > iov.iov_len ? iov.iov_len : packet_len;
+			handlep->pkt_meta.pm_flags |= PCAP_META_VLAN;
+			handlep->pkt_meta.pm_vlan_tci = aux->tp_vlan_tci;
+			handlep->pkt_meta.pm_vlan_tpid = VLAN_TPID(aux, aux);
+			if (handle->opt.vlan_metadata) {
+				/*
+				 * Leave the packet alone, and hand the
+				 * tag to the userland filter as
+				 * metadata.
+				 */
+				aux_data.vlan_tag = aux->tp_vlan_tci & 0x0fff;
+				aux_data.vlan_tag_present = 1;
+				break;
+			}
+
+			len = packet_len > msg->msg_iov->iov_len ? msg->msg_iov->iov_len : packet_len;
 			if (len < (unsigned int) handlep->vlan_offset)
 				break;
 
@@ -1717,8 +2939,8 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 
 	/* Run the packet filter if not using kernel filter */
 	if (handlep->filter_in_userland && handle->fcode.bf_insns) {
-		if (bpf_filter_with_aux_data(handle->fcode.bf_insns, bp,
-		    packet_len, caplen, &aux_data) == 0) {
+		if (pcap_run_filter(handle, bp, packet_len, caplen,
+		    &aux_data) == 0) {
 			/* rejected by filter */
 			return 0;
 		}
@@ -1726,21 +2948,56 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 
 	/* Fill in our own header data */
 
-	/* get timestamp for this packet */
-#if defined(SIOCGSTAMPNS) && defined(SO_TIMESTAMPNS)
-	if (handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) {
-		if (ioctl(handle->fd, SIOCGSTAMPNS, &pcap_header.ts) == -1) {
-			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
-					"SIOCGSTAMPNS: %s", pcap_strerror(errno));
-			return PCAP_ERROR;
+	/*
+	 * Get the time stamp for this packet; if the socket handed
+	 * it to us in a control message, use that, otherwise ask
+	 * for the time stamp of the last packet read.
+	 */
+	have_ts = 0;
+	if (msg->msg_controllen != 0) {
+		for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET)
+				continue;
+#ifdef SO_TIMESTAMPNS
+			if (cmsg->cmsg_type == SCM_TIMESTAMPNS &&
+			    cmsg->cmsg_len >= CMSG_LEN(sizeof(struct timespec))) {
+				struct timespec ts;
+
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				pcap_header.ts.tv_sec = ts.tv_sec;
+				if (handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO)
+					pcap_header.ts.tv_usec = ts.tv_nsec;
+				else
+					pcap_header.ts.tv_usec = ts.tv_nsec / 1000;
+				have_ts = 1;
+				break;
+			}
+#endif
+			if (cmsg->cmsg_type == SCM_TIMESTAMP &&
+			    cmsg->cmsg_len >= CMSG_LEN(sizeof(struct timeval))) {
+				memcpy(&pcap_header.ts, CMSG_DATA(cmsg),
+				    sizeof(pcap_header.ts));
+				have_ts = 1;
+				break;
+			}
 		}
-	} else
+	}
+	if (!have_ts) {
+#if defined(SIOCGSTAMPNS) && defined(SO_TIMESTAMPNS)
+		if (handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) {
+			if (ioctl(handle->fd, SIOCGSTAMPNS, &pcap_header.ts) == -1) {
+				snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+						"SIOCGSTAMPNS: %s", pcap_strerror(errno));
+				return PCAP_ERROR;
+			}
+		} else
 #endif
-	{
-		if (ioctl(handle->fd, SIOCGSTAMP, &pcap_header.ts) == -1) {
-			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
-					"SIOCGSTAMP: %s", pcap_strerror(errno));
-			return PCAP_ERROR;
+		{
+			if (ioctl(handle->fd, SIOCGSTAMP, &pcap_header.ts) == -1) {
+				snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+						"SIOCGSTAMP: %s", pcap_strerror(errno));
+				return PCAP_ERROR;
+			}
 		}
 	}
 
@@ -1945,6 +3202,13 @@ pcap_stats_linux(pcap_t *handle, struct pcap_stat *stats)
 		 */
 		handlep->stat.ps_recv += kstats.tp_packets;
 		handlep->stat.ps_drop += kstats.tp_drops;
+
+		/*
+		 * That also clears the kernel's count of drops, so the
+		 * next block marked TP_STATUS_LOSING starts a new loss
+		 * event.
+		 */
+		handlep->ring_losing = 0;
 		*stats = handlep->stat;
 		return 0;
 	}
@@ -1984,7 +3248,7 @@ pcap_stats_linux(pcap_t *handle, struct pcap_stat *stats)
 	 *
 	 * We maintain the count of packets processed by libpcap in
 	 * "handlep->packets_read", for reasons described in the comment
-	 * at the end of pcap_read_packet().  We have no idea how many
+	 * at the end of pcap_handle_packet_recv().  We have no idea how many
 	 * packets were dropped by the kernel buffers -- but we know
 	 * how many the interface dropped, so we can return that.
 	 */
@@ -2442,7 +3706,7 @@ pcap_setfilter_linux_common(pcap_t *handle, struct bpf_program *filter,
 	 *	padding.
 	 */
 	if (can_filter_in_kernel) {
-		if ((err = set_kernel_filter(handle, &fcode)) == 0)
+		if ((err = set_kernel_filter(handle, &fcode, is_mmapped)) == 0)
 		{
 			/*
 			 * Installation succeded - using kernel filter,
@@ -2515,6 +3779,10 @@ pcap_setdirection_linux(pcap_t *handle, pcap_direction_t d)
 
 	if (!handlep->sock_packet) {
 		handle->direction = d;
+#ifdef HAVE_PACKET_RING
+		if (handlep->mmapbuf != NULL)
+			pcap_set_read_op_mmap(handle);
+#endif
 		return 0;
 	}
 #endif
@@ -3344,6 +4612,20 @@ activate_new(pcap_t *handle)
 	}
 #endif /* defined(SIOCGSTAMPNS) && defined(SO_TIMESTAMPNS) */
 
+#ifdef SO_BUSY_POLL
+	/*
+	 * In busy-poll mode, also ask the kernel to busy-poll the
+	 * device queue when we read from the socket.  That's not
+	 * available on older kernels, and raising the time above
+	 * net.core.busy_read needs CAP_NET_ADMIN; either way, we
+	 * still spin on the ring ourselves, so don't fail.
+	 */
+	if (handle->opt.busy_poll > 0) {
+		(void)setsockopt(sock_fd, SOL_SOCKET, SO_BUSY_POLL,
+		    &handle->opt.busy_poll, sizeof(handle->opt.busy_poll));
+	}
+#endif /* SO_BUSY_POLL */
+
 	/*
 	 * We've succeeded. Save the socket FD in the pcap structure.
 	 */
@@ -3366,6 +4648,17 @@ activate_new(pcap_t *handle)
 	}
 #endif /* SO_BPF_EXTENSIONS */
 
+#if defined(SKF_AD_VLAN_TAG) && defined(SKF_AD_VLAN_TAG_PRESENT)
+	/*
+	 * If VLAN tags are reported as metadata, rather than put back
+	 * into the packet, filters must get them from the metadata as
+	 * well.  If the kernel can't run such a filter, it's run in
+	 * userland, which can.
+	 */
+	if (handle->opt.vlan_metadata)
+		handle->bpf_codegen_flags |= BPF_SPECIAL_VLAN_HANDLING;
+#endif
+
 	return 1;
 #else /* HAVE_PF_PACKET_SOCKETS */
 	strlcpy(ebuf,
@@ -3375,7 +4668,145 @@ activate_new(pcap_t *handle)
 #endif /* HAVE_PF_PACKET_SOCKETS */
 }
 
+/*
+ * Join the PACKET_FANOUT group requested with pcap_set_fanout().
+ *
+ * Returns 0 on success and -1, with handle->errbuf set, on failure.
+ */
+static int
+join_fanout_group(pcap_t *handle)
+{
+#ifdef HAVE_PACKET_FANOUT
+	struct pcap_linux *handlep = handle->priv;
+	int mode;
+	int val;
+
+	if (handlep->sock_packet) {
+		strlcpy(handle->errbuf,
+		    "Fanout groups aren't supported on SOCK_PACKET sockets",
+		    PCAP_ERRBUF_SIZE);
+		return -1;
+	}
+
+	switch (handle->opt.fanout_mode) {
+
+	case PCAP_FANOUT_HASH:
+		mode = PACKET_FANOUT_HASH;
+		break;
+
+	case PCAP_FANOUT_LB:
+		mode = PACKET_FANOUT_LB;
+		break;
+
+	case PCAP_FANOUT_CPU:
+		mode = PACKET_FANOUT_CPU;
+		break;
+
+#ifdef PACKET_FANOUT_ROLLOVER
+	case PCAP_FANOUT_ROLLOVER:
+		mode = PACKET_FANOUT_ROLLOVER;
+		break;
+#endif
+
+#ifdef PACKET_FANOUT_QM
+	case PCAP_FANOUT_QM:
+		mode = PACKET_FANOUT_QM;
+		break;
+#endif
+
+	default:
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "Fanout mode %d isn't supported by this build of libpcap",
+		    handle->opt.fanout_mode);
+		return -1;
+	}
+
+	if (handle->opt.fanout_flags & PCAP_FANOUT_FLAG_DEFRAG) {
+#ifdef PACKET_FANOUT_FLAG_DEFRAG
+		mode |= PACKET_FANOUT_FLAG_DEFRAG;
+#else
+		strlcpy(handle->errbuf,
+		    "Fanout defragmentation isn't supported by this build of libpcap",
+		    PCAP_ERRBUF_SIZE);
+		return -1;
+#endif
+	}
+	if (handle->opt.fanout_flags & PCAP_FANOUT_FLAG_ROLLOVER) {
+#ifdef PACKET_FANOUT_FLAG_ROLLOVER
+		mode |= PACKET_FANOUT_FLAG_ROLLOVER;
+#else
+		strlcpy(handle->errbuf,
+		    "Fanout rollover isn't supported by this build of libpcap",
+		    PCAP_ERRBUF_SIZE);
+		return -1;
+#endif
+	}
+
+	/*
+	 * The group ID goes in the low-order 16 bits and the mode
+	 * and flags go in the upper 16 bits.
+	 *
+	 * All sockets in a group must use the same mode and flags,
+	 * so joining an existing group with different ones fails
+	 * with EINVAL.
+	 */
+	val = (mode << 16) | handle->opt.fanout_group;
+	if (setsockopt(handle->fd, SOL_PACKET, PACKET_FANOUT, &val,
+	    sizeof(val)) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't join fanout group %d: %s",
+		    handle->opt.fanout_group, pcap_strerror(errno));
+		return -1;
+	}
+	return 0;
+#else /* HAVE_PACKET_FANOUT */
+	strlcpy(handle->errbuf,
+	    "Fanout groups aren't supported by this build of libpcap",
+	    PCAP_ERRBUF_SIZE);
+	return -1;
+#endif /* HAVE_PACKET_FANOUT */
+}
+
 #ifdef HAVE_PACKET_RING
+/*
+ * Turn on the virtio-net header for packets in the ring, as requested
+ * with pcap_set_vnet_hdr().
+ *
+ * Returns 0 on success and -1, with handle->errbuf set, on failure.
+ */
+static int
+enable_vnet_hdr(pcap_t *handle)
+{
+#ifdef PACKET_VNET_HDR
+	struct pcap_linux *handlep = handle->priv;
+	int one = 1;
+
+	/*
+	 * The kernel only supplies the header on SOCK_RAW sockets.
+	 */
+	if (handlep->cooked) {
+		strlcpy(handle->errbuf,
+		    "Virtio-net headers aren't supported in cooked mode",
+		    PCAP_ERRBUF_SIZE);
+		return -1;
+	}
+	if (setsockopt(handle->fd, SOL_PACKET, PACKET_VNET_HDR, &one,
+	    sizeof(one)) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't enable virtio-net headers: %s",
+		    pcap_strerror(errno));
+		return -1;
+	}
+	handlep->vnet_hdr_len = sizeof(struct virtio_net_hdr);
+	return 0;
+#else /* PACKET_VNET_HDR */
+	strlcpy(handle->errbuf,
+	    "Virtio-net headers aren't supported by this build of libpcap",
+	    PCAP_ERRBUF_SIZE);
+	return -1;
+#endif /* PACKET_VNET_HDR */
+}
+
 /*
  * Attempt to activate with memory-mapped access.
  *
@@ -3392,6 +4823,7 @@ static int
 activate_mmap(pcap_t *handle, int *status)
 {
 	struct pcap_linux *handlep = handle->priv;
+	struct numa_policy old_policy;
 	int ret;
 
 	/*
@@ -3417,13 +4849,47 @@ activate_mmap(pcap_t *handle, int *status)
 		*status = PCAP_ERROR;
 		return ret;
 	}
+
+	/*
+	 * The virtio-net header has to be turned on before the ring
+	 * is created, as it changes where the kernel puts packets in
+	 * the ring.
+	 */
+	if (handle->opt.vnet_hdr || handle->opt.resegment) {
+		if (enable_vnet_hdr(handle) == -1) {
+			free(handlep->oneshot_buffer);
+			*status = PCAP_ERROR;
+			return -1;
+		}
+	}
+
+	/*
+	 * The kernel allocates the ring when we ask it to create the
+	 * ring, so, for that, have our allocations prefer the node on
+	 * which we were asked to put the buffer.
+	 */
+	if (set_numa_policy(handle, &old_policy) == -1) {
+		free(handlep->oneshot_buffer);
+		*status = PCAP_ERROR;
+		return -1;
+	}
 	ret = create_ring(handle, status);
+	restore_numa_policy(handle, &old_policy);
 	if (ret == 0) {
 		/*
 		 * We don't support memory-mapped capture; our caller
 		 * will fall back on reading from the socket.
+		 *
+		 * We only handle the virtio-net header in the ring.
 		 */
 		free(handlep->oneshot_buffer);
+		if (handlep->vnet_hdr_len != 0) {
+			strlcpy(handle->errbuf,
+			    "Virtio-net headers require memory-mapped capture",
+			    PCAP_ERRBUF_SIZE);
+			*status = PCAP_ERROR;
+			return -1;
+		}
 		return 0;
 	}
 	if (ret == -1) {
@@ -3435,6 +4901,40 @@ activate_mmap(pcap_t *handle, int *status)
 		return -1;
 	}
 
+	if (handle->opt.multi_consumer) {
+		if (init_multi_consumer(handle) == -1) {
+			destroy_ring(handle);
+			free(handlep->oneshot_buffer);
+			*status = PCAP_ERROR;
+			return -1;
+		}
+	}
+	if (handle->opt.resegment) {
+		if (init_resegment(handle) == -1) {
+			destroy_ring(handle);
+			free(handlep->oneshot_buffer);
+			*status = PCAP_ERROR;
+			return -1;
+		}
+	}
+	handlep->release_fd = -1;
+	if (handle->opt.hold_mode) {
+		/*
+		 * If the application is holding every frame in the
+		 * ring, a blocking read waits on this for another thread
+		 * to release some.
+		 */
+		handlep->release_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+		if (handlep->release_fd == -1) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't create eventfd: %s", pcap_strerror(errno));
+			destroy_ring(handle);
+			free(handlep->oneshot_buffer);
+			*status = PCAP_ERROR;
+			return -1;
+		}
+	}
+
 	/*
 	 * Success.  *status has been set either to 0 if there are no
 	 * warnings or to a PCAP_WARNING_ value if there is a warning.
@@ -3444,30 +4944,148 @@ activate_mmap(pcap_t *handle, int *status)
 	 * handle->offset is used to get the current position into the rx ring.
 	 * handle->cc is used to store the ring size.
 	 */
-
-	switch (handlep->tp_version) {
-	case TPACKET_V1:
-		handle->read_op = pcap_read_linux_mmap_v1;
-		break;
-#ifdef HAVE_TPACKET2
-	case TPACKET_V2:
-		handle->read_op = pcap_read_linux_mmap_v2;
-		break;
-#endif
-#ifdef HAVE_TPACKET3
-	case TPACKET_V3:
-		handle->read_op = pcap_read_linux_mmap_v3;
-		break;
+
+	pcap_set_read_op_mmap(handle);
+	if (handlep->tx_ring != NULL) {
+		/*
+		 * Once there's a transmit ring, the kernel sends from
+		 * the ring rather than from the buffer handed to send(),
+		 * so all sends have to go through the ring.
+		 */
+		handle->inject_op = pcap_inject_linux_mmap;
+		handle->inject_queue_op = pcap_inject_queue_linux_mmap;
+		handle->inject_flush_op = pcap_inject_flush_linux_mmap;
+	}
+
+#ifdef SO_ATTACH_FILTER
+	/*
+	 * The kernel only cuts a packet off at the snapshot length
+	 * when a filter program returns that length, so, until a
+	 * filter is set, attach one that does only that; that way,
+	 * the part of the packet that we'd discard isn't copied into
+	 * the ring.
+	 *
+	 * This is just an optimization, so ignore errors.
+	 */
+	if (handle->snapshot < MAXIMUM_SNAPLEN)
+		(void)set_kernel_snaplen_filter(handle);
 #endif
-	}
+
 	handle->cleanup_op = pcap_cleanup_linux_mmap;
 	handle->setfilter_op = pcap_setfilter_linux_mmap;
 	handle->setnonblock_op = pcap_setnonblock_mmap;
 	handle->getnonblock_op = pcap_getnonblock_mmap;
 	handle->oneshot_callback = pcap_oneshot_mmap;
+	handle->read_batch_op = pcap_read_batch_linux_mmap;
+	handle->batch_callback = pcap_batch_mmap;
+	handle->release_op = pcap_release_linux_mmap;
+	if (handle->opt.hold_mode) {
+		/*
+		 * The packet stays in the ring until the application
+		 * releases it, so pcap_next() and pcap_next_ex() don't
+		 * need to copy it.
+		 */
+		handlep->hold_frames = 1;
+		handle->oneshot_callback = pcap_oneshot;
+	}
+	if (handle->opt.multi_consumer) {
+		/*
+		 * Blocks are handed back to the kernel as soon as
+		 * they've been read, so pcap_next_batch() has to copy
+		 * the packets.
+		 */
+		handle->read_batch_op = handle->read_op;
+		handle->batch_callback = pcap_batch;
+	}
+	if (handle->opt.resegment) {
+		/*
+		 * The segments we hand out are in our arena, not in
+		 * the ring, so pcap_next_batch() has to copy them.
+		 */
+		handle->read_batch_op = handle->read_op;
+		handle->batch_callback = pcap_batch_linux;
+	}
 	handle->selectable_fd = handle->fd;
 	return 1;
 }
+
+/*
+ * Set up for several threads to read from the ring at once.
+ */
+static int
+init_multi_consumer(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+#ifdef HAVE_TPACKET3
+	if (handlep->tp_version != TPACKET_V3) {
+		strlcpy(handle->errbuf,
+		    "Multi-consumer mode requires a TPACKET_V3 ring",
+		    PCAP_ERRBUF_SIZE);
+		return -1;
+	}
+	if (handle->opt.hold_mode) {
+		strlcpy(handle->errbuf,
+		    "Multi-consumer mode can't be used with hold mode",
+		    PCAP_ERRBUF_SIZE);
+		return -1;
+	}
+	handlep->mc_claimed = calloc(handle->cc, 1);
+	if (handlep->mc_claimed == NULL) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return -1;
+	}
+	handlep->mc_next_block = 0;
+	return 0;
+#else
+	strlcpy(handle->errbuf,
+	    "Multi-consumer mode requires a TPACKET_V3 ring",
+	    PCAP_ERRBUF_SIZE);
+	return -1;
+#endif
+}
+
+/*
+ * Set up to split aggregated packets, allocating the arena for their
+ * segments; a packet's segments, with a copy of its headers in front
+ * of each, take up at most RESEG_MAX_SEGS * RESEG_MAX_HDR more bytes
+ * than the packet.
+ */
+static int
+init_resegment(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	if (handle->opt.hold_mode) {
+		strlcpy(handle->errbuf,
+		    "Resegmentation can't be used with hold mode",
+		    PCAP_ERRBUF_SIZE);
+		return -1;
+	}
+	if (handle->opt.multi_consumer) {
+		strlcpy(handle->errbuf,
+		    "Resegmentation can't be used in multi-consumer mode",
+		    PCAP_ERRBUF_SIZE);
+		return -1;
+	}
+	handlep->reseg_arena = malloc(handle->snapshot +
+	    RESEG_MAX_SEGS * RESEG_MAX_HDR);
+	handlep->reseg_segs = malloc(RESEG_MAX_SEGS *
+	    sizeof(struct reseg_seg));
+	if (handlep->reseg_arena == NULL || handlep->reseg_segs == NULL) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		free(handlep->reseg_arena);
+		free(handlep->reseg_segs);
+		handlep->reseg_arena = NULL;
+		handlep->reseg_segs = NULL;
+		return -1;
+	}
+	handlep->reseg_count = 0;
+	handlep->reseg_next = 0;
+	return 0;
+}
 #else /* HAVE_PACKET_RING */
 static int
 activate_mmap(pcap_t *handle _U_, int *status _U_)
@@ -3560,9 +5178,11 @@ prepare_tpacket_socket(pcap_t *handle)
 	 *
 	 * The buffering cannot be disabled in that mode, so
 	 * if the user has requested immediate mode, we don't
-	 * use TPACKET_V3.
+	 * use TPACKET_V3.  Busy-polling the ring would be
+	 * pointless with buffering, so it implies immediate
+	 * mode.
 	 */
-	if (handle->opt.immediate)
+	if (handle->opt.immediate || handle->opt.busy_poll > 0)
 		ret = 1; /* pretend TPACKET_V3 couldn't be set */
 	else
 		ret = init_tpacket(handle, TPACKET_V3, "TPACKET_V3");
@@ -3618,12 +5238,25 @@ create_ring(pcap_t *handle, int *status)
 	socklen_t len;
 	unsigned int sk_type, tp_reserve, maclen, tp_hdrlen, netoff, macoff;
 	unsigned int frame_size;
+	size_t rx_len, tx_len;
+#ifdef HAVE_TPACKET3
+	unsigned int retire_tov;
+#endif
 
 	/*
 	 * Start out assuming no warnings or errors.
 	 */
 	*status = 0;
 
+#ifdef HAVE_TPACKET3
+	/*
+	 * By default, time out blocks after the configured buffering
+	 * timeout, or have the kernel pick a timeout if we're in
+	 * non-blocking mode.
+	 */
+	retire_tov = (handlep->timeout>=0)?handlep->timeout:0;
+#endif
+
 	switch (handlep->tp_version) {
 
 	case TPACKET_V1:
@@ -3730,6 +5363,7 @@ create_ring(pcap_t *handle, int *status)
 			 */
 		tp_hdrlen = TPACKET_ALIGN(handlep->tp_hdrlen) + sizeof(struct sockaddr_ll) ;
 		netoff = TPACKET_ALIGN(tp_hdrlen + (maclen < 16 ? 16 : maclen)) + tp_reserve;
+		netoff += handlep->vnet_hdr_len;	/* the kernel puts it before the packet */
 			/* NOTE: AFAICS tp_reserve may break the TPACKET_ALIGN
 			 * of netoff, which contradicts
 			 * linux-2.6/Documentation/networking/packet_mmap.txt
@@ -3756,6 +5390,12 @@ create_ring(pcap_t *handle, int *status)
 		 * in the "frame". */
 		req.tp_frame_size = MAXIMUM_SNAPLEN;
 		req.tp_frame_nr = handle->opt.buffer_size/req.tp_frame_size;
+
+		/*
+		 * Override that with whatever the user asked for
+		 * with pcap_set_ring_geometry().
+		 */
+		set_ring_geometry_v3(handle, &req, &retire_tov);
 		break;
 #endif
 	default:
@@ -3879,6 +5519,19 @@ create_ring(pcap_t *handle, int *status)
 	}
 #endif /* HAVE_LINUX_NET_TSTAMP_H && PACKET_TIMESTAMP */
 
+	/*
+	 * If we were asked for a transmit buffer, set up a tx ring
+	 * first; PACKET_LOSS can't be changed once either ring
+	 * exists.
+	 */
+	tx_len = 0;
+	if (handle->opt.tx_buffer_size > 0) {
+		if (create_tx_ring(handle, &tx_len) == -1) {
+			*status = PCAP_ERROR;
+			return -1;
+		}
+	}
+
 	/* ask the kernel to create the ring */
 retry:
 	req.tp_block_nr = req.tp_frame_nr / frames_per_block;
@@ -3888,11 +5541,11 @@ retry:
 
 #ifdef HAVE_TPACKET3
 	/* timeout value to retire block - use the configured buffering timeout, or default if <0. */
-	req.tp_retire_blk_tov = (handlep->timeout>=0)?handlep->timeout:0;
+	req.tp_retire_blk_tov = retire_tov;
 	/* private data not used */
 	req.tp_sizeof_priv = 0;
-	/* Rx ring - feature request bits - none (rxhash will not be filled) */
-	req.tp_feature_req_word = 0;
+	/* Rx ring - feature request bits - have the rxhash filled in */
+	req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
 #endif
 
 	if (setsockopt(handle->fd, SOL_PACKET, PACKET_RX_RING,
@@ -3917,17 +5570,25 @@ retry:
 			/*
 			 * We don't have ring buffer support in this kernel.
 			 */
+			destroy_ring(handle);
 			return 0;
 		}
 		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
 		    "can't create rx ring on packet socket: %s",
 		    pcap_strerror(errno));
+		destroy_ring(handle);
 		*status = PCAP_ERROR;
 		return -1;
 	}
 
-	/* memory map the rx ring */
-	handlep->mmapbuflen = req.tp_block_nr * req.tp_block_size;
+	/*
+	 * The tx ring, if any, is mapped with the same mmap() as the
+	 * rx ring, after it.
+	 */
+	rx_len = req.tp_block_nr * req.tp_block_size;
+
+	/* memory map the rx ring, and the tx ring if we have one */
+	handlep->mmapbuflen = rx_len + tx_len;
 	handlep->mmapbuf = mmap(0, handlep->mmapbuflen,
 	    PROT_READ|PROT_WRITE, MAP_SHARED, handle->fd, 0);
 	if (handlep->mmapbuf == MAP_FAILED) {
@@ -3935,10 +5596,16 @@ retry:
 		    "can't mmap rx ring: %s", pcap_strerror(errno));
 
 		/* clear the allocated ring on error*/
+		handlep->mmapbuf = NULL;
 		destroy_ring(handle);
 		*status = PCAP_ERROR;
 		return -1;
 	}
+	if (tx_len != 0) {
+		handlep->tx_ring = handlep->mmapbuf + rx_len;
+		handlep->tx_offset = 0;
+		handlep->tx_queued = 0;
+	}
 
 	/* allocate a ring for each frame header pointer*/
 	handle->cc = req.tp_frame_nr;
@@ -3968,6 +5635,109 @@ retry:
 	return 1;
 }
 
+#ifdef HAVE_TPACKET3
+/*
+ * Parameters for picking TPACKET_V3 ring geometry automatically:
+ *
+ * a block should fill in about RING_AUTO_FILL_MS milliseconds at
+ * line rate, but be no bigger than RING_AUTO_MAX_BLOCK unless it
+ * has to be to hold a snapshot-length packet;
+ *
+ * a block that isn't full is retired after the time it would take
+ * to fill at line rate;
+ *
+ * there should be enough blocks to buffer RING_AUTO_BUFFER_MS
+ * milliseconds of traffic at line rate, but at least
+ * RING_AUTO_MIN_BLOCKS blocks and, if possible, no more than
+ * RING_AUTO_MAX_SIZE bytes' worth.
+ *
+ * If we can't get the interface speed, we assume RING_AUTO_SPEED
+ * megabits per second.
+ */
+#define RING_AUTO_FILL_MS	1
+#define RING_AUTO_MAX_BLOCK	(4*1024*1024)
+#define RING_AUTO_BUFFER_MS	100
+#define RING_AUTO_MIN_BLOCKS	4
+#define RING_AUTO_MAX_SIZE	(64*1024*1024)
+#define RING_AUTO_SPEED		1000
+
+/*
+ * Apply the geometry set with pcap_set_ring_geometry(), if any, to
+ * the request for a TPACKET_V3 ring; as with TPACKET_V3 each "frame"
+ * is a block, that means setting the frame size and count.
+ */
+static void
+set_ring_geometry_v3(pcap_t *handle, struct tpacket_req3 *req,
+    unsigned int *retire_tov)
+{
+	unsigned int block_size, min_block_size, block_nr;
+	unsigned long bytes_per_ms;
+	int speed;
+
+	if (handle->opt.ring_block_size == 0 &&
+	    handle->opt.ring_block_nr == 0 &&
+	    handle->opt.ring_retire_tov == 0)
+		return;
+
+	/*
+	 * Get the line rate in bytes per millisecond; a speed of 1
+	 * megabit per second is 125 bytes per millisecond.
+	 */
+	speed = iface_get_speed(handle);
+	if (speed <= 0)
+		speed = RING_AUTO_SPEED;
+	bytes_per_ms = (unsigned long)speed * 125;
+
+	block_size = req->tp_frame_size;
+	if (handle->opt.ring_block_size > 0)
+		block_size = handle->opt.ring_block_size;
+	else if (handle->opt.ring_block_size == PCAP_RING_AUTO) {
+		/*
+		 * The block has to hold at least a block header and
+		 * one packet of the snapshot length, with its
+		 * tpacket3_hdr and link-layer header.
+		 */
+		min_block_size = TPACKET_ALIGN(sizeof(struct tpacket_block_desc)) +
+		    TPACKET_ALIGN(TPACKET3_HDRLEN) + MAX_LINKHEADER_SIZE +
+		    handle->snapshot;
+		block_size = getpagesize();
+		while (block_size < min_block_size ||
+		    (block_size < bytes_per_ms * RING_AUTO_FILL_MS &&
+		     block_size < RING_AUTO_MAX_BLOCK))
+			block_size <<= 1;
+	}
+
+	if (handle->opt.ring_block_nr > 0)
+		block_nr = handle->opt.ring_block_nr;
+	else if (handle->opt.ring_block_nr == PCAP_RING_AUTO) {
+		block_nr = (bytes_per_ms * RING_AUTO_BUFFER_MS) / block_size;
+		if (block_nr > RING_AUTO_MAX_SIZE / block_size)
+			block_nr = RING_AUTO_MAX_SIZE / block_size;
+		if (block_nr < RING_AUTO_MIN_BLOCKS)
+			block_nr = RING_AUTO_MIN_BLOCKS;
+	} else {
+		/*
+		 * Use the buffer size, as we would by default,
+		 * but in blocks of the size we're now using.
+		 */
+		block_nr = handle->opt.buffer_size / block_size;
+		if (block_nr == 0)
+			block_nr = 1;
+	}
+
+	if (handle->opt.ring_retire_tov > 0)
+		*retire_tov = handle->opt.ring_retire_tov;
+	else if (handle->opt.ring_retire_tov == PCAP_RING_AUTO) {
+		*retire_tov = block_size / bytes_per_ms;
+		if (*retire_tov == 0)
+			*retire_tov = 1;
+	}
+
+	req->tp_frame_size = block_size;
+	req->tp_frame_nr = block_nr;
+}
+#endif /* HAVE_TPACKET3 */
+
 /* free all ring related resources*/
 static void
 destroy_ring(pcap_t *handle)
@@ -3980,6 +5750,11 @@ destroy_ring(pcap_t *handle)
 	/* do not test for setsockopt failure, as we can't recover from any error */
 	(void)setsockopt(handle->fd, SOL_PACKET, PACKET_RX_RING,
 				(void *) &req, sizeof(req));
+	if (handlep->tx_frame_nr != 0) {
+		(void)setsockopt(handle->fd, SOL_PACKET, PACKET_TX_RING,
+					(void *) &req, sizeof(req));
+		handlep->tx_frame_nr = 0;
+	}
 
 	/* if ring is mapped, unmap it*/
 	if (handlep->mmapbuf) {
@@ -3987,6 +5762,289 @@ destroy_ring(pcap_t *handle)
 		(void)munmap(handlep->mmapbuf, handlep->mmapbuflen);
 		handlep->mmapbuf = NULL;
 	}
+	handlep->tx_ring = NULL;
+}
+
+/*
+ * Attempt to set up a tx ring, sized from the transmit buffer size,
+ * on a socket that's already had its version set up by
+ * prepare_tpacket_socket(); it's mapped by our caller, after the
+ * rx ring.
+ *
+ * On success, returns 1 and sets *tx_len to the size of the ring.
+ *
+ * If we can't send on this socket, or the kernel can't do a tx ring
+ * for it, returns 0, and leaves *tx_len at 0; pcap_inject_queue()
+ * then just sends packets as they're queued.
+ *
+ * On error, returns -1 and sets handle->errbuf.
+ */
+static int
+create_tx_ring(pcap_t *handle, size_t *tx_len)
+{
+	struct pcap_linux *handlep = handle->priv;
+#ifdef HAVE_TPACKET3
+	struct tpacket_req3 req;
+#else
+	struct tpacket_req req;
+#endif
+	int mtu;
+#ifdef PACKET_LOSS
+	int val;
+#endif
+
+	/*
+	 * We don't support sending on the "any" device or in cooked
+	 * mode; see pcap_inject_linux().
+	 */
+	if (handlep->ifindex == -1 || handlep->cooked)
+		return 0;
+
+	mtu = iface_get_mtu(handle->fd, handle->opt.source, handle->errbuf);
+	if (mtu == -1)
+		return -1;
+
+	/*
+	 * The kernel expects the packet data to start right after the
+	 * aligned frame header, so each frame has to have room for
+	 * that header plus a link-layer header and an MTU's worth of
+	 * data.
+	 *
+	 * The rx-only fields of a struct tpacket_req3 must be zero
+	 * for a tx ring.
+	 */
+	memset(&req, 0, sizeof(req));
+	req.tp_frame_size = TPACKET_ALIGN(TPACKET_ALIGN(handlep->tp_hdrlen) +
+	    MAX_LINKHEADER_SIZE + mtu);
+	req.tp_block_size = getpagesize();
+	while (req.tp_block_size < req.tp_frame_size)
+		req.tp_block_size <<= 1;
+	handlep->tx_frames_per_block = req.tp_block_size/req.tp_frame_size;
+	req.tp_block_nr = (handle->opt.tx_buffer_size/req.tp_frame_size) /
+	    handlep->tx_frames_per_block;
+	if (req.tp_block_nr == 0)
+		req.tp_block_nr = 1;
+	req.tp_frame_nr = req.tp_block_nr * handlep->tx_frames_per_block;
+
+#ifdef PACKET_LOSS
+	/*
+	 * Have the kernel skip frames it can't send, rather than
+	 * stopping at them; otherwise a single bad frame would stall
+	 * the ring, as we never go back to rewrite frames.
+	 */
+	val = 1;
+	if (setsockopt(handle->fd, SOL_PACKET, PACKET_LOSS, &val,
+	    sizeof(val)) == -1) {
+		if (errno == ENOPROTOOPT)
+			return 0;
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't set PACKET_LOSS on packet socket: %s",
+		    pcap_strerror(errno));
+		return -1;
+	}
+#endif
+
+	if (setsockopt(handle->fd, SOL_PACKET, PACKET_TX_RING,
+	    (void *) &req, sizeof(req)) == -1) {
+		if (errno == ENOPROTOOPT || errno == EINVAL) {
+			/*
+			 * ENOPROTOOPT means the kernel doesn't support
+			 * tx rings at all; EINVAL means it doesn't
+			 * support them with this TPACKET_ version
+			 * (kernels before 4.11 can't do TPACKET_V3
+			 * tx rings).
+			 */
+			return 0;
+		}
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't create tx ring on packet socket: %s",
+		    pcap_strerror(errno));
+		return -1;
+	}
+	handlep->tx_block_size = req.tp_block_size;
+	handlep->tx_frame_size = req.tp_frame_size;
+	handlep->tx_frame_nr = req.tp_frame_nr;
+	*tx_len = req.tp_block_nr * req.tp_block_size;
+	return 1;
+}
+
+/*
+ * Make sure the packet data in a tx frame is visible to the kernel
+ * before the status change that hands the frame to it.
+ */
+#ifdef __GNUC__
+#define TX_RING_WRITE_BARRIER()	__sync_synchronize()
+#else
+#define TX_RING_WRITE_BARRIER()
+#endif
+
+static inline u_char *
+pcap_get_tx_frame(struct pcap_linux *handlep, u_int idx)
+{
+	return handlep->tx_ring +
+	    (idx / handlep->tx_frames_per_block) * handlep->tx_block_size +
+	    (idx % handlep->tx_frames_per_block) * handlep->tx_frame_size;
+}
+
+/*
+ * Is the given tx frame free, i.e. neither waiting to be sent nor
+ * being sent?  (The kernel may have put time stamp status bits into
+ * the status of a frame it's finished with.)
+ */
+static inline int
+pcap_tx_frame_is_free(struct pcap_linux *handlep, u_char *frame)
+{
+	unsigned long status;
+
+	switch (handlep->tp_version) {
+	case TPACKET_V1:
+		status = ((struct tpacket_hdr *)frame)->tp_status;
+		break;
+#ifdef HAVE_TPACKET2
+	case TPACKET_V2:
+		status = ((struct tpacket2_hdr *)frame)->tp_status;
+		break;
+#endif
+#ifdef HAVE_TPACKET3
+	case TPACKET_V3:
+		status = ((struct tpacket3_hdr *)frame)->tp_status;
+		break;
+#endif
+	default:
+		return 0;
+	}
+	return (status & (TP_STATUS_SEND_REQUEST|TP_STATUS_SENDING)) == 0;
+}
+
+/*
+ * Tell the kernel to send all the frames in the tx ring that are
+ * waiting to be sent; in blocking mode, wait until they've all been
+ * sent.
+ */
+static int
+pcap_kick_tx_ring(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	int ret;
+
+	do {
+		ret = send(handle->fd, NULL, 0, 0);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1) {
+		if (errno == EAGAIN) {
+			/*
+			 * Non-blocking mode and the device queue
+			 * is full; the frames stay queued for the
+			 * next kick.
+			 */
+			return 0;
+		}
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE, "send: %s",
+		    pcap_strerror(errno));
+		return -1;
+	}
+	handlep->tx_queued = 0;
+	return 0;
+}
+
+static int
+pcap_inject_queue_linux_mmap(pcap_t *handle, const void *buf, size_t size)
+{
+	struct pcap_linux *handlep = handle->priv;
+	unsigned int hdrlen = TPACKET_ALIGN(handlep->tp_hdrlen);
+	u_char *frame;
+
+	if (size > handlep->tx_frame_size - hdrlen) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "packet of %lu bytes is too big for the tx ring (maximum %u)",
+		    (unsigned long)size, handlep->tx_frame_size - hdrlen);
+		return -1;
+	}
+
+	frame = pcap_get_tx_frame(handlep, handlep->tx_offset);
+	if (!pcap_tx_frame_is_free(handlep, frame)) {
+		/*
+		 * The ring is full; send what's in it.  In blocking
+		 * mode, that waits until everything's been sent, so
+		 * the frame will be free afterwards; in non-blocking
+		 * mode, tell our caller to try again later.
+		 */
+		if (pcap_kick_tx_ring(handle) == -1)
+			return -1;
+		if (!pcap_tx_frame_is_free(handlep, frame)) {
+			if (handlep->timeout < 0)
+				return 0;
+			strlcpy(handle->errbuf,
+			    "tx ring frame still in use after sending",
+			    PCAP_ERRBUF_SIZE);
+			return -1;
+		}
+	}
+
+	memcpy(frame + hdrlen, buf, size);
+	switch (handlep->tp_version) {
+	case TPACKET_V1:
+		((struct tpacket_hdr *)frame)->tp_len = size;
+		TX_RING_WRITE_BARRIER();
+		((struct tpacket_hdr *)frame)->tp_status = TP_STATUS_SEND_REQUEST;
+		break;
+#ifdef HAVE_TPACKET2
+	case TPACKET_V2:
+		((struct tpacket2_hdr *)frame)->tp_len = size;
+		TX_RING_WRITE_BARRIER();
+		((struct tpacket2_hdr *)frame)->tp_status = TP_STATUS_SEND_REQUEST;
+		break;
+#endif
+#ifdef HAVE_TPACKET3
+	case TPACKET_V3:
+		/*
+		 * The kernel rejects TPACKET_V3 tx frames that claim
+		 * to be followed by another frame.
+		 */
+		((struct tpacket3_hdr *)frame)->tp_next_offset = 0;
+		((struct tpacket3_hdr *)frame)->tp_len = size;
+		TX_RING_WRITE_BARRIER();
+		((struct tpacket3_hdr *)frame)->tp_status = TP_STATUS_SEND_REQUEST;
+		break;
+#endif
+	}
+
+	if (++handlep->tx_offset >= handlep->tx_frame_nr)
+		handlep->tx_offset = 0;
+	handlep->tx_queued++;
+	return size;
+}
+
+static int
+pcap_inject_flush_linux_mmap(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	if (handlep->tx_queued == 0)
+		return 0;
+	return pcap_kick_tx_ring(handle);
+}
+
+static int
+pcap_inject_linux_mmap(pcap_t *handle, const void *buf, size_t size)
+{
+	int ret;
+
+	ret = pcap_inject_queue_linux_mmap(handle, buf, size);
+	if (ret == -1)
+		return -1;
+	if (ret == 0) {
+		/*
+		 * No room in the ring in non-blocking mode; report
+		 * it the way a full socket buffer would be reported.
+		 */
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE, "send: %s",
+		    pcap_strerror(EAGAIN));
+		return -1;
+	}
+	if (pcap_inject_flush_linux_mmap(handle) == -1)
+		return -1;
+	return ret;
 }
 
 /*
@@ -4019,6 +6077,24 @@ pcap_oneshot_mmap(u_char *user, const struct pcap_pkthdr *h,
 	*sp->pkt = handlep->oneshot_buffer;
 }
 
+/*
+ * For pcap_next_batch(), we don't copy the packets; instead, we hold
+ * on to the frames they're in until the next read.
+ */
+static void
+pcap_batch_mmap(u_char *user, const struct pcap_pkthdr *h,
+    const u_char *bytes)
+{
+	struct batch_userdata *sp = (struct batch_userdata *)user;
+	struct pcap_linux *handlep = sp->pd->priv;
+
+	if (handlep->batch_metas_wanted)
+		handlep->batch_metas[sp->cnt] = handlep->pkt_meta;
+	sp->hdrs[sp->cnt] = *h;
+	sp->pkts[sp->cnt] = bytes;
+	sp->cnt++;
+}
+
 static void
 pcap_cleanup_linux_mmap( pcap_t *handle )
 {
@@ -4029,6 +6105,20 @@ pcap_cleanup_linux_mmap( pcap_t *handle )
 		free(handlep->oneshot_buffer);
 		handlep->oneshot_buffer = NULL;
 	}
+	if (handlep->mc_claimed != NULL) {
+		free(handlep->mc_claimed);
+		handlep->mc_claimed = NULL;
+	}
+	if (handlep->release_fd != -1) {
+		close(handlep->release_fd);
+		handlep->release_fd = -1;
+	}
+	if (handlep->reseg_arena != NULL) {
+		free(handlep->reseg_arena);
+		free(handlep->reseg_segs);
+		handlep->reseg_arena = NULL;
+		handlep->reseg_segs = NULL;
+	}
 	pcap_cleanup_linux(handle);
 }
 
@@ -4105,10 +6195,327 @@ pcap_get_ring_frame(pcap_t *handle, int status)
 	return h.raw;
 }
 
+/*
+ * In hold mode, pcap_release() may be called from other threads while
+ * we're reading, so the held-frame bookkeeping is protected by a lock;
+ * the reading thread only ever adds frames after the ones being held,
+ * and pcap_release() only ever removes them from the front.
+ */
+static inline void
+pcap_lock_held_mmap(struct pcap_linux *handlep)
+{
+	while (__sync_lock_test_and_set(&handlep->held_lock, 1))
+		;
+}
+
+static inline void
+pcap_unlock_held_mmap(struct pcap_linux *handlep)
+{
+	__sync_lock_release(&handlep->held_lock);
+}
+
+/*
+ * Number of frames we're holding.  pcap_release() can only make that
+ * go down, so, if we see a stale value, we just read fewer frames.
+ */
+static inline int
+pcap_held_count_mmap(struct pcap_linux *handlep)
+{
+	return (__atomic_load_n(&handlep->held_count, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * We're done with the frame (or, for TPACKET_V3, the block) at the
+ * current ring position, but we're holding frames for the application;
+ * remember that this one's held, rather than handing it back to the
+ * kernel.  The held frames are always consecutive in the ring.
+ */
+static inline void
+pcap_hold_frame_mmap(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	pcap_lock_held_mmap(handlep);
+	if (handlep->held_count == 0)
+		handlep->held_offset = handle->offset;
+	__atomic_store_n(&handlep->held_count, handlep->held_count + 1,
+	    __ATOMIC_RELEASE);
+	pcap_unlock_held_mmap(handlep);
+}
+
+/*
+ * Hand the first "count" frames we're holding back to the kernel; the
+ * lock must be held.  Returns 1 if we were holding every frame in the
+ * ring and now aren't, so that a read waiting for frames to be released
+ * should be woken up, and 0 otherwise.
+ */
+static int
+pcap_release_frames_locked_mmap(pcap_t *handle, int count)
+{
+	struct pcap_linux *handlep = handle->priv;
+	union thdr h;
+	int was_full;
+
+	was_full = handlep->held_count >= handle->cc;
+	for (; count != 0; count--) {
+		h.raw = RING_GET_FRAME_AT(handle, handlep->held_offset);
+		switch (handlep->tp_version) {
+		case TPACKET_V1:
+			h.h1->tp_status = TP_STATUS_KERNEL;
+			break;
+#ifdef HAVE_TPACKET2
+		case TPACKET_V2:
+			h.h2->tp_status = TP_STATUS_KERNEL;
+			break;
+#endif
+#ifdef HAVE_TPACKET3
+		case TPACKET_V3:
+			h.h3->hdr.bh1.block_status = TP_STATUS_KERNEL;
+			break;
+#endif
+		}
+		if (++handlep->held_offset >= handle->cc)
+			handlep->held_offset = 0;
+		__atomic_store_n(&handlep->held_count,
+		    handlep->held_count - 1, __ATOMIC_RELEASE);
+	}
+	return (was_full && handlep->held_count < handle->cc);
+}
+
+/* wake up a read waiting for frames to be released */
+static void
+pcap_wake_for_release_mmap(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	uint64_t one = 1;
+
+	if (handlep->release_fd != -1)
+		(void)write(handlep->release_fd, &one, sizeof one);
+}
+
+/* hand all the frames we're holding back to the kernel */
+static void
+pcap_release_held_frames_mmap(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	int wake;
+
+	pcap_lock_held_mmap(handlep);
+	wake = pcap_release_frames_locked_mmap(handle, handlep->held_count);
+	pcap_unlock_held_mmap(handlep);
+	if (wake)
+		pcap_wake_for_release_mmap(handle);
+}
+
+/*
+ * Hand the frame holding the given packet, and all the frames before
+ * it, back to the kernel; if the packet is null, hand back all the
+ * frames we're holding.
+ */
+static int
+pcap_release_linux_mmap(pcap_t *handle, const u_char *pkt)
+{
+	struct pcap_linux *handlep = handle->priv;
+	u_char *frame;
+	int offset, n, wake;
+
+	if (pkt == NULL) {
+		pcap_release_held_frames_mmap(handle);
+		return 0;
+	}
+
+	/*
+	 * Find the frame holding the packet; in TPACKET_V3, a
+	 * "frame" is a block, which holds several packets.
+	 */
+	pcap_lock_held_mmap(handlep);
+	offset = handlep->held_offset;
+	for (n = 0; n < handlep->held_count; n++) {
+		frame = (u_char *)RING_GET_FRAME_AT(handle, offset);
+		if (pkt >= frame && pkt < frame + handle->bufsize)
+			break;
+		if (++offset >= handle->cc)
+			offset = 0;
+	}
+	if (n < handlep->held_count) {
+		wake = pcap_release_frames_locked_mmap(handle, n + 1);
+		pcap_unlock_held_mmap(handlep);
+		if (wake)
+			pcap_wake_for_release_mmap(handle);
+		return 0;
+	}
+
+#ifdef HAVE_TPACKET3
+	/*
+	 * The packet may be in the TPACKET_V3 block we haven't finished
+	 * reading, which is the one after the blocks we're holding; we
+	 * can't hand that block back yet, so we'll hold it once we've
+	 * finished reading it.
+	 */
+	if (handlep->tp_version == TPACKET_V3) {
+		frame = (u_char *)RING_GET_FRAME_AT(handle, offset);
+		if (pkt >= frame && pkt < frame + handle->bufsize) {
+			wake = pcap_release_frames_locked_mmap(handle,
+			    handlep->held_count);
+			pcap_unlock_held_mmap(handlep);
+			if (wake)
+				pcap_wake_for_release_mmap(handle);
+			return 0;
+		}
+	}
+#endif
+	pcap_unlock_held_mmap(handlep);
+	snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+	    "The packet to release isn't in the ring or was already released");
+	return -1;
+}
+
+/*
+ * The application is holding every frame in the ring; unless we're in
+ * non-blocking mode, wait, for up to the timeout, for it to release
+ * some.  Returns 0 if it did, 1 if it didn't, and PCAP_ERROR_BREAK or
+ * PCAP_ERROR if the loop was broken out of or on an error.
+ */
+static int
+pcap_wait_for_release_mmap(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct pollfd pollinfo;
+	uint64_t count;
+	int ret;
+
+	if (handlep->timeout < 0 || handlep->release_fd == -1)
+		return 1;
+
+	pollinfo.fd = handlep->release_fd;
+	pollinfo.events = POLLIN;
+	while (pcap_held_count_mmap(handlep) >= handle->cc) {
+		if (handle->break_loop) {
+			handle->break_loop = 0;
+			return PCAP_ERROR_BREAK;
+		}
+		ret = poll(&pollinfo, 1,
+		    handlep->timeout == 0 ? -1 : handlep->timeout);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't poll for released frames: %s",
+			    pcap_strerror(errno));
+			return PCAP_ERROR;
+		}
+		if (ret == 0)
+			return 1;	/* timed out */
+		(void)read(handlep->release_fd, &count, sizeof count);
+	}
+	return 0;
+}
+
+/*
+ * Check, before reading from the ring, whether we're holding frames;
+ * if we are, and we've been asked to stop holding them, hand them back
+ * to the kernel.  If the application is holding every frame in the
+ * ring, wait for it to release some.  Returns 0 if there may be frames
+ * to read, 1 if there aren't, and PCAP_ERROR_BREAK or PCAP_ERROR if the
+ * loop was broken out of or on an error.
+ */
+static inline int
+pcap_check_held_frames_mmap(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	if (pcap_held_count_mmap(handlep) == 0)
+		return 0;
+	if (!handlep->hold_frames) {
+		pcap_release_held_frames_mmap(handle);
+		return 0;
+	}
+	if (pcap_held_count_mmap(handlep) < handle->cc)
+		return 0;
+	return pcap_wait_for_release_mmap(handle);
+}
+
+/*
+ * Read packets for pcap_next_batch(); the packets in the batch point
+ * into the ring, so we hold on to the frames they're in until the next
+ * read from the ring, rather than handing each frame back to the kernel
+ * as soon as we're done with it.
+ */
+static int
+pcap_read_batch_linux_mmap(pcap_t *handle, int max_packets,
+    pcap_handler callback, u_char *user)
+{
+	struct pcap_linux *handlep = handle->priv;
+	int ret;
+
+	/*
+	 * In hold mode, the application hands the frames back with
+	 * pcap_release(), so we leave that to it.
+	 */
+	if (handlep->hold_frames)
+		return handle->read_op(handle, max_packets, callback, user);
+
+	/* the previous batch is no longer in use */
+	pcap_release_held_frames_mmap(handle);
+
+	handlep->hold_frames = 1;
+	ret = handle->read_op(handle, max_packets, callback, user);
+	handlep->hold_frames = 0;
+	return ret;
+}
+
 #ifndef POLLRDHUP
 #define POLLRDHUP 0
 #endif
 
+/*
+ * Hint to the CPU that we're spinning; the "memory" clobber also
+ * makes sure the ring frame status is re-read on every check.
+ */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define BUSY_POLL_PAUSE()	__asm__ __volatile__("pause" ::: "memory")
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define BUSY_POLL_PAUSE()	__asm__ __volatile__("yield" ::: "memory")
+#elif defined(__GNUC__)
+#define BUSY_POLL_PAUSE()	__asm__ __volatile__("" ::: "memory")
+#else
+#define BUSY_POLL_PAUSE()
+#endif
+
+/*
+ * Number of ring checks between looks at the clock when busy-polling.
+ */
+#define BUSY_POLL_CHECKS	64
+
+/*
+ * Spin checking the ring for up to the busy-poll time; returns 1 if
+ * a frame showed up, 0 if it didn't or if pcap_breakloop() was
+ * called.
+ */
+static int
+pcap_busy_poll_mmap(pcap_t *handle)
+{
+	struct timespec start, now;
+	long elapsed;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		for (i = 0; i < BUSY_POLL_CHECKS; i++) {
+			if (pcap_get_ring_frame(handle, TP_STATUS_USER))
+				return 1;
+			if (handle->break_loop)
+				return 0;
+			BUSY_POLL_PAUSE();
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000000 +
+		    (now.tv_nsec - start.tv_nsec) / 1000;
+		if (elapsed >= handle->opt.busy_poll)
+			return 0;
+	}
+}
+
 /* wait for frames availability.*/
 static int pcap_wait_for_frames_mmap(pcap_t *handle)
 {
@@ -4119,6 +6526,22 @@ static int pcap_wait_for_frames_mmap(pcap_t *handle)
 		struct pollfd pollinfo;
 		int ret;
 
+		/*
+		 * In busy-poll mode, unless we're in non-blocking mode,
+		 * spin for a while before blocking.
+		 */
+		if (handle->opt.busy_poll > 0 && handlep->timeout >= 0) {
+			if (pcap_busy_poll_mmap(handle)) {
+				handlep->busy_poll_hits++;
+				return 0;
+			}
+			if (handle->break_loop) {
+				handle->break_loop = 0;
+				return PCAP_ERROR_BREAK;
+			}
+			handlep->busy_poll_sleeps++;
+		}
+
 		pollinfo.fd = handle->fd;
 		pollinfo.events = POLLIN;
 
@@ -4219,8 +6642,85 @@ static int pcap_wait_for_frames_mmap(pcap_t *handle)
 	return 0;
 }
 
+/*
+ * Optional steps in handling a packet from the ring.  The TPACKET_V2
+ * and TPACKET_V3 read routines come in one variant for each
+ * combination of these, chosen by pcap_set_read_op_mmap(), so that
+ * the per-packet code doesn't test for steps that the capture doesn't
+ * need.
+ */
+#define MMAP_COOKED	0x01	/* construct an SLL header */
+#define MMAP_VLAN	0x02	/* reinsert VLAN tags or report them as metadata */
+#define MMAP_FILTER	0x04	/* filter in userland */
+#define MMAP_DIRECTION	0x08	/* check the packet's direction */
+#define MMAP_ALL	(MMAP_COOKED|MMAP_VLAN|MMAP_FILTER|MMAP_DIRECTION)
+
+/*
+ * The variants are made by inlining common routines with a constant
+ * set of steps; make sure they really are inlined, so that the tests
+ * for steps that aren't in the set are compiled out.
+ */
+#ifdef __GNUC__
+#define MMAP_INLINE	inline __attribute__((always_inline))
+#else
+#define MMAP_INLINE	inline
+#endif
+
+/*
+ * Define pcap_read_linux_mmap_VERSION_FEATURES() for each set of
+ * features, and the pcap_read_linux_mmap_VERSION_ops[] table, indexed
+ * by the set of features, of those routines, given
+ * pcap_read_linux_mmap_VERSION_common().
+ */
+#define MMAP_READ_VARIANT(version, features) \
+static int \
+pcap_read_linux_mmap_##version##_##features(pcap_t *handle, int max_packets, \
+		pcap_handler callback, u_char *user) \
+{ \
+	return pcap_read_linux_mmap_##version##_common(handle, max_packets, \
+	    callback, user, features); \
+}
+
+#define MMAP_READ_VARIANTS(version) \
+MMAP_READ_VARIANT(version, 0) \
+MMAP_READ_VARIANT(version, 1) \
+MMAP_READ_VARIANT(version, 2) \
+MMAP_READ_VARIANT(version, 3) \
+MMAP_READ_VARIANT(version, 4) \
+MMAP_READ_VARIANT(version, 5) \
+MMAP_READ_VARIANT(version, 6) \
+MMAP_READ_VARIANT(version, 7) \
+MMAP_READ_VARIANT(version, 8) \
+MMAP_READ_VARIANT(version, 9) \
+MMAP_READ_VARIANT(version, 10) \
+MMAP_READ_VARIANT(version, 11) \
+MMAP_READ_VARIANT(version, 12) \
+MMAP_READ_VARIANT(version, 13) \
+MMAP_READ_VARIANT(version, 14) \
+MMAP_READ_VARIANT(version, 15) \
+\
+static int (*const pcap_read_linux_mmap_##version##_ops[MMAP_ALL + 1])(pcap_t *, \
+		int, pcap_handler, u_char *) = { \
+	pcap_read_linux_mmap_##version##_0, \
+	pcap_read_linux_mmap_##version##_1, \
+	pcap_read_linux_mmap_##version##_2, \
+	pcap_read_linux_mmap_##version##_3, \
+	pcap_read_linux_mmap_##version##_4, \
+	pcap_read_linux_mmap_##version##_5, \
+	pcap_read_linux_mmap_##version##_6, \
+	pcap_read_linux_mmap_##version##_7, \
+	pcap_read_linux_mmap_##version##_8, \
+	pcap_read_linux_mmap_##version##_9, \
+	pcap_read_linux_mmap_##version##_10, \
+	pcap_read_linux_mmap_##version##_11, \
+	pcap_read_linux_mmap_##version##_12, \
+	pcap_read_linux_mmap_##version##_13, \
+	pcap_read_linux_mmap_##version##_14, \
+	pcap_read_linux_mmap_##version##_15, \
+};
+
 /* handle a single memory mapped packet */
-static int pcap_handle_packet_mmap(
+static MMAP_INLINE int pcap_handle_packet_mmap(
 		pcap_t *handle,
 		pcap_handler callback,
 		u_char *user,
@@ -4231,7 +6731,12 @@ static int pcap_handle_packet_mmap(
 		unsigned int tp_sec,
 		unsigned int tp_usec,
 		int tp_vlan_tci_valid,
-		__u16 tp_vlan_tci)
+		__u16 tp_vlan_tci,
+		__u16 tp_vlan_tpid,
+		unsigned int tp_meta_flags,
+		__u32 tp_rxhash,
+		struct pcap_pkt_meta *meta,
+		const int features)
 {
 	struct pcap_linux *handlep = handle->priv;
 	unsigned char *bp;
@@ -4252,7 +6757,9 @@ static int pcap_handle_packet_mmap(
 	 * filter until all the frames present into the ring
 	 * at filter creation time are processed.
 	 * In this case, blocks_to_filter_in_userland is used
-	 * as a counter for the packet we need to filter.
+	 * as a counter for the packet we need to filter, or,
+	 * with TPACKET_V3, filter_seq_num is the sequence number
+	 * of the last block we need to filter.
 	 * Note: alternatively it could be possible to stop applying
 	 * the filter when the ring became empty, but it can possibly
 	 * happen a lot later... */
@@ -4260,7 +6767,7 @@ static int pcap_handle_packet_mmap(
 
 	/* if required build in place the sll header*/
 	sll = (void *)frame + TPACKET_ALIGN(handlep->tp_hdrlen);
-	if (handlep->cooked) {
+	if (features & MMAP_COOKED) {
 		struct sll_header *hdrp;
 
 		/*
@@ -4299,20 +6806,49 @@ static int pcap_handle_packet_mmap(
 		hdrp->sll_protocol = sll->sll_protocol;
 	}
 
-	if (handlep->filter_in_userland && handle->fcode.bf_insns) {
+	if ((features & MMAP_FILTER) && handle->fcode.bf_insns) {
 		struct bpf_aux_data aux_data;
 
 		aux_data.vlan_tag = tp_vlan_tci & 0x0fff;
 		aux_data.vlan_tag_present = tp_vlan_tci_valid;
 
-		if (bpf_filter_with_aux_data(handle->fcode.bf_insns, bp,
-		    tp_len, tp_snaplen, &aux_data) == 0)
+		if (pcap_run_filter(handle, bp, tp_len, tp_snaplen,
+		    &aux_data) == 0)
 			return 0;
 	}
 
-	if (!linux_check_direction(handle, sll))
+	if ((features & MMAP_DIRECTION) &&
+	    !linux_check_direction(handle, sll))
 		return 0;
 
+	/*
+	 * Save the packet's metadata for pcap_get_pkt_meta() and
+	 * pcap_dispatch_meta(); the VLAN tag, if any, is added below.
+	 */
+	meta->pm_flags = PCAP_META_IFINFO | tp_meta_flags;
+	meta->pm_ifindex = sll->sll_ifindex;
+	meta->pm_pkttype = sll->sll_pkttype;
+	meta->pm_protocol = ntohs(sll->sll_protocol);
+	meta->pm_rxhash = tp_rxhash;
+#ifdef PACKET_VNET_HDR
+	if (handlep->vnet_hdr_len != 0) {
+		struct virtio_net_hdr vnet;
+
+		/*
+		 * The kernel put the header just before the packet;
+		 * get it before we insert a VLAN tag over it.
+		 */
+		memcpy(&vnet, frame + tp_mac - sizeof(vnet), sizeof(vnet));
+		meta->pm_flags |= PCAP_META_VNET;
+		meta->pm_vnet_flags = vnet.flags;
+		meta->pm_gso_type = vnet.gso_type;
+		meta->pm_hdr_len = vnet.hdr_len;
+		meta->pm_gso_size = vnet.gso_size;
+		meta->pm_csum_start = vnet.csum_start;
+		meta->pm_csum_offset = vnet.csum_offset;
+	}
+#endif
+
 	/* get required packet info from ring header */
 	pcaphdr.ts.tv_sec = tp_sec;
 	pcaphdr.ts.tv_usec = tp_usec;
@@ -4320,36 +6856,57 @@ static int pcap_handle_packet_mmap(
 	pcaphdr.len = tp_len;
 
 	/* if required build in place the sll header*/
-	if (handlep->cooked) {
+	if (features & MMAP_COOKED) {
 		/* update packet len */
 		pcaphdr.caplen += SLL_HDR_LEN;
 		pcaphdr.len += SLL_HDR_LEN;
 	}
 
 #if defined(HAVE_TPACKET2) || defined(HAVE_TPACKET3)
-	if (tp_vlan_tci_valid &&
-		handlep->vlan_offset != -1 &&
-		tp_snaplen >= (unsigned int) handlep->vlan_offset)
-	{
-		struct vlan_tag *tag;
+	if ((features & MMAP_VLAN) && tp_vlan_tci_valid) {
+		meta->pm_flags |= PCAP_META_VLAN;
+		meta->pm_vlan_tci = tp_vlan_tci;
+		meta->pm_vlan_tpid = tp_vlan_tpid;
+
+		/*
+		 * Unless we were asked to hand the tag to the
+		 * application only as metadata, put it back into
+		 * the packet.
+		 */
+		if (!handle->opt.vlan_metadata &&
+		    tp_snaplen >= (unsigned int) handlep->vlan_offset) {
+			struct vlan_tag *tag;
 
-		bp -= VLAN_TAG_LEN;
-		memmove(bp, bp + VLAN_TAG_LEN, handlep->vlan_offset);
+			bp -= VLAN_TAG_LEN;
+			memmove(bp, bp + VLAN_TAG_LEN, handlep->vlan_offset);
+
+			tag = (struct vlan_tag *)(bp + handlep->vlan_offset);
+			tag->vlan_tpid = htons(ETH_P_8021Q);
+			tag->vlan_tci = htons(tp_vlan_tci);
 
-		tag = (struct vlan_tag *)(bp + handlep->vlan_offset);
-		tag->vlan_tpid = htons(ETH_P_8021Q);
-		tag->vlan_tci = htons(tp_vlan_tci);
+			pcaphdr.caplen += VLAN_TAG_LEN;
+			pcaphdr.len += VLAN_TAG_LEN;
 
-		pcaphdr.caplen += VLAN_TAG_LEN;
-		pcaphdr.len += VLAN_TAG_LEN;
+			/*
+			 * The offsets in the virtio-net header are
+			 * from the start of the packet without the tag.
+			 */
+			if (meta->pm_flags & PCAP_META_VNET) {
+				if (meta->pm_hdr_len != 0)
+					meta->pm_hdr_len += VLAN_TAG_LEN;
+				if (meta->pm_vnet_flags & PCAP_VNET_F_NEEDS_CSUM)
+					meta->pm_csum_start += VLAN_TAG_LEN;
+			}
+		}
 	}
 #endif
 
 	/*
 	 * The only way to tell the kernel to cut off the
 	 * packet at a snapshot length is with a filter program;
-	 * if there's no filter program, the kernel won't cut
-	 * the packet off.
+	 * if we're filtering in userland, the kernel won't cut
+	 * the packet off, and, even if it does, the cooked-mode
+	 * header and any VLAN tag we added make the packet longer.
 	 *
 	 * Trim the snapshot length to be no longer than the
 	 * specified snapshot length.
@@ -4368,9 +6925,14 @@ pcap_read_linux_mmap_v1(pcap_t *handle, int max_packets, pcap_handler callback,
 		u_char *user)
 {
 	struct pcap_linux *handlep = handle->priv;
+	int features = pcap_mmap_features(handle);
 	int pkts = 0;
 	int ret;
 
+	ret = pcap_check_held_frames_mmap(handle);
+	if (ret != 0)
+		return (ret < 0 ? ret : 0);
+
 	/* wait for frames availability.*/
 	ret = pcap_wait_for_frames_mmap(handle);
 	if (ret) {
@@ -4382,6 +6944,10 @@ pcap_read_linux_mmap_v1(pcap_t *handle, int max_packets, pcap_handler callback,
 	while ((pkts < max_packets) || PACKET_COUNT_IS_UNLIMITED(max_packets)) {
 		union thdr h;
 
+		/* don't wrap around onto frames we're holding */
+		if (pcap_held_count_mmap(handlep) >= handle->cc)
+			break;
+
 		h.raw = pcap_get_ring_frame(handle, TP_STATUS_USER);
 		if (!h.raw)
 			break;
@@ -4397,7 +6963,12 @@ pcap_read_linux_mmap_v1(pcap_t *handle, int max_packets, pcap_handler callback,
 				h.h1->tp_sec,
 				h.h1->tp_usec,
 				0,
-				0);
+				0,
+				0,
+				0,
+				0,
+				&handlep->pkt_meta,
+				features);
 		if (ret == 1) {
 			pkts++;
 			handlep->packets_read++;
@@ -4411,7 +6982,10 @@ pcap_read_linux_mmap_v1(pcap_t *handle, int max_packets, pcap_handler callback,
 		 * after having been filtered by the kernel, count
 		 * the one we've just processed.
 		 */
-		h.h1->tp_status = TP_STATUS_KERNEL;
+		if (handlep->hold_frames)
+			pcap_hold_frame_mmap(handle);
+		else
+			h.h1->tp_status = TP_STATUS_KERNEL;
 		if (handlep->blocks_to_filter_in_userland > 0) {
 			handlep->blocks_to_filter_in_userland--;
 			if (handlep->blocks_to_filter_in_userland == 0) {
@@ -4420,6 +6994,7 @@ pcap_read_linux_mmap_v1(pcap_t *handle, int max_packets, pcap_handler callback,
 				 * in userland.
 				 */
 				handlep->filter_in_userland = 0;
+				pcap_set_read_op_mmap(handle);
 			}
 		}
 
@@ -4437,14 +7012,18 @@ pcap_read_linux_mmap_v1(pcap_t *handle, int max_packets, pcap_handler callback,
 }
 
 #ifdef HAVE_TPACKET2
-static int
-pcap_read_linux_mmap_v2(pcap_t *handle, int max_packets, pcap_handler callback,
-		u_char *user)
+static MMAP_INLINE int
+pcap_read_linux_mmap_v2_common(pcap_t *handle, int max_packets,
+		pcap_handler callback, u_char *user, const int features)
 {
 	struct pcap_linux *handlep = handle->priv;
 	int pkts = 0;
 	int ret;
 
+	ret = pcap_check_held_frames_mmap(handle);
+	if (ret != 0)
+		return (ret < 0 ? ret : 0);
+
 	/* wait for frames availability.*/
 	ret = pcap_wait_for_frames_mmap(handle);
 	if (ret) {
@@ -4456,6 +7035,10 @@ pcap_read_linux_mmap_v2(pcap_t *handle, int max_packets, pcap_handler callback,
 	while ((pkts < max_packets) || PACKET_COUNT_IS_UNLIMITED(max_packets)) {
 		union thdr h;
 
+		/* don't wrap around onto frames we're holding */
+		if (pcap_held_count_mmap(handlep) >= handle->cc)
+			break;
+
 		h.raw = pcap_get_ring_frame(handle, TP_STATUS_USER);
 		if (!h.raw)
 			break;
@@ -4475,7 +7058,12 @@ pcap_read_linux_mmap_v2(pcap_t *handle, int max_packets, pcap_handler callback,
 #else
 				h.h2->tp_vlan_tci != 0,
 #endif
-				h.h2->tp_vlan_tci);
+				h.h2->tp_vlan_tci,
+				VLAN_TPID(h.h2, h.h2),
+				TS_META_FLAGS(h.h2->tp_status),
+				0,
+				&handlep->pkt_meta,
+				features);
 		if (ret == 1) {
 			pkts++;
 			handlep->packets_read++;
@@ -4489,7 +7077,10 @@ pcap_read_linux_mmap_v2(pcap_t *handle, int max_packets, pcap_handler callback,
 		 * after having been filtered by the kernel, count
 		 * the one we've just processed.
 		 */
-		h.h2->tp_status = TP_STATUS_KERNEL;
+		if (handlep->hold_frames)
+			pcap_hold_frame_mmap(handle);
+		else
+			h.h2->tp_status = TP_STATUS_KERNEL;
 		if (handlep->blocks_to_filter_in_userland > 0) {
 			handlep->blocks_to_filter_in_userland--;
 			if (handlep->blocks_to_filter_in_userland == 0) {
@@ -4498,27 +7089,95 @@ pcap_read_linux_mmap_v2(pcap_t *handle, int max_packets, pcap_handler callback,
 				 * in userland.
 				 */
 				handlep->filter_in_userland = 0;
+				pcap_set_read_op_mmap(handle);
 			}
 		}
 
-		/* next block */
-		if (++handle->offset >= handle->cc)
-			handle->offset = 0;
+		/* next block */
+		if (++handle->offset >= handle->cc)
+			handle->offset = 0;
+
+		/* check for break loop condition*/
+		if (handle->break_loop) {
+			handle->break_loop = 0;
+			return PCAP_ERROR_BREAK;
+		}
+	}
+	return pkts;
+}
+
+MMAP_READ_VARIANTS(v2)
+#endif /* HAVE_TPACKET2 */
+
+#ifdef HAVE_TPACKET3
+/*
+ * Update the statistics gathered from the ring for a block we're about
+ * to read, and note whether its first packet follows a loss.
+ */
+static inline void
+pcap_note_block_v3(pcap_t *handle, union thdr h)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct pcap_ring_stat *rs = &handlep->ring_stat;
+	union thdr next;
+	u_int occupancy;
+	int i, full;
+
+	rs->rs_blocks++;
 
-		/* check for break loop condition*/
-		if (handle->break_loop) {
-			handle->break_loop = 0;
-			return PCAP_ERROR_BREAK;
+	/*
+	 * The kernel marks each block it retires with TP_STATUS_LOSING
+	 * if it has dropped packets since the drop count was last read
+	 * by pcap_stats(), so the first such block is the first one to
+	 * follow the loss.  The flag stays set until a packet is handed
+	 * to the callback, even if that's from a later block, so a
+	 * packet dropped by the userland filter doesn't swallow it.
+	 */
+	if (h.h3->hdr.bh1.block_status & TP_STATUS_LOSING) {
+		rs->rs_losing_blocks++;
+		if (!handlep->ring_losing) {
+			rs->rs_loss_events++;
+			handlep->block_meta_flags = PCAP_META_LOSS;
+			handlep->ring_losing = 1;
 		}
+	} else
+		handlep->ring_losing = 0;
+
+	/*
+	 * The kernel fills blocks in order, so, if the block
+	 * rs_occupancy_max blocks past this one is waiting to be
+	 * read, so are the ones before it; count how many more past
+	 * it are.
+	 */
+	occupancy = rs->rs_occupancy_max;
+	while (occupancy < (u_int)handle->cc) {
+		i = (handle->offset + occupancy) % handle->cc;
+		next.raw = ((union thdr **)handle->buffer)[i];
+		if (next.h3->hdr.bh1.block_status == TP_STATUS_KERNEL)
+			break;
+		occupancy++;
+	}
+	rs->rs_occupancy_max = occupancy;
+
+	/*
+	 * We handed the block before this one back to the kernel, so,
+	 * unless we're holding it, if it's waiting to be read, the
+	 * kernel has filled every block in the ring, and is dropping
+	 * packets until we hand this one back.
+	 */
+	if (pcap_held_count_mmap(handlep) == 0 && handle->cc > 1) {
+		i = handle->offset == 0 ? handle->cc - 1 : handle->offset - 1;
+		next.raw = ((union thdr **)handle->buffer)[i];
+		full = next.h3->hdr.bh1.block_status != TP_STATUS_KERNEL;
+		if (full && !handlep->ring_full)
+			rs->rs_full++;
+		handlep->ring_full = full;
 	}
-	return pkts;
 }
-#endif /* HAVE_TPACKET2 */
 
-#ifdef HAVE_TPACKET3
-static int
-pcap_read_linux_mmap_v3(pcap_t *handle, int max_packets, pcap_handler callback,
-		u_char *user)
+static MMAP_INLINE int
+pcap_read_linux_mmap_v3_common(pcap_t *handle, int max_packets,
+		pcap_handler callback, u_char *user, const int features)
 {
 	struct pcap_linux *handlep = handle->priv;
 	union thdr h;
@@ -4526,6 +7185,10 @@ pcap_read_linux_mmap_v3(pcap_t *handle, int max_packets, pcap_handler callback,
 	int ret;
 
 again:
+	ret = pcap_check_held_frames_mmap(handle);
+	if (ret != 0)
+		return (ret < 0 ? ret : 0);
+
 	if (handlep->current_packet == NULL) {
 		/* wait for frames availability.*/
 		ret = pcap_wait_for_frames_mmap(handle);
@@ -4546,10 +7209,36 @@ again:
 	 * packets currently available in the ring */
 	while ((pkts < max_packets) || PACKET_COUNT_IS_UNLIMITED(max_packets)) {
 		if (handlep->current_packet == NULL) {
+			/* don't wrap around onto blocks we're holding */
+			if (pcap_held_count_mmap(handlep) >= handle->cc)
+				break;
+
 			h.raw = pcap_get_ring_frame(handle, TP_STATUS_USER);
 			if (!h.raw)
 				break;
 
+			if ((features & MMAP_FILTER) &&
+			    handlep->filter_seq_num != 0 &&
+			    h.h3->hdr.bh1.seq_num > handlep->filter_seq_num) {
+				/*
+				 * The kernel started this block, and so
+				 * every block after it, after the current
+				 * filter was attached, so no more packets
+				 * need to be filtered in userland; switch
+				 * to the read routine that doesn't.
+				 */
+				handlep->filter_seq_num = 0;
+				handlep->filter_in_userland = 0;
+				pcap_set_read_op_mmap(handle);
+				if (pkts != 0)
+					break;
+				return (handle->opt.resegment ?
+				    handlep->reseg_read_op :
+				    handle->read_op)(handle, max_packets,
+				    callback, user);
+			}
+
+			pcap_note_block_v3(handle, h);
 			handlep->current_packet = h.raw + h.h3->hdr.bh1.offset_to_first_pkt;
 			handlep->packets_left = h.h3->hdr.bh1.num_pkts;
 		}
@@ -4576,8 +7265,16 @@ again:
 #else
 					tp3_hdr->hv1.tp_vlan_tci != 0,
 #endif
-					tp3_hdr->hv1.tp_vlan_tci);
+					tp3_hdr->hv1.tp_vlan_tci,
+					VLAN_TPID(tp3_hdr, &tp3_hdr->hv1),
+					PCAP_META_RXHASH |
+					    TS_META_FLAGS(tp3_hdr->tp_status) |
+					    handlep->block_meta_flags,
+					tp3_hdr->hv1.tp_rxhash,
+					&handlep->pkt_meta,
+					features);
 			if (ret == 1) {
+				handlep->block_meta_flags = 0;
 				pkts++;
 				handlep->packets_read++;
 			} else if (ret < 0) {
@@ -4590,44 +7287,716 @@ again:
 
 		if (handlep->packets_left <= 0) {
 			/*
-			 * Hand this block back to the kernel, and, if
-			 * we're counting blocks that need to be
-			 * filtered in userland after having been
-			 * filtered by the kernel, count the one we've
-			 * just processed.
+			 * Hand this block back to the kernel.
 			 */
-			h.h3->hdr.bh1.block_status = TP_STATUS_KERNEL;
-			if (handlep->blocks_to_filter_in_userland > 0) {
-				handlep->blocks_to_filter_in_userland--;
-				if (handlep->blocks_to_filter_in_userland == 0) {
-					/*
-					 * No more blocks need to be filtered
-					 * in userland.
-					 */
-					handlep->filter_in_userland = 0;
-				}
+			if (handlep->hold_frames)
+				pcap_hold_frame_mmap(handle);
+			else
+				h.h3->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+			/* next block */
+			if (++handle->offset >= handle->cc)
+				handle->offset = 0;
+
+			handlep->current_packet = NULL;
+		}
+
+		/* check for break loop condition*/
+		if (handle->break_loop) {
+			handle->break_loop = 0;
+			return PCAP_ERROR_BREAK;
+		}
+	}
+	if (pkts == 0 && handlep->timeout == 0) {
+		/* Block until we see a packet. */
+		goto again;
+	}
+	return pkts;
+}
+
+MMAP_READ_VARIANTS(v3)
+
+/*
+ * Multi-consumer mode.
+ *
+ * Several threads may call pcap_dispatch() or pcap_loop() on the same
+ * handle at once; each call claims whole blocks from the ring, hands
+ * the packets in them to the callback, and hands each block back to
+ * the kernel as soon as it's done with it, independently of the other
+ * threads.  The position in the ring and the per-block claims are
+ * shared between the threads and updated with atomic operations; all
+ * other per-read state is local to the call.
+ */
+
+/*
+ * Claim the oldest block in the ring that the kernel has handed to us
+ * and that no other thread has claimed.  Returns the index of the
+ * block, or -1 if there is no such block.
+ */
+static int
+pcap_claim_block_mc(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	union thdr h;
+	int block;
+
+	for (;;) {
+		block = handlep->mc_next_block;
+
+		/*
+		 * Claim the block before checking whether it's ours to
+		 * read, so that no other thread can claim it between the
+		 * check and our advancing past it.
+		 */
+		if (!__sync_bool_compare_and_swap(&handlep->mc_claimed[block],
+		    0, 1)) {
+			/*
+			 * Another thread has claimed it.  If it hasn't
+			 * advanced past it yet, it's about to; otherwise
+			 * we've wrapped around onto a block that's still
+			 * being read, and there's nothing for us.
+			 */
+			if (handlep->mc_next_block == block)
+				return -1;
+			continue;
+		}
+		h.raw = ((union thdr **)handle->buffer)[block];
+		if (h.h3->hdr.bh1.block_status == TP_STATUS_KERNEL) {
+			__sync_lock_release(&handlep->mc_claimed[block]);
+			return -1;
+		}
+		if (__sync_bool_compare_and_swap(&handlep->mc_next_block,
+		    block, block + 1 < handle->cc ? block + 1 : 0))
+			return block;
+
+		/*
+		 * We were looking at a position in the ring that another
+		 * thread has since advanced past; try again.
+		 */
+		__sync_lock_release(&handlep->mc_claimed[block]);
+	}
+}
+
+/*
+ * Hand a claimed block back to the kernel, and drop our claim on it.
+ */
+static void
+pcap_release_block_mc(pcap_t *handle, int block)
+{
+	struct pcap_linux *handlep = handle->priv;
+	union thdr h;
+
+	h.raw = ((union thdr **)handle->buffer)[block];
+	__sync_synchronize();
+	h.h3->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	__sync_lock_release(&handlep->mc_claimed[block]);
+}
+
+/*
+ * Work out whether a block just claimed needs to be filtered in
+ * userland.
+ *
+ * Unlike pcap_read_linux_mmap_v3_common(), we don't stop filtering in
+ * userland once we see a block started after a kernel filter was
+ * attached, as another thread might not yet have looked at a block
+ * started before it; we just compare every block's sequence number.
+ */
+static int
+pcap_filter_block_mc(pcap_t *handle, union thdr h)
+{
+	struct pcap_linux *handlep = handle->priv;
+	__u64 filter_seq_num;
+
+	if (!handlep->filter_in_userland)
+		return 0;
+	filter_seq_num = handlep->filter_seq_num;
+	return filter_seq_num == 0 ||
+	    h.h3->hdr.bh1.seq_num <= filter_seq_num;
+}
+
+/*
+ * Update the statistics gathered from the ring for a block just
+ * claimed; see pcap_note_block_v3().  We don't track how full the ring
+ * is, as other threads may be reading the blocks past this one.
+ */
+static void
+pcap_note_block_mc(pcap_t *handle, union thdr h)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct pcap_ring_stat *rs = &handlep->ring_stat;
+
+	__sync_fetch_and_add(&rs->rs_blocks, 1);
+	if (h.h3->hdr.bh1.block_status & TP_STATUS_LOSING) {
+		__sync_fetch_and_add(&rs->rs_losing_blocks, 1);
+		if (!__sync_lock_test_and_set(&handlep->ring_losing, 1))
+			__sync_fetch_and_add(&rs->rs_loss_events, 1);
+	} else if (handlep->ring_losing)
+		__sync_lock_release(&handlep->ring_losing);
+}
+
+/*
+ * Wait for the kernel to hand us a block.  Returns 1 if it may have
+ * done so, 0 on a timeout, or a PCAP_ERROR_ value.
+ */
+static int
+pcap_wait_for_block_mc(pcap_t *handle, int *spurious)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct pollfd pollinfo;
+	int timeout;
+	int ret;
+
+	if (*spurious) {
+		/*
+		 * The kernel reports the socket as readable for as
+		 * long as the last block it filled hasn't been handed
+		 * back, which will be the case while another thread is
+		 * reading it; rather than spinning until it's done,
+		 * sleep for as long as we would poll for.
+		 */
+		(void)poll(NULL, 0, 1);
+	}
+	if (handlep->timeout < 0)
+		timeout = 0;	/* non-blocking mode */
+	else if (handlep->timeout > 0)
+		timeout = handlep->timeout;
+	else {
+		/*
+		 * Don't block for very long; see the comment in
+		 * pcap_wait_for_frames_mmap().
+		 */
+		timeout = 1;
+	}
+	pollinfo.fd = handle->fd;
+	pollinfo.events = POLLIN;
+	do {
+		ret = poll(&pollinfo, 1, timeout);
+		if (ret < 0 && errno != EINTR) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				"can't poll on packet socket: %s",
+				pcap_strerror(errno));
+			return PCAP_ERROR;
+		}
+		if (handle->break_loop)
+			return PCAP_ERROR_BREAK;
+	} while (ret < 0);
+	if (ret > 0 &&
+	    (pollinfo.revents & (POLLHUP|POLLRDHUP|POLLERR|POLLNVAL))) {
+		if (pollinfo.revents & (POLLHUP|POLLRDHUP))
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				"Hangup on packet socket");
+		else if (pollinfo.revents & POLLNVAL)
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				"Invalid polling request on packet socket");
+		else
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				"Error condition on packet socket");
+		return PCAP_ERROR;
+	}
+	*spurious = ret > 0;
+	return ret > 0 || handlep->timeout == 0;
+}
+
+static int
+pcap_read_linux_mmap_v3_mc(pcap_t *handle, int max_packets,
+		pcap_handler callback, u_char *user)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct pcap_pkt_meta meta;
+	struct tpacket3_hdr *tp3_hdr;
+	union thdr h;
+	unsigned char *frame;
+	int block, packets_left;
+	int features;
+	int spurious = 0;
+	int pkts = 0;
+	u_int read = 0;
+	int ret = 0;
+
+	/*
+	 * pcap_breakloop() stops every thread, so we don't clear
+	 * break_loop.
+	 */
+	while (!handle->break_loop &&
+	    (pkts < max_packets || PACKET_COUNT_IS_UNLIMITED(max_packets))) {
+		block = pcap_claim_block_mc(handle);
+		if (block == -1) {
+			if (pkts != 0)
+				break;
+			ret = pcap_wait_for_block_mc(handle, &spurious);
+			if (ret <= 0)
+				return ret;
+			continue;
+		}
+		spurious = 0;
+
+		h.raw = ((union thdr **)handle->buffer)[block];
+		pcap_note_block_mc(handle, h);
+		features = pcap_mmap_features(handle) & ~MMAP_FILTER;
+		if (pcap_filter_block_mc(handle, h))
+			features |= MMAP_FILTER;
+
+		/*
+		 * Read the whole block even if that's more than
+		 * max_packets; no other thread can pick up where we
+		 * stop.
+		 */
+		frame = h.raw + h.h3->hdr.bh1.offset_to_first_pkt;
+		for (packets_left = h.h3->hdr.bh1.num_pkts; packets_left > 0;
+		    packets_left--) {
+			tp3_hdr = (struct tpacket3_hdr *)frame;
+			ret = pcap_handle_packet_mmap(
+					handle,
+					callback,
+					user,
+					frame,
+					tp3_hdr->tp_len,
+					tp3_hdr->tp_mac,
+					tp3_hdr->tp_snaplen,
+					tp3_hdr->tp_sec,
+					handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO ? tp3_hdr->tp_nsec : tp3_hdr->tp_nsec / 1000,
+#if defined(TP_STATUS_VLAN_VALID)
+					(tp3_hdr->hv1.tp_vlan_tci || (tp3_hdr->tp_status & TP_STATUS_VLAN_VALID)),
+#else
+					tp3_hdr->hv1.tp_vlan_tci != 0,
+#endif
+					tp3_hdr->hv1.tp_vlan_tci,
+					VLAN_TPID(tp3_hdr, &tp3_hdr->hv1),
+					PCAP_META_RXHASH |
+					    TS_META_FLAGS(tp3_hdr->tp_status),
+					tp3_hdr->hv1.tp_rxhash,
+					&meta,
+					features);
+			if (ret < 0)
+				break;
+			if (ret == 1) {
+				pkts++;
+				read++;
 			}
+			frame += tp3_hdr->tp_next_offset;
+		}
+		pcap_release_block_mc(handle, block);
+		if (ret < 0)
+			break;
+	}
+	__sync_fetch_and_add(&handlep->packets_read, read);
+	if (ret < 0)
+		return ret;
+	if (handle->break_loop)
+		return PCAP_ERROR_BREAK;
+	return pkts;
+}
+#endif /* HAVE_TPACKET3 */
+
+/*
+ * Resegmentation.
+ *
+ * With segmentation offload, the packets a capture sees can be
+ * aggregates of several packets' worth of TCP or UDP payload, which
+ * the NIC or the kernel would split, or did merge, on the wire; the
+ * virtio-net header says how.  If asked to, we split those aggregates
+ * back into wire-sized segments, with the IP and TCP or UDP headers of
+ * each fixed up to look like what would have been on the wire, and
+ * hand those to the callback instead.
+ */
+#define RESEG_GET16(p)		((u_int)(p)[0] << 8 | (u_int)(p)[1])
+#define RESEG_GET32(p)		(RESEG_GET16(p) << 16 | RESEG_GET16((p) + 2))
+#define RESEG_PUT16(p, v)	((p)[0] = (u_char)((v) >> 8), \
+				 (p)[1] = (u_char)(v))
+#define RESEG_PUT32(p, v)	(RESEG_PUT16(p, (v) >> 16), \
+				 RESEG_PUT16((p) + 2, v))
+
+/*
+ * Add "len" bytes at "p" to a ones-complement sum.
+ */
+static uint32_t
+reseg_sum(uint32_t sum, const u_char *p, u_int len)
+{
+	while (len > 1) {
+		sum += RESEG_GET16(p);
+		p += 2;
+		len -= 2;
+	}
+	if (len != 0)
+		sum += (u_int)p[0] << 8;
+	return sum;
+}
+
+static u_int
+reseg_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return sum;
+}
+
+/*
+ * Split the aggregated packet "bytes", described by the metadata in
+ * handlep->pkt_meta, into segments in the arena.  Returns the number
+ * of segments, or 0 if the packet isn't one we can split, in which
+ * case it's handed to the callback as is.
+ *
+ * If the whole packet was captured, each segment gets a complete
+ * transport-layer checksum; otherwise, each gets the sum of its
+ * pseudo-header, as it would have been handed to a NIC doing checksum
+ * offload, and the segments' metadata says so.
+ */
+static int
+pcap_resegment(pcap_t *handle, const struct pcap_pkthdr *h,
+    const u_char *bytes)
+{
+	struct pcap_linux *handlep = handle->priv;
+	const struct pcap_pkt_meta *meta = &handlep->pkt_meta;
+	u_int caplen = h->caplen;
+	u_int l3off, l4off, hdrlen, csum_offset, mss, payload, nsegs;
+	u_int ethertype, proto, ipv6, captured, seglen, segcap, l4len;
+	u_int off, i, sum;
+	u_char *dst, *l3, *l4;
+
+	if (handle->linktype != DLT_EN10MB || caplen < 14)
+		return 0;
+
+	/*
+	 * Skip the MAC addresses and any VLAN tags.
+	 */
+	l3off = 12;
+	ethertype = RESEG_GET16(bytes + l3off);
+	while ((ethertype == ETH_P_8021Q || ethertype == ETH_P_8021AD) &&
+	    l3off + VLAN_TAG_LEN + 2 <= caplen) {
+		l3off += VLAN_TAG_LEN;
+		ethertype = RESEG_GET16(bytes + l3off);
+	}
+	l3off += 2;
+
+	switch (ethertype) {
+
+	case ETH_P_IP:
+		if (l3off + 20 > caplen || (bytes[l3off] >> 4) != 4 ||
+		    (bytes[l3off] & 0x0f) < 5)
+			return 0;
+		l4off = l3off + (bytes[l3off] & 0x0f) * 4;
+		proto = bytes[l3off + 9];
+		ipv6 = 0;
+		break;
+
+	case ETH_P_IPV6:
+		/*
+		 * The transport-layer header must directly follow
+		 * the IPv6 header.
+		 */
+		if (l3off + 40 > caplen)
+			return 0;
+		l4off = l3off + 40;
+		proto = bytes[l3off + 6];
+		ipv6 = 1;
+		break;
+
+	default:
+		return 0;
+	}
+
+	switch (meta->pm_gso_type & ~PCAP_GSO_ECN) {
+
+	case PCAP_GSO_TCPV4:
+	case PCAP_GSO_TCPV6:
+		if (proto != IPPROTO_TCP || l4off + 20 > caplen ||
+		    (bytes[l4off + 12] >> 4) < 5)
+			return 0;
+		hdrlen = l4off + (bytes[l4off + 12] >> 4) * 4;
+		csum_offset = 16;
+		break;
+
+	case PCAP_GSO_UDP_L4:
+		if (proto != IPPROTO_UDP)
+			return 0;
+		hdrlen = l4off + 8;
+		csum_offset = 6;
+		break;
+
+	default:
+		/*
+		 * That includes PCAP_GSO_UDP, which is split into IP
+		 * fragments, not segments.
+		 */
+		return 0;
+	}
+	mss = meta->pm_gso_size;
+	if (hdrlen > caplen || hdrlen > RESEG_MAX_HDR || mss == 0 ||
+	    h->len <= hdrlen)
+		return 0;
+	payload = h->len - hdrlen;
+	nsegs = (payload + mss - 1) / mss;
+	if (nsegs < 2 || nsegs > RESEG_MAX_SEGS)
+		return 0;
+	captured = caplen - hdrlen;
+
+	dst = handlep->reseg_arena;
+	for (i = 0, off = 0; i < nsegs; i++, off += mss) {
+		seglen = payload - off < mss ? payload - off : mss;
+		segcap = captured > off ? captured - off : 0;
+		if (segcap > seglen)
+			segcap = seglen;
+		l4len = hdrlen - l4off + seglen;
+
+		memcpy(dst, bytes, hdrlen);
+		memcpy(dst + hdrlen, bytes + hdrlen + off, segcap);
+		l3 = dst + l3off;
+		l4 = dst + l4off;
+
+		/*
+		 * Fix up the network-layer header, and start the
+		 * pseudo-header sum.
+		 */
+		if (ipv6) {
+			RESEG_PUT16(l3 + 4, l4len);
+			sum = reseg_sum(0, l3 + 8, 32);
+		} else {
+			RESEG_PUT16(l3 + 2, l4off - l3off + l4len);
+			RESEG_PUT16(l3 + 4, RESEG_GET16(l3 + 4) + i);
+			RESEG_PUT16(l3 + 10, 0);
+			RESEG_PUT16(l3 + 10,
+			    ~reseg_fold(reseg_sum(0, l3, l4off - l3off)));
+			sum = reseg_sum(0, l3 + 12, 8);
+		}
+		sum += proto + l4len;
+
+		/*
+		 * Fix up the transport-layer header.
+		 */
+		if (proto == IPPROTO_TCP) {
+			RESEG_PUT32(l4 + 4, RESEG_GET32(l4 + 4) + off);
+			if (i != 0)
+				l4[13] &= ~0x80;	/* CWR */
+			if (i != nsegs - 1)
+				l4[13] &= ~0x09;	/* FIN, PSH */
+		} else
+			RESEG_PUT16(l4 + 4, l4len);
+		if (caplen == h->len) {
+			RESEG_PUT16(l4 + csum_offset, 0);
+			sum = ~reseg_fold(reseg_sum(sum, l4, l4len)) & 0xffff;
+			if (sum == 0 && proto == IPPROTO_UDP)
+				sum = 0xffff;
+			RESEG_PUT16(l4 + csum_offset, sum);
+		} else
+			RESEG_PUT16(l4 + csum_offset, reseg_fold(sum));
+
+		handlep->reseg_segs[i].hdr.ts = h->ts;
+		handlep->reseg_segs[i].hdr.caplen = hdrlen + segcap;
+		handlep->reseg_segs[i].hdr.len = hdrlen + seglen;
+		handlep->reseg_segs[i].data = dst;
+		dst += hdrlen + segcap;
+	}
+
+	handlep->reseg_meta = *meta;
+	handlep->reseg_meta.pm_gso_type = PCAP_GSO_NONE;
+	handlep->reseg_meta.pm_gso_size = 0;
+	handlep->reseg_meta.pm_hdr_len = 0;
+	if (caplen == h->len) {
+		handlep->reseg_meta.pm_vnet_flags &= ~PCAP_VNET_F_NEEDS_CSUM;
+		handlep->reseg_meta.pm_vnet_flags |= PCAP_VNET_F_DATA_VALID;
+	} else {
+		handlep->reseg_meta.pm_vnet_flags |= PCAP_VNET_F_NEEDS_CSUM;
+		handlep->reseg_meta.pm_csum_start = l4off;
+		handlep->reseg_meta.pm_csum_offset = csum_offset;
+	}
+	return nsegs;
+}
+
+struct reseg_userdata {
+	pcap_t *handle;
+	pcap_handler callback;
+	u_char *user;
+	int budget;	/* packets we may still hand over; -1 if no limit */
+	int delivered;	/* packets handed over */
+};
+
+/*
+ * Hand the callback the segments we haven't yet handed it, as many as
+ * the budget allows.
+ */
+static void
+pcap_reseg_deliver(struct reseg_userdata *ru)
+{
+	pcap_t *handle = ru->handle;
+	struct pcap_linux *handlep = handle->priv;
+	struct reseg_seg *seg;
 
-			/* next block */
-			if (++handle->offset >= handle->cc)
-				handle->offset = 0;
+	while (handlep->reseg_next < handlep->reseg_count &&
+	    ru->budget != 0 && !handle->break_loop) {
+		seg = &handlep->reseg_segs[handlep->reseg_next++];
+		handlep->pkt_meta = handlep->reseg_meta;
+		ru->callback(ru->user, &seg->hdr, seg->data);
+		ru->delivered++;
+		if (ru->budget > 0)
+			ru->budget--;
+	}
+}
 
-			handlep->current_packet = NULL;
-		}
+static void
+pcap_reseg_callback(u_char *user, const struct pcap_pkthdr *h,
+    const u_char *bytes)
+{
+	struct reseg_userdata *ru = (struct reseg_userdata *)user;
+	pcap_t *handle = ru->handle;
+	struct pcap_linux *handlep = handle->priv;
+	int nsegs;
+
+	if ((handlep->pkt_meta.pm_flags & PCAP_META_VNET) &&
+	    handlep->pkt_meta.pm_gso_type != PCAP_GSO_NONE &&
+	    (nsegs = pcap_resegment(handle, h, bytes)) != 0) {
+		handlep->reseg_count = nsegs;
+		handlep->reseg_next = 0;
+		pcap_reseg_deliver(ru);
+	} else {
+		ru->callback(ru->user, h, bytes);
+		ru->delivered++;
+		if (ru->budget > 0)
+			ru->budget--;
+	}
+}
 
-		/* check for break loop condition*/
+/*
+ * Read packets with the routine pcap_set_read_op_mmap() picked,
+ * splitting aggregated ones on the way to the callback.
+ *
+ * One packet from the ring can turn into many, so, if there's a limit
+ * on how many we hand over, we read one at a time, and leave any
+ * segments over the limit for the next call; only the first read
+ * waits for packets to arrive.
+ */
+static int
+pcap_read_linux_resegment(pcap_t *handle, int max_packets,
+		pcap_handler callback, u_char *user)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct reseg_userdata ru;
+	int timeout = handlep->timeout;
+	int ret;
+
+	ru.handle = handle;
+	ru.callback = callback;
+	ru.user = user;
+	ru.budget = PACKET_COUNT_IS_UNLIMITED(max_packets) ? -1 : max_packets;
+	ru.delivered = 0;
+
+	if (handlep->reseg_next < handlep->reseg_count) {
+		pcap_reseg_deliver(&ru);
 		if (handle->break_loop) {
 			handle->break_loop = 0;
 			return PCAP_ERROR_BREAK;
 		}
+		if (ru.budget == 0)
+			return ru.delivered;
 	}
-	if (pkts == 0 && handlep->timeout == 0) {
-		/* Block until we see a packet. */
-		goto again;
+
+	if (ru.budget < 0) {
+		if (ru.delivered != 0 && timeout >= 0)
+			handlep->timeout = ~timeout;
+		ret = handlep->reseg_read_op(handle, max_packets,
+		    pcap_reseg_callback, (u_char *)&ru);
+	} else {
+		do {
+			if (ru.delivered != 0 && timeout >= 0)
+				handlep->timeout = ~timeout;
+			ret = handlep->reseg_read_op(handle, 1,
+			    pcap_reseg_callback, (u_char *)&ru);
+		} while (ret > 0 && ru.budget > 0);
 	}
-	return pkts;
+	handlep->timeout = timeout;
+	if (ret < 0)
+		return ret;
+	return ru.delivered;
 }
-#endif /* HAVE_TPACKET3 */
+
+/*
+ * Work out which optional steps in handling packets from the ring
+ * this capture needs.
+ */
+static int
+pcap_mmap_features(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	int features = 0;
+
+	if (handlep->cooked)
+		features |= MMAP_COOKED;
+	if (handlep->vlan_offset != -1 || handle->opt.vlan_metadata)
+		features |= MMAP_VLAN;
+	if (handlep->filter_in_userland && handle->fcode.bf_insns)
+		features |= MMAP_FILTER;
+	/*
+	 * If we're bound to a device other than the loopback device,
+	 * and want packets in both directions, every packet passes
+	 * linux_check_direction().
+	 */
+	if (handle->direction != PCAP_D_INOUT ||
+	    handlep->ifindex == -1 ||
+	    handlep->ifindex == handlep->lo_ifindex)
+		features |= MMAP_DIRECTION;
+	return features;
+}
+
+/*
+ * Use the read routine that does only the optional steps in handling
+ * packets from the ring that this capture needs.  This must be called
+ * whenever anything that affects the choice changes.
+ */
+static void
+pcap_set_read_op_mmap(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	int features = pcap_mmap_features(handle);
+	read_op_t read_op = NULL;
+
+	switch (handlep->tp_version) {
+	case TPACKET_V1:
+		read_op = pcap_read_linux_mmap_v1;
+		break;
+#ifdef HAVE_TPACKET2
+	case TPACKET_V2:
+		read_op = pcap_read_linux_mmap_v2_ops[features];
+		break;
+#endif
+#ifdef HAVE_TPACKET3
+	case TPACKET_V3:
+		if (handle->opt.multi_consumer)
+			read_op = pcap_read_linux_mmap_v3_mc;
+		else
+			read_op = pcap_read_linux_mmap_v3_ops[features];
+		break;
+#endif
+	}
+	if (handle->opt.resegment) {
+		/*
+		 * Packets go through the resegmenter on their way to
+		 * the callback.
+		 */
+		handlep->reseg_read_op = read_op;
+		handle->read_op = pcap_read_linux_resegment;
+	} else
+		handle->read_op = read_op;
+}
+
+#ifdef HAVE_TPACKET3
+/*
+ * Get the sequence number of the block the kernel most recently started
+ * filling.
+ */
+static __u64
+pcap_ring_last_seq_num(pcap_t *handle)
+{
+	union thdr h;
+	__u64 seq_num = 0;
+	int i;
+
+	for (i = 0; i < handle->cc; i++) {
+		h.raw = ((union thdr **)handle->buffer)[i];
+		if (h.h3->hdr.bh1.seq_num > seq_num)
+			seq_num = h.h3->hdr.bh1.seq_num;
+	}
+	return seq_num;
+}
+#endif
 
 static int
 pcap_setfilter_linux_mmap(pcap_t *handle, struct bpf_program *filter)
@@ -4647,18 +8016,48 @@ pcap_setfilter_linux_mmap(pcap_t *handle, struct bpf_program *filter)
 		return ret;
 
 	/*
-	 * If we're filtering in userland, there's nothing to do;
-	 * the new filter will be used for the next packet.
+	 * If we're filtering in userland, there's nothing else to
+	 * do; the new filter will be used for the next packet.
+	 * Stop counting down to the end of filtering in userland
+	 * for an earlier kernel filter, as we now have to filter
+	 * every packet in userland.
 	 */
-	if (handlep->filter_in_userland)
+	if (handlep->filter_in_userland) {
+		handlep->blocks_to_filter_in_userland = 0;
+		handlep->filter_seq_num = 0;
+		pcap_set_read_op_mmap(handle);
 		return ret;
+	}
 
 	/*
 	 * We're filtering in the kernel; the packets present in
 	 * all blocks currently in the ring were already filtered
 	 * by the old filter, and so will need to be filtered in
 	 * userland by the new filter.
-	 *
+	 */
+#ifdef HAVE_TPACKET3
+	if (handlep->tp_version == TPACKET_V3) {
+		/*
+		 * The kernel tags each block with a sequence number
+		 * when it starts filling it, so the blocks that might
+		 * hold such packets are the ones whose sequence
+		 * numbers are no greater than the largest one in the
+		 * ring; filter only those in userland, and stop as
+		 * soon as we see a later one.
+		 *
+		 * Allow for one more block, just in case we lost a
+		 * race with another thread of control that was adding
+		 * a packet that had run the old filter to a block that
+		 * it started after we looked, as described below.
+		 */
+		handlep->filter_seq_num = pcap_ring_last_seq_num(handle) + 1;
+		handlep->filter_in_userland = 1;
+		pcap_set_read_op_mmap(handle);
+		return ret;
+	}
+#endif
+
+	/*
 	 * Get an upper bound for the number of such blocks; first,
 	 * walk the ring backward and count the free blocks.
 	 */
@@ -4705,6 +8104,7 @@ pcap_setfilter_linux_mmap(pcap_t *handle, struct bpf_program *filter)
 	 */
 	handlep->blocks_to_filter_in_userland = handle->cc - n;
 	handlep->filter_in_userland = 1;
+	pcap_set_read_op_mmap(handle);
 	return ret;
 }
 
@@ -5712,8 +9112,397 @@ iface_get_offload(pcap_t *handle _U_)
 }
 #endif /* SIOCETHTOOL */
 
+/*
+ * Get the link speed of the interface, in megabits per second, or 0
+ * if we can't find it out.  That's used only as a hint, so errors
+ * aren't reported.
+ */
+#if defined(SIOCETHTOOL) && defined(ETHTOOL_GSET)
+static int
+iface_get_speed(pcap_t *handle)
+{
+	struct ifreq	ifr;
+	struct ethtool_cmd ecmd;
+	__u32		speed;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, handle->opt.source, sizeof(ifr.ifr_name));
+	memset(&ecmd, 0, sizeof(ecmd));
+	ecmd.cmd = ETHTOOL_GSET;
+	ifr.ifr_data = (caddr_t)&ecmd;
+	if (ioctl(handle->fd, SIOCETHTOOL, &ifr) == -1)
+		return 0;
+	speed = ethtool_cmd_speed(&ecmd);
+	if (speed == 0 || speed > INT_MAX)
+		return 0;	/* SPEED_UNKNOWN, or nonsense */
+	return speed;
+}
+#else /* defined(SIOCETHTOOL) && defined(ETHTOOL_GSET) */
+static int
+iface_get_speed(pcap_t *handle _U_)
+{
+	return 0;
+}
+#endif /* defined(SIOCETHTOOL) && defined(ETHTOOL_GSET) */
+
 #endif /* HAVE_PF_PACKET_SOCKETS */
 
+/* ===== NUMA and huge page support ================================== */
+
+/*
+ * Get the NUMA node to which the device is attached, or -1 if it's
+ * not attached to any particular node or we can't tell.
+ */
+static int
+iface_get_numa_node(const char *device)
+{
+	char	path[PATH_MAX];
+	FILE	*f;
+	int	node;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node",
+	    device);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	if (fscanf(f, "%d", &node) != 1)
+		node = -1;
+	fclose(f);
+	return node;
+}
+
+/*
+ * If we were asked to put our buffers on a particular NUMA node, make
+ * memory allocated for this thread, including memory the kernel
+ * allocates on its behalf, prefer that node, saving the old policy in
+ * *old.  Returns 0 on success and -1, with handle->errbuf set, on
+ * error.
+ */
+static int
+set_numa_policy(pcap_t *handle, struct numa_policy *old)
+{
+	struct pcap_linux *handlep = handle->priv;
+#ifdef HAVE_NUMA_SYSCALLS
+	unsigned long mask[NUMA_MASK_LONGS];
+#endif
+
+	old->set = 0;
+	if (handlep->numa_node < 0)
+		return 0;
+#ifdef HAVE_NUMA_SYSCALLS
+	if ((unsigned)handlep->numa_node >= 8 * sizeof(mask)) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "NUMA node %d is not valid", handlep->numa_node);
+		return -1;
+	}
+	if (syscall(__NR_get_mempolicy, &old->mode, old->mask,
+	    8 * sizeof(old->mask), NULL, 0) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "get_mempolicy: %s", pcap_strerror(errno));
+		return -1;
+	}
+	memset(mask, 0, sizeof(mask));
+	mask[handlep->numa_node / (8 * sizeof(mask[0]))] |=
+	    1UL << (handlep->numa_node % (8 * sizeof(mask[0])));
+	if (syscall(__NR_set_mempolicy, MPOL_PREFERRED, mask,
+	    8 * sizeof(mask)) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't allocate memory on NUMA node %d: %s",
+		    handlep->numa_node, pcap_strerror(errno));
+		return -1;
+	}
+	old->set = 1;
+	return 0;
+#else
+	strlcpy(handle->errbuf,
+	    "NUMA node selection isn't supported by this build",
+	    PCAP_ERRBUF_SIZE);
+	return -1;
+#endif
+}
+
+static void
+restore_numa_policy(pcap_t *handle _U_, struct numa_policy *old)
+{
+#ifdef HAVE_NUMA_SYSCALLS
+	if (old->set)
+		(void)syscall(__NR_set_mempolicy, old->mode, old->mask,
+		    8 * sizeof(old->mask));
+#endif
+	old->set = 0;
+}
+
+/*
+ * Get the NUMA node on which the page containing buf is, or -1 if we
+ * can't tell.
+ */
+static int
+get_buffer_numa_node(void *buf _U_)
+{
+#ifdef HAVE_NUMA_SYSCALLS
+	int node;
+
+	if (buf == NULL ||
+	    syscall(__NR_get_mempolicy, &node, NULL, 0, buf,
+	      MPOL_F_NODE|MPOL_F_ADDR) == -1)
+		return -1;
+	return node;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Restrict the calling thread to the CPUs of the given NUMA node, and
+ * make the memory allocated for it prefer that node.  Returns 0 on
+ * success and -1, with errbuf set, on error.
+ */
+static int
+bind_thread_to_numa_node(int node, char *errbuf)
+{
+#if defined(HAVE_NUMA_SYSCALLS) && defined(__NR_sched_setaffinity)
+	char	path[PATH_MAX];
+	FILE	*f;
+	unsigned long cpus[NUMA_MASK_LONGS], mask[NUMA_MASK_LONGS];
+	u_int	first, last, cpu;
+	int	c, ncpus;
+
+	if ((unsigned)node >= 8 * sizeof(mask)) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "NUMA node %d is not valid", node);
+		return -1;
+	}
+
+	/*
+	 * The node's CPUs are listed as comma-separated numbers and
+	 * ranges of numbers, such as "0-7,16-23".
+	 */
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+	    node);
+	f = fopen(path, "r");
+	if (f == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "can't get the CPUs of NUMA node %d: %s", node,
+		    pcap_strerror(errno));
+		return -1;
+	}
+	memset(cpus, 0, sizeof(cpus));
+	ncpus = 0;
+	while (fscanf(f, "%u", &first) == 1) {
+		last = first;
+		c = getc(f);
+		if (c == '-') {
+			if (fscanf(f, "%u", &last) != 1)
+				break;
+			c = getc(f);
+		}
+		for (cpu = first; cpu <= last && cpu < 8 * sizeof(cpus);
+		    cpu++) {
+			cpus[cpu / (8 * sizeof(cpus[0]))] |=
+			    1UL << (cpu % (8 * sizeof(cpus[0])));
+			ncpus++;
+		}
+		if (c != ',')
+			break;
+	}
+	fclose(f);
+	if (ncpus == 0) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "NUMA node %d has no CPUs", node);
+		return -1;
+	}
+	if (syscall(__NR_sched_setaffinity, 0, sizeof(cpus), cpus) == -1) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "can't run on the CPUs of NUMA node %d: %s", node,
+		    pcap_strerror(errno));
+		return -1;
+	}
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(mask[0]))] |=
+	    1UL << (node % (8 * sizeof(mask[0])));
+	if (syscall(__NR_set_mempolicy, MPOL_PREFERRED, mask,
+	    8 * sizeof(mask)) == -1) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "can't allocate memory on NUMA node %d: %s", node,
+		    pcap_strerror(errno));
+		return -1;
+	}
+	return 0;
+#else
+	snprintf(errbuf, PCAP_ERRBUF_SIZE,
+	    "Binding to NUMA node %d isn't supported by this build", node);
+	return -1;
+#endif
+}
+
+#ifdef HAVE_RECVMMSG
+/*
+ * Get the size of the system's default huge pages, or 0 if it doesn't
+ * have them.
+ */
+static size_t
+get_huge_page_size(void)
+{
+	char	line[128];
+	FILE	*f;
+	unsigned long kb;
+	size_t	size = 0;
+
+	f = fopen("/proc/meminfo", "r");
+	if (f == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+			size = kb * 1024;
+			break;
+		}
+	}
+	fclose(f);
+	return size;
+}
+
+/*
+ * Allocate a buffer of *len bytes for packets, on the NUMA node we
+ * were asked to use, if any.  If we were asked to use huge pages,
+ * try explicit huge pages, rounding *len up to a multiple of the huge
+ * page size and setting *huge if that works, and otherwise ask for
+ * transparent huge pages.
+ *
+ * Returns NULL, with handle->errbuf set, on error.
+ */
+static u_char *
+alloc_packet_buffer(pcap_t *handle, size_t *len, int *huge)
+{
+	struct pcap_linux *handlep = handle->priv;
+	u_char	*buf = MAP_FAILED, *aligned;
+	size_t	huge_page_size = 0, map_len;
+#ifdef HAVE_NUMA_SYSCALLS
+	unsigned long mask[NUMA_MASK_LONGS];
+#endif
+
+	*huge = 0;
+	if (handle->opt.hugepages) {
+		huge_page_size = get_huge_page_size();
+		if (huge_page_size != 0)
+			*len = (*len + huge_page_size - 1) &
+			    ~(huge_page_size - 1);
+	}
+#ifdef MAP_HUGETLB
+	if (huge_page_size != 0) {
+		buf = mmap(NULL, *len, PROT_READ|PROT_WRITE,
+		    MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (buf != MAP_FAILED)
+			*huge = 1;
+	}
+#endif
+	if (buf == MAP_FAILED) {
+		/*
+		 * Transparent huge pages are only used for the parts
+		 * of a mapping that are aligned on huge page
+		 * boundaries, so, if we want them, map an extra huge
+		 * page's worth and trim the mapping so that it's
+		 * aligned.
+		 */
+		map_len = *len + huge_page_size;
+		buf = mmap(NULL, map_len, PROT_READ|PROT_WRITE,
+		    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (buf == MAP_FAILED) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't allocate packet buffer: %s",
+			    pcap_strerror(errno));
+			return NULL;
+		}
+		if (huge_page_size != 0) {
+			aligned = buf + ((huge_page_size -
+			    ((unsigned long)buf & (huge_page_size - 1))) &
+			    (huge_page_size - 1));
+			if (aligned != buf)
+				munmap(buf, aligned - buf);
+			if (aligned + *len != buf + map_len)
+				munmap(aligned + *len,
+				    (buf + map_len) - (aligned + *len));
+			buf = aligned;
+#ifdef MADV_HUGEPAGE
+			/*
+			 * This fails if transparent huge pages aren't
+			 * available, in which case we just use ordinary
+			 * pages.
+			 */
+			(void)madvise(buf, *len, MADV_HUGEPAGE);
+#endif
+		}
+	}
+
+#ifdef HAVE_NUMA_SYSCALLS
+	/*
+	 * The pages are allocated when packets are first read into
+	 * them, so set the policy for the buffer itself.
+	 */
+	if (handlep->numa_node >= 0) {
+		if ((unsigned)handlep->numa_node >= 8 * sizeof(mask)) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "NUMA node %d is not valid", handlep->numa_node);
+			munmap(buf, *len);
+			return NULL;
+		}
+		memset(mask, 0, sizeof(mask));
+		mask[handlep->numa_node / (8 * sizeof(mask[0]))] |=
+		    1UL << (handlep->numa_node % (8 * sizeof(mask[0])));
+		if (syscall(__NR_mbind, buf, *len, MPOL_PREFERRED, mask,
+		    8 * sizeof(mask), 0) == -1) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't allocate memory on NUMA node %d: %s",
+			    handlep->numa_node, pcap_strerror(errno));
+			munmap(buf, *len);
+			return NULL;
+		}
+	}
+#else
+	if (handlep->numa_node >= 0) {
+		strlcpy(handle->errbuf,
+		    "NUMA node selection isn't supported by this build",
+		    PCAP_ERRBUF_SIZE);
+		munmap(buf, *len);
+		return NULL;
+	}
+#endif
+	return buf;
+}
+
+/*
+ * Get the number of bytes of the mapping containing buf that are in
+ * transparent huge pages.
+ */
+static u_long
+get_transparent_huge_size(void *buf)
+{
+	char	line[256];
+	FILE	*f;
+	unsigned long start, end, kb;
+	int	in_mapping = 0;
+	u_long	size = 0;
+
+	f = fopen("/proc/self/smaps", "r");
+	if (f == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			if (in_mapping)
+				break;
+			in_mapping = (start <= (unsigned long)buf &&
+			    (unsigned long)buf < end);
+		} else if (in_mapping &&
+		    sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+			size = kb * 1024;
+			break;
+		}
+	}
+	fclose(f);
+	return size;
+}
+#endif /* HAVE_RECVMMSG */
+
 /* ===== Functions to interface to the older kernels ================== */
 
 /*
@@ -6143,7 +9932,7 @@ fix_offset(struct bpf_insn *p)
 }
 
 static int
-set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode)
+set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode, int is_mmapped)
 {
 	int total_filter_on = 0;
 	int save_mode;
@@ -6180,8 +9969,16 @@ set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode)
 	 * get bogus packets if an error occurs, rather than having
 	 * the filtering done in userland even if it could have been
 	 * done in the kernel.
+	 *
+	 * With a memory-mapped ring, packets aren't queued up on the
+	 * socket, so there's nothing to drain, and the total filter
+	 * would just drop the packets that arrive while we change
+	 * filters; the kernel replaces the old filter with the new
+	 * one atomically, and our caller arranges to filter, in
+	 * userland, the packets already in the ring.
 	 */
-	if (setsockopt(handle->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+	if (!is_mmapped &&
+	    setsockopt(handle->fd, SOL_SOCKET, SO_ATTACH_FILTER,
 		       &total_fcode, sizeof(total_fcode)) == 0) {
 		char drain[1];
 
@@ -6269,6 +10066,21 @@ set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode)
 	return ret;
 }
 
+/*
+ * Attach a filter that accepts all packets, cut off at the snapshot
+ * length.
+ */
+static int
+set_kernel_snaplen_filter(pcap_t *handle)
+{
+	struct sock_filter	snaplen_insn
+	    = BPF_STMT(BPF_RET | BPF_K, handle->snapshot);
+	struct sock_fprog	snaplen_fcode = { 1, &snaplen_insn };
+
+	return setsockopt(handle->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+			  &snaplen_fcode, sizeof(snaplen_fcode));
+}
+
 static int
 reset_kernel_filter(pcap_t *handle)
 {
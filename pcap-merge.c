@@ -0,0 +1,713 @@
+/*
+ * Copyright (c) 2026 The Tcpdump Group
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Merge the packets from several capture handles, live or offline,
+ * into one stream in time stamp order.
+ *
+ * Packets are copied out of the members as they're read and kept in
+ * a heap ordered by time stamp.  The earliest packet in the heap is
+ * handed out when we know nothing earlier can still arrive - that is,
+ * when every member that hasn't reached the end of its file has a
+ * packet in the heap - or, as idle interfaces would otherwise hold
+ * everything up, when it's older than the reordering window.  A
+ * savefile can always supply its next packet immediately, so we only
+ * ever wait on the live members.
+ *
+ * This assumes that the time stamps from any one member are in order,
+ * and that those from live members are comparable with the time of
+ * day; packets that arrive more than the window late are handed out
+ * as soon as they're read, and so might be out of order.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap-int.h"
+
+#ifdef NEED_STRERROR_H
+#include "strerror.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/time.h>
+
+/*
+ * Most packets we read from a live member in one pass, so that a busy
+ * member doesn't keep us from looking at the others.
+ */
+#define MERGE_MAX_READS	64
+
+/*
+ * A packet copied out of a member.
+ */
+struct merge_pkt {
+	struct pcap_pkthdr hdr;
+	u_int seq;		/* order in which we read it, to break ties */
+	int member;		/* member it came from */
+	u_char *data;
+	u_int bufsize;		/* size of the buffer "data" points to */
+	struct merge_pkt *next;	/* next packet on the free list */
+};
+
+struct merge_member {
+	pcap_t *p;
+	int live;		/* not a savefile */
+	int eof;		/* savefile that has no more packets */
+	int buffered;		/* packets from this member in the heap */
+	int was_nonblock;	/* its mode before we made it non-blocking */
+};
+
+/*
+ * Private data for merging pcap_t's.
+ */
+struct pcap_merge {
+	struct merge_member *members;
+	int nmembers;
+	int nactive;		/* members that haven't reached EOF */
+	int empty_live;		/* live members with nothing in the heap */
+	int empty_offline;	/* active savefiles with nothing in the heap */
+	struct pollfd *pfds;	/* descriptors for the live members */
+	int npfds;
+
+	/*
+	 * The reordering window, in the units of the time stamps.
+	 */
+	long window_sec;
+	long window_frac;
+	long frac_per_sec;
+
+	struct merge_pkt **heap;
+	int nheap;
+	int maxheap;
+	struct merge_pkt *free;	/* packet buffers we can reuse */
+	struct merge_pkt *last;	/* packet most recently handed out */
+	u_int seq;
+	int alloc_failed;	/* merge_add() couldn't allocate memory */
+	int nonblock;
+};
+
+/*
+ * Argument for merge_add().
+ */
+struct merge_userdata {
+	pcap_t *p;
+	int member;
+};
+
+static int
+merge_before(const struct merge_pkt *a, const struct merge_pkt *b)
+{
+	if (a->hdr.ts.tv_sec != b->hdr.ts.tv_sec)
+		return (a->hdr.ts.tv_sec < b->hdr.ts.tv_sec);
+	if (a->hdr.ts.tv_usec != b->hdr.ts.tv_usec)
+		return (a->hdr.ts.tv_usec < b->hdr.ts.tv_usec);
+	return ((int)(a->seq - b->seq) < 0);
+}
+
+static void
+merge_heap_push(struct pcap_merge *pm, struct merge_pkt *pkt)
+{
+	struct merge_pkt **heap = pm->heap;
+	int i, parent;
+
+	i = pm->nheap++;
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!merge_before(pkt, heap[parent]))
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = pkt;
+}
+
+static struct merge_pkt *
+merge_heap_pop(struct pcap_merge *pm)
+{
+	struct merge_pkt **heap = pm->heap;
+	struct merge_pkt *top, *pkt;
+	int i, child;
+
+	top = heap[0];
+	pkt = heap[--pm->nheap];
+	i = 0;
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= pm->nheap)
+			break;
+		if (child + 1 < pm->nheap &&
+		    merge_before(heap[child + 1], heap[child]))
+			child++;
+		if (!merge_before(heap[child], pkt))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = pkt;
+	return (top);
+}
+
+/*
+ * Callback for reading from a member; copy the packet into the heap.
+ */
+static void
+merge_add(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
+{
+	struct merge_userdata *mu = (struct merge_userdata *)user;
+	struct pcap_merge *pm = mu->p->priv;
+	struct merge_member *m = &pm->members[mu->member];
+	struct merge_pkt *pkt, **heap;
+	u_char *data;
+	int maxheap;
+
+	if (pm->nheap == pm->maxheap) {
+		maxheap = pm->maxheap != 0 ? 2 * pm->maxheap : 256;
+		heap = realloc(pm->heap, maxheap * sizeof (*heap));
+		if (heap == NULL) {
+			pm->alloc_failed = 1;
+			return;
+		}
+		pm->heap = heap;
+		pm->maxheap = maxheap;
+	}
+	if (pm->free != NULL) {
+		pkt = pm->free;
+		pm->free = pkt->next;
+	} else {
+		pkt = malloc(sizeof (*pkt));
+		if (pkt == NULL) {
+			pm->alloc_failed = 1;
+			return;
+		}
+		pkt->data = NULL;
+		pkt->bufsize = 0;
+	}
+	if (h->caplen > pkt->bufsize) {
+		data = realloc(pkt->data, h->caplen);
+		if (data == NULL) {
+			pkt->next = pm->free;
+			pm->free = pkt;
+			pm->alloc_failed = 1;
+			return;
+		}
+		pkt->data = data;
+		pkt->bufsize = h->caplen;
+	}
+	pkt->hdr = *h;
+	memcpy(pkt->data, bytes, h->caplen);
+	pkt->seq = pm->seq++;
+	pkt->member = mu->member;
+	merge_heap_push(pm, pkt);
+
+	if (m->buffered++ == 0) {
+		if (m->live)
+			pm->empty_live--;
+		else
+			pm->empty_offline--;
+	}
+}
+
+/*
+ * Read what we can from a member without blocking: everything that's
+ * waiting, up to a limit, for a live member, and the next packet, if
+ * we don't already have it, for a savefile.  Returns 0 on success,
+ * PCAP_ERROR_BREAK if the loop on the member was broken out of, and
+ * PCAP_ERROR on an error.
+ */
+static int
+merge_read_member(pcap_t *p, int member)
+{
+	struct pcap_merge *pm = p->priv;
+	struct merge_member *m = &pm->members[member];
+	struct merge_userdata mu;
+	size_t len;
+	int n;
+
+	if (m->eof || (!m->live && m->buffered != 0))
+		return (0);
+	mu.p = p;
+	mu.member = member;
+	n = pcap_dispatch(m->p, m->live ? MERGE_MAX_READS : 1, merge_add,
+	    (u_char *)&mu);
+	if (n == PCAP_ERROR_BREAK)
+		return (PCAP_ERROR_BREAK);
+	if (n < 0) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "handle %d", member);
+		len = strlen(p->errbuf);
+		snprintf(p->errbuf + len, PCAP_ERRBUF_SIZE - len, ": %s",
+		    m->p->errbuf);
+		return (PCAP_ERROR);
+	}
+	if (pm->alloc_failed) {
+		pm->alloc_failed = 0;
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(ENOMEM));
+		return (PCAP_ERROR);
+	}
+	if (n == 0 && !m->live) {
+		/*
+		 * End of file.
+		 */
+		m->eof = 1;
+		pm->nactive--;
+		pm->empty_offline--;
+	}
+	return (0);
+}
+
+/*
+ * Get the time before which packets from live members can be handed
+ * out even if some members have nothing in the heap.
+ */
+static void
+merge_horizon(struct pcap_merge *pm, struct timeval *horizon)
+{
+	gettimeofday(horizon, NULL);
+	if (pm->frac_per_sec != 1000000)
+		horizon->tv_usec *= 1000;
+	horizon->tv_sec -= pm->window_sec;
+	horizon->tv_usec -= pm->window_frac;
+	if (horizon->tv_usec < 0) {
+		horizon->tv_usec += pm->frac_per_sec;
+		horizon->tv_sec--;
+	}
+}
+
+/*
+ * Can the packet at the top of the heap be handed out?
+ */
+static int
+merge_releasable(struct pcap_merge *pm, const struct timeval *horizon)
+{
+	const struct timeval *ts = &pm->heap[0]->hdr.ts;
+
+	if (pm->empty_offline != 0)
+		return (0);
+	if (pm->empty_live == 0)
+		return (1);
+	return (ts->tv_sec < horizon->tv_sec ||
+	    (ts->tv_sec == horizon->tv_sec &&
+	     ts->tv_usec <= horizon->tv_usec));
+}
+
+/*
+ * Milliseconds until the packet at the top of the heap can be handed
+ * out, rounded up.
+ */
+static int
+merge_wait_ms(struct pcap_merge *pm, const struct timeval *horizon)
+{
+	const struct timeval *ts = &pm->heap[0]->hdr.ts;
+	long frac_per_ms = pm->frac_per_sec / 1000;
+	long ms;
+
+	ms = (ts->tv_sec - horizon->tv_sec) * 1000 +
+	    (ts->tv_usec - horizon->tv_usec) / frac_per_ms + 1;
+	if (ms > 1000)
+		ms = 1000;	/* recheck at least once a second */
+	return ((int)ms);
+}
+
+static int
+pcap_read_merge(pcap_t *p, int max_packets, pcap_handler callback,
+    u_char *user)
+{
+	struct pcap_merge *pm = p->priv;
+	struct merge_pkt *pkt;
+	struct timeval horizon;
+	int i, n = 0, timeout, timed_release, ret;
+
+	for (;;) {
+		/*
+		 * Has "pcap_breakloop()" been called?
+		 */
+		if (p->break_loop) {
+			p->break_loop = 0;
+			return (PCAP_ERROR_BREAK);
+		}
+
+		for (i = 0; i < pm->nmembers; i++) {
+			ret = merge_read_member(p, i);
+			if (ret < 0)
+				return (ret);
+		}
+		if (pm->npfds != 0)
+			merge_horizon(pm, &horizon);
+
+		while (pm->nheap != 0 && merge_releasable(pm, &horizon)) {
+			pkt = merge_heap_pop(pm);
+			if (--pm->members[pkt->member].buffered == 0) {
+				if (pm->members[pkt->member].live)
+					pm->empty_live++;
+				else {
+					/*
+					 * We need this savefile's next
+					 * packet before we can tell which
+					 * packet comes next.
+					 */
+					pm->empty_offline++;
+					ret = merge_read_member(p,
+					    pkt->member);
+					if (ret == PCAP_ERROR_BREAK && n != 0) {
+						/*
+						 * Report the break once
+						 * we've counted the
+						 * packets handed out.
+						 */
+						p->break_loop = 1;
+						return (n);
+					}
+					if (ret < 0)
+						return (ret);
+				}
+			}
+
+			/*
+			 * The packet handed out last time has to stay
+			 * around until now, for pcap_next_ex().
+			 */
+			if (pm->last != NULL) {
+				pm->last->next = pm->free;
+				pm->free = pm->last;
+			}
+			pm->last = pkt;
+			(*callback)(user, &pkt->hdr, pkt->data);
+			if (++n >= max_packets &&
+			    !PACKET_COUNT_IS_UNLIMITED(max_packets))
+				return (n);
+			if (p->break_loop)
+				return (n);
+		}
+		if (n != 0)
+			return (n);
+
+		if (pm->nactive == 0 && pm->nheap == 0) {
+			/*
+			 * Every member is a savefile, and we've handed
+			 * out all their packets.
+			 */
+			return (PCAP_ERROR_BREAK);
+		}
+		if (pm->nonblock)
+			return (0);
+
+		/*
+		 * Wait for a live member to have packets, for the
+		 * packet at the top of the heap to age past the window,
+		 * or for the timeout to expire.
+		 */
+		timeout = p->opt.timeout > 0 ? p->opt.timeout : -1;
+		timed_release = 0;
+		if (pm->nheap != 0 && pm->npfds != 0) {
+			ret = merge_wait_ms(pm, &horizon);
+			if (timeout < 0 || ret < timeout) {
+				timeout = ret;
+				timed_release = 1;
+			}
+		}
+		ret = poll(pm->pfds, pm->npfds, timeout);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "poll: %s",
+			    pcap_strerror(errno));
+			return (PCAP_ERROR);
+		}
+		if (ret == 0 && !timed_release)
+			return (0);
+	}
+}
+
+static int
+pcap_inject_merge(pcap_t *p, const void *buf _U_, size_t size _U_)
+{
+	snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+	    "Packets can't be sent on a merged capture");
+	return (PCAP_ERROR);
+}
+
+static int
+pcap_setfilter_merge(pcap_t *p, struct bpf_program *fp)
+{
+	struct pcap_merge *pm = p->priv;
+	int i;
+
+	/*
+	 * Packets already in the heap were filtered with the old
+	 * filter; only packets read from now on see the new one.
+	 */
+	for (i = 0; i < pm->nmembers; i++) {
+		if (pcap_setfilter(pm->members[i].p, fp) == -1) {
+			strlcpy(p->errbuf, pm->members[i].p->errbuf,
+			    PCAP_ERRBUF_SIZE);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+static int
+pcap_setdirection_merge(pcap_t *p, pcap_direction_t d)
+{
+	struct pcap_merge *pm = p->priv;
+	int i;
+
+	for (i = 0; i < pm->nmembers; i++) {
+		if (pcap_setdirection(pm->members[i].p, d) == -1) {
+			strlcpy(p->errbuf, pm->members[i].p->errbuf,
+			    PCAP_ERRBUF_SIZE);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+static int
+pcap_getnonblock_merge(pcap_t *p, char *errbuf _U_)
+{
+	struct pcap_merge *pm = p->priv;
+
+	return (pm->nonblock);
+}
+
+static int
+pcap_setnonblock_merge(pcap_t *p, int nonblock, char *errbuf _U_)
+{
+	struct pcap_merge *pm = p->priv;
+
+	/*
+	 * The live members are always in non-blocking mode; this
+	 * only affects whether we wait for them.
+	 */
+	pm->nonblock = nonblock;
+	return (0);
+}
+
+/*
+ * The statistics are the sums of those of the live members; savefiles
+ * have no statistics.
+ */
+static int
+pcap_stats_merge(pcap_t *p, struct pcap_stat *ps)
+{
+	struct pcap_merge *pm = p->priv;
+	struct pcap_stat mps;
+	int i;
+
+	if (pm->npfds == 0) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Statistics aren't available from merged savefiles");
+		return (-1);
+	}
+	memset(ps, 0, sizeof (*ps));
+	for (i = 0; i < pm->nmembers; i++) {
+		if (!pm->members[i].live)
+			continue;
+		if (pcap_stats(pm->members[i].p, &mps) == -1) {
+			strlcpy(p->errbuf, pm->members[i].p->errbuf,
+			    PCAP_ERRBUF_SIZE);
+			return (-1);
+		}
+		ps->ps_recv += mps.ps_recv;
+		ps->ps_drop += mps.ps_drop;
+		ps->ps_ifdrop += mps.ps_ifdrop;
+	}
+	return (0);
+}
+
+static void
+merge_free_pkt(struct merge_pkt *pkt)
+{
+	free(pkt->data);
+	free(pkt);
+}
+
+static void
+pcap_cleanup_merge(pcap_t *p)
+{
+	struct pcap_merge *pm = p->priv;
+	struct merge_pkt *pkt;
+	int i;
+
+	for (i = 0; i < pm->nmembers; i++)
+		pcap_close(pm->members[i].p);
+	free(pm->members);
+	free(pm->pfds);
+	for (i = 0; i < pm->nheap; i++)
+		merge_free_pkt(pm->heap[i]);
+	free(pm->heap);
+	while ((pkt = pm->free) != NULL) {
+		pm->free = pkt->next;
+		merge_free_pkt(pkt);
+	}
+	if (pm->last != NULL)
+		merge_free_pkt(pm->last);
+	pcap_cleanup_live_common(p);
+}
+
+pcap_t *
+pcap_open_merge(pcap_t **handles, int count, u_int window_usec, char *errbuf)
+{
+	pcap_t *p;
+	struct pcap_merge *pm;
+	struct merge_member *m;
+	int i;
+
+	if (count < 1) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "At least one capture handle must be merged");
+		return (NULL);
+	}
+	for (i = 0; i < count; i++) {
+		if (!handles[i]->activated) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "%s: %s", handles[i]->opt.source,
+			    pcap_statustostr(PCAP_ERROR_NOT_ACTIVATED));
+			return (NULL);
+		}
+		if (handles[i]->linktype != handles[0]->linktype) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "Captures with different link-layer header types can't be merged");
+			return (NULL);
+		}
+		if (handles[i]->opt.tstamp_precision !=
+		    handles[0]->opt.tstamp_precision) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "Captures with different time stamp precisions can't be merged");
+			return (NULL);
+		}
+		if (handles[i]->rfile == NULL &&
+		    handles[i]->selectable_fd == -1) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "%s: can't be merged, as it has no selectable descriptor",
+			    handles[i]->opt.source);
+			return (NULL);
+		}
+	}
+
+	p = pcap_create_common("(merge)", errbuf, sizeof (struct pcap_merge));
+	if (p == NULL)
+		return (NULL);
+	pm = p->priv;
+
+	pm->members = calloc(count, sizeof (*pm->members));
+	pm->pfds = calloc(count, sizeof (*pm->pfds));
+	if (pm->members == NULL || pm->pfds == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		free(pm->members);
+		free(pm->pfds);
+		pcap_close(p);
+		return (NULL);
+	}
+	p->linktype = handles[0]->linktype;
+	p->snapshot = 0;
+	p->opt.timeout = 0;
+	p->opt.tstamp_precision = handles[0]->opt.tstamp_precision;
+	for (i = 0; i < count; i++) {
+		/*
+		 * Put the live members in non-blocking mode, so that
+		 * we can read what each of them has without waiting.
+		 */
+		if (handles[i]->rfile != NULL)
+			continue;
+		pm->members[i].was_nonblock = pcap_getnonblock(handles[i],
+		    errbuf);
+		if (pm->members[i].was_nonblock == -1 ||
+		    pcap_setnonblock(handles[i], 1, errbuf) == -1) {
+			/*
+			 * Put the ones we've already changed back the
+			 * way they were; errbuf has the error, so use
+			 * our own buffer for any others.
+			 */
+			while (--i >= 0) {
+				if (handles[i]->rfile == NULL)
+					(void)pcap_setnonblock(handles[i],
+					    pm->members[i].was_nonblock,
+					    p->errbuf);
+			}
+			free(pm->members);
+			free(pm->pfds);
+			pcap_close(p);
+			return (NULL);
+		}
+	}
+	for (i = 0; i < count; i++) {
+		m = &pm->members[i];
+		m->p = handles[i];
+		m->live = handles[i]->rfile == NULL;
+		if (m->live) {
+			pm->pfds[pm->npfds].fd = handles[i]->selectable_fd;
+			pm->pfds[pm->npfds].events = POLLIN;
+			pm->npfds++;
+			pm->empty_live++;
+
+			/*
+			 * Don't wait longer than any live member would.
+			 */
+			if (handles[i]->opt.timeout > 0 &&
+			    (p->opt.timeout == 0 ||
+			     handles[i]->opt.timeout < p->opt.timeout))
+				p->opt.timeout = handles[i]->opt.timeout;
+		} else
+			pm->empty_offline++;
+		if (handles[i]->snapshot > p->snapshot)
+			p->snapshot = handles[i]->snapshot;
+	}
+	pm->nmembers = count;
+	pm->nactive = count;
+
+	if (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) {
+		pm->frac_per_sec = 1000000000;
+		pm->window_frac = (window_usec % 1000000) * 1000;
+	} else {
+		pm->frac_per_sec = 1000000;
+		pm->window_frac = window_usec % 1000000;
+	}
+	pm->window_sec = window_usec / 1000000;
+
+	p->read_op = pcap_read_merge;
+	p->inject_op = pcap_inject_merge;
+	p->setfilter_op = pcap_setfilter_merge;
+	p->setdirection_op = pcap_setdirection_merge;
+	p->set_datalink_op = NULL;	/* the members can't change */
+	p->getnonblock_op = pcap_getnonblock_merge;
+	p->setnonblock_op = pcap_setnonblock_merge;
+	p->stats_op = pcap_stats_merge;
+	p->cleanup_op = pcap_cleanup_merge;
+
+	p->activated = 1;
+	return (p);
+}
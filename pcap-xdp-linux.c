@@ -0,0 +1,839 @@
+/*
+ * Copyright (c) 2026 The Tcpdump Group
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Capture on a single receive queue of a network interface with an
+ * AF_XDP socket.
+ *
+ * Devices are named "xdp:{interface}" or "xdp:{interface}:{queue}";
+ * the queue defaults to 0.  We load a small XDP program that redirects
+ * the packets arriving on that queue to our socket, and attach it to
+ * the interface, in native (driver) mode if the driver supports it
+ * and in generic (SKB) mode otherwise; the latter works with any
+ * interface, including veth pairs.  Packets arriving on other queues
+ * are passed to the networking stack as usual.
+ *
+ * NOTE: unlike a PF_PACKET socket, an AF_XDP socket doesn't see a copy
+ * of the packet - the packets we capture are *not* passed on to the
+ * networking stack, so this is only suitable for traffic that's meant
+ * to be captured rather than processed by the host.
+ *
+ * This requires a 5.9 or later kernel, for BPF links for XDP programs
+ * and for the full set of AF_XDP statistics.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap-int.h"
+
+#ifdef NEED_STRERROR_H
+#include "strerror.h"
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/types.h>
+#include <linux/if_link.h>
+#include <linux/if_packet.h>
+#include <linux/if_xdp.h>
+
+/*
+ * <linux/bpf.h> defines its own struct bpf_insn, for eBPF instructions,
+ * which clashes with ours; rename it out of the way.
+ */
+#define bpf_insn linux_bpf_insn
+#include <linux/bpf.h>
+#undef bpf_insn
+
+#include "pcap-xdp-linux.h"
+
+#define XDP_IFACE_PREFIX	"xdp:"
+
+/*
+ * Size of a UMEM frame, each of which holds one packet; it must be
+ * a power of 2, and no bigger than a page.
+ */
+#define XDP_FRAME_SIZE		4096
+
+/*
+ * Number of UMEM frames to use if no buffer size was specified, and
+ * the minimum number to use; the number must be a power of 2.
+ */
+#define XDP_DEFAULT_FRAME_NR	4096
+#define XDP_MIN_FRAME_NR	64
+
+#ifndef AF_XDP
+#define AF_XDP			44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP			283
+#endif
+
+/*
+ * Make sure we see the descriptors the kernel has produced before
+ * reading them, and that the kernel sees the descriptors we've
+ * produced before it sees the updated producer index.
+ */
+#ifdef __GNUC__
+#define XDP_RING_BARRIER()	__sync_synchronize()
+#else
+#define XDP_RING_BARRIER()
+#endif
+
+/*
+ * One of the rings shared with the kernel.
+ */
+struct xdp_ring {
+	void	*map;		/* mmap()ed region */
+	size_t	maplen;
+	__u32	*producer;
+	__u32	*consumer;
+	void	*descs;		/* descriptors */
+	__u32	mask;		/* number of descriptors - 1 */
+};
+
+/*
+ * Private data for capturing on AF_XDP sockets.
+ */
+struct pcap_xdp {
+	int	ifindex;
+	int	queue_id;
+	int	skb_mode;	/* XDP program is attached in generic mode */
+	int	map_fd;		/* XSKMAP through which packets reach us */
+	int	prog_fd;	/* XDP program redirecting packets to us */
+	int	link_fd;	/* attachment of that program to the interface */
+	int	promisc_fd;	/* PF_PACKET socket holding promiscuous mode */
+	u_char	*umem;		/* memory into which packets are received */
+	size_t	umem_len;
+	u_int	frame_nr;	/* number of frames in the UMEM */
+	struct xdp_ring rx;
+	struct xdp_ring fill;
+	struct xdp_ring comp;
+	int	timeout;	/* timeout specified to pcap_open_live; negative if non-blocking */
+	u_int	packets_read;	/* count of packets read */
+	u_char	*oneshot_buffer; /* buffer for copy of packet */
+};
+
+static int
+sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * Wait for packets to arrive on the rx ring.  Returns 1 if there
+ * are packets, 0 if there aren't any before the timeout expires or,
+ * in non-blocking mode, right now, or a PCAP_ERROR_ value on error.
+ */
+static int
+xdp_wait_for_packets(pcap_t *handle)
+{
+	struct pcap_xdp *handlep = handle->priv;
+	struct pollfd pollinfo;
+	int timeout;
+	int ret;
+
+	if (*(volatile __u32 *)handlep->rx.producer != *handlep->rx.consumer)
+		return 1;
+
+	if (handlep->timeout == 0)
+		timeout = -1;	/* block forever */
+	else if (handlep->timeout > 0)
+		timeout = handlep->timeout;	/* block for that amount of time */
+	else
+		timeout = 0;	/* non-blocking mode - poll to pick up errors */
+
+	pollinfo.fd = handle->fd;
+	pollinfo.events = POLLIN;
+	do {
+		ret = poll(&pollinfo, 1, timeout);
+		if (ret < 0 && errno != EINTR) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't poll on XDP socket: %s", pcap_strerror(errno));
+			return PCAP_ERROR;
+		}
+		if (ret > 0 && (pollinfo.revents & (POLLERR|POLLNVAL))) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "Error condition on XDP socket");
+			return PCAP_ERROR;
+		}
+		/* check for break loop condition on interrupted syscall*/
+		if (handle->break_loop) {
+			handle->break_loop = 0;
+			return PCAP_ERROR_BREAK;
+		}
+	} while (ret < 0);
+	return ret > 0;
+}
+
+static int
+xdp_read_linux(pcap_t *handle, int max_packets, pcap_handler callback, u_char *user)
+{
+	struct pcap_xdp *handlep = handle->priv;
+	struct xdp_desc *descs = handlep->rx.descs;
+	__u64 *fill = handlep->fill.descs;
+	struct pcap_pkthdr pcaphdr;
+	struct timeval ts;
+	__u32 cons, prod, fill_prod;
+	int pkts = 0;
+	int ret;
+
+	ret = xdp_wait_for_packets(handle);
+	if (ret <= 0)
+		return ret;
+
+	cons = *handlep->rx.consumer;
+	prod = *(volatile __u32 *)handlep->rx.producer;
+	XDP_RING_BARRIER();
+	fill_prod = *handlep->fill.producer;
+
+	/*
+	 * AF_XDP doesn't give us a time stamp for the packets, so
+	 * stamp the whole lot with the time we picked them up.
+	 */
+	gettimeofday(&ts, NULL);
+
+	/* non-positive values of max_packets are used to require all
+	 * packets currently available in the ring */
+	while (cons != prod &&
+	    ((pkts < max_packets) || PACKET_COUNT_IS_UNLIMITED(max_packets))) {
+		struct xdp_desc *desc = &descs[cons & handlep->rx.mask];
+		u_char *bp = handlep->umem + desc->addr;
+
+		pcaphdr.ts = ts;
+		pcaphdr.len = desc->len;
+		pcaphdr.caplen = desc->len;
+		if (pcaphdr.caplen > (bpf_u_int32)handle->snapshot)
+			pcaphdr.caplen = handle->snapshot;
+
+		if (handle->fcode.bf_insns == NULL ||
+		    pcap_run_filter(handle, bp, pcaphdr.len, pcaphdr.caplen,
+		    NULL)) {
+			callback(user, &pcaphdr, bp);
+			pkts++;
+			handlep->packets_read++;
+		}
+
+		/*
+		 * Hand the frame back to the kernel to be refilled;
+		 * the fill ring has room for every frame, so there's
+		 * always room for it.
+		 */
+		fill[fill_prod & handlep->fill.mask] =
+		    desc->addr & ~(__u64)(XDP_FRAME_SIZE - 1);
+		fill_prod++;
+		cons++;
+
+		/* check for break loop condition*/
+		if (handle->break_loop)
+			break;
+	}
+
+	XDP_RING_BARRIER();
+	*handlep->fill.producer = fill_prod;
+	*handlep->rx.consumer = cons;
+
+	if (handle->break_loop) {
+		handle->break_loop = 0;
+		return PCAP_ERROR_BREAK;
+	}
+	return pkts;
+}
+
+/*
+ * The frame a packet was received into is handed back to the kernel
+ * as soon as we've processed it, so pcap_next() and pcap_next_ex()
+ * need a copy of the packet.
+ */
+static void
+xdp_oneshot(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
+{
+	struct oneshot_userdata *sp = (struct oneshot_userdata *)user;
+	pcap_t *handle = sp->pd;
+	struct pcap_xdp *handlep = handle->priv;
+
+	*sp->hdr = *h;
+	memcpy(handlep->oneshot_buffer, bytes, h->caplen);
+	*sp->pkt = handlep->oneshot_buffer;
+}
+
+static int
+xdp_inject_linux(pcap_t *handle, const void *buf _U_, size_t size _U_)
+{
+	snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+	    "Sending packets isn't supported on XDP devices");
+	return (-1);
+}
+
+static int
+xdp_stats_linux(pcap_t *handle, struct pcap_stat *stats)
+{
+	struct pcap_xdp *handlep = handle->priv;
+	struct xdp_statistics xstats;
+	socklen_t len = sizeof(xstats);
+
+	memset(&xstats, 0, sizeof(xstats));
+	if (getsockopt(handle->fd, SOL_XDP, XDP_STATISTICS, &xstats,
+	    &len) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't get XDP statistics: %s", pcap_strerror(errno));
+		return -1;
+	}
+
+	/*
+	 * Packets dropped because the rx ring was full, or because
+	 * there was no free frame to put them in, are the ones we
+	 * were too slow to pick up.
+	 */
+	stats->ps_recv = handlep->packets_read;
+	stats->ps_drop = (u_int)(xstats.rx_dropped + xstats.rx_ring_full);
+	stats->ps_ifdrop = 0;
+	return 0;
+}
+
+static int
+xdp_getnonblock(pcap_t *handle, char *errbuf _U_)
+{
+	struct pcap_xdp *handlep = handle->priv;
+
+	/* use negative value of timeout to indicate non blocking ops */
+	return (handlep->timeout < 0);
+}
+
+static int
+xdp_setnonblock(pcap_t *handle, int nonblock, char *errbuf _U_)
+{
+	struct pcap_xdp *handlep = handle->priv;
+
+	/*
+	 * Map each value to their corresponding negation to
+	 * preserve the timeout value provided with pcap_set_timeout.
+	 */
+	if (nonblock) {
+		if (handlep->timeout >= 0)
+			handlep->timeout = ~handlep->timeout;
+	} else {
+		if (handlep->timeout < 0)
+			handlep->timeout = ~handlep->timeout;
+	}
+	return 0;
+}
+
+static void
+xdp_unmap_ring(struct xdp_ring *ring)
+{
+	if (ring->map != NULL) {
+		(void)munmap(ring->map, ring->maplen);
+		ring->map = NULL;
+	}
+}
+
+static void
+xdp_cleanup_linux(pcap_t *handle)
+{
+	struct pcap_xdp *handlep = handle->priv;
+
+	/*
+	 * Closing the link detaches the XDP program from the
+	 * interface, so do that first, to stop packets from
+	 * being redirected to a socket that's going away.
+	 */
+	if (handlep->link_fd != -1) {
+		close(handlep->link_fd);
+		handlep->link_fd = -1;
+	}
+	if (handlep->prog_fd != -1) {
+		close(handlep->prog_fd);
+		handlep->prog_fd = -1;
+	}
+	if (handlep->map_fd != -1) {
+		close(handlep->map_fd);
+		handlep->map_fd = -1;
+	}
+	if (handlep->promisc_fd != -1) {
+		close(handlep->promisc_fd);
+		handlep->promisc_fd = -1;
+	}
+	xdp_unmap_ring(&handlep->rx);
+	xdp_unmap_ring(&handlep->fill);
+	xdp_unmap_ring(&handlep->comp);
+	if (handlep->umem != NULL) {
+		(void)munmap(handlep->umem, handlep->umem_len);
+		handlep->umem = NULL;
+	}
+	if (handlep->oneshot_buffer != NULL) {
+		free(handlep->oneshot_buffer);
+		handlep->oneshot_buffer = NULL;
+	}
+	pcap_cleanup_live_common(handle);
+}
+
+/*
+ * Map one of the rings of the socket, given the ring's offsets, its
+ * number of descriptors, the size of a descriptor, and the page offset
+ * that selects it.
+ */
+static int
+xdp_map_ring(pcap_t *handle, struct xdp_ring *ring,
+    const struct xdp_ring_offset *off, u_int nr, size_t desc_size,
+    off_t pgoff)
+{
+	u_char *map;
+
+	ring->maplen = off->desc + nr * desc_size;
+	map = mmap(NULL, ring->maplen, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, handle->fd, pgoff);
+	if (map == MAP_FAILED) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't mmap XDP ring: %s", pcap_strerror(errno));
+		return -1;
+	}
+	ring->map = map;
+	ring->producer = (__u32 *)(map + off->producer);
+	ring->consumer = (__u32 *)(map + off->consumer);
+	ring->descs = map + off->desc;
+	ring->mask = nr - 1;
+	return 0;
+}
+
+/*
+ * Register the UMEM with the socket, and create and map its fill and
+ * completion rings and the socket's rx ring.
+ */
+static int
+xdp_setup_rings(pcap_t *handle)
+{
+	struct pcap_xdp *handlep = handle->priv;
+	struct xdp_umem_reg mr;
+	struct xdp_mmap_offsets off;
+	socklen_t len;
+	u_int nr;
+
+	/*
+	 * Use as many frames as fit in the buffer size, rounded
+	 * down to a power of 2, as that's what the rings need.
+	 */
+	if (handle->opt.buffer_size != 0) {
+		nr = XDP_MIN_FRAME_NR;
+		while (nr * 2 <= handle->opt.buffer_size / XDP_FRAME_SIZE)
+			nr *= 2;
+	} else
+		nr = XDP_DEFAULT_FRAME_NR;
+	handlep->frame_nr = nr;
+
+	handlep->umem_len = (size_t)nr * XDP_FRAME_SIZE;
+	handlep->umem = mmap(NULL, handlep->umem_len, PROT_READ|PROT_WRITE,
+	    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (handlep->umem == MAP_FAILED) {
+		handlep->umem = NULL;
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't allocate XDP packet buffer: %s",
+		    pcap_strerror(errno));
+		return -1;
+	}
+
+	memset(&mr, 0, sizeof(mr));
+	mr.addr = (__u64)(unsigned long)handlep->umem;
+	mr.len = handlep->umem_len;
+	mr.chunk_size = XDP_FRAME_SIZE;
+	mr.headroom = 0;
+	if (setsockopt(handle->fd, SOL_XDP, XDP_UMEM_REG, &mr,
+	    sizeof(mr)) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't register XDP packet buffer: %s",
+		    pcap_strerror(errno));
+		return -1;
+	}
+
+	/*
+	 * Every frame is either in the fill ring, waiting for a
+	 * packet, or in the rx ring, waiting for us, so both rings
+	 * need room for all of them.  We never send, so the
+	 * completion ring, which the kernel insists on, can be as
+	 * small as it likes.
+	 */
+	if (setsockopt(handle->fd, SOL_XDP, XDP_UMEM_FILL_RING, &nr,
+	    sizeof(nr)) == -1 ||
+	    setsockopt(handle->fd, SOL_XDP, XDP_RX_RING, &nr,
+	    sizeof(nr)) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't create XDP ring: %s", pcap_strerror(errno));
+		return -1;
+	}
+	nr = XDP_MIN_FRAME_NR;
+	if (setsockopt(handle->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &nr,
+	    sizeof(nr)) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't create XDP ring: %s", pcap_strerror(errno));
+		return -1;
+	}
+
+	len = sizeof(off);
+	if (getsockopt(handle->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off,
+	    &len) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't get XDP ring offsets: %s", pcap_strerror(errno));
+		return -1;
+	}
+
+	if (xdp_map_ring(handle, &handlep->fill, &off.fr, handlep->frame_nr,
+	    sizeof(__u64), XDP_UMEM_PGOFF_FILL_RING) == -1)
+		return -1;
+	if (xdp_map_ring(handle, &handlep->comp, &off.cr, XDP_MIN_FRAME_NR,
+	    sizeof(__u64), XDP_UMEM_PGOFF_COMPLETION_RING) == -1)
+		return -1;
+	if (xdp_map_ring(handle, &handlep->rx, &off.rx, handlep->frame_nr,
+	    sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) == -1)
+		return -1;
+	return 0;
+}
+
+/*
+ * Create the XSKMAP, load an XDP program that redirects packets
+ * arriving on our queue through it, and attach that program to the
+ * interface, in native mode if we can and in generic mode if not.
+ */
+static int
+xdp_setup_program(pcap_t *handle)
+{
+	struct pcap_xdp *handlep = handle->priv;
+	union bpf_attr attr;
+	struct linux_bpf_insn prog[6];
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(int);
+	attr.value_size = sizeof(int);
+	attr.max_entries = handlep->queue_id + 1;
+	handlep->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (handlep->map_fd == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't create XSKMAP: %s", pcap_strerror(errno));
+		return -1;
+	}
+
+	/*
+	 * return bpf_redirect_map(&xskmap, ctx->rx_queue_index, XDP_PASS);
+	 *
+	 * The XDP_PASS passes on packets for queues with no socket
+	 * in the map, i.e. queues other than ours.
+	 */
+	memset(prog, 0, sizeof(prog));
+	prog[0].code = BPF_LDX|BPF_MEM|BPF_W;
+	prog[0].dst_reg = BPF_REG_2;
+	prog[0].src_reg = BPF_REG_1;
+	prog[0].off = offsetof(struct xdp_md, rx_queue_index);
+	prog[1].code = BPF_LD|BPF_IMM|BPF_DW;
+	prog[1].dst_reg = BPF_REG_1;
+	prog[1].src_reg = BPF_PSEUDO_MAP_FD;
+	prog[1].imm = handlep->map_fd;
+	/* prog[2] is the second half of the 64-bit load */
+	prog[3].code = BPF_ALU64|BPF_MOV|BPF_K;
+	prog[3].dst_reg = BPF_REG_3;
+	prog[3].imm = XDP_PASS;
+	prog[4].code = BPF_JMP|BPF_CALL;
+	prog[4].imm = BPF_FUNC_redirect_map;
+	prog[5].code = BPF_JMP|BPF_EXIT;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.expected_attach_type = BPF_XDP;
+	attr.insns = (__u64)(unsigned long)prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (__u64)(unsigned long)"Dual BSD/GPL";
+	handlep->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (handlep->prog_fd == -1) {
+		if (errno == EPERM) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't load XDP program: %s (CAP_BPF and CAP_NET_ADMIN are required)",
+			    pcap_strerror(errno));
+		} else {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't load XDP program: %s", pcap_strerror(errno));
+		}
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = handlep->prog_fd;
+	attr.link_create.target_ifindex = handlep->ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+	handlep->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+	if (handlep->link_fd == -1 && errno != EBUSY && errno != EEXIST) {
+		/*
+		 * The driver doesn't do XDP; fall back on the
+		 * generic implementation.
+		 */
+		attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+		handlep->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+		handlep->skb_mode = 1;
+	}
+	if (handlep->link_fd == -1) {
+		if (errno == EBUSY || errno == EEXIST) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't attach XDP program to %s: another XDP program is already attached",
+			    handle->opt.source);
+		} else {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't attach XDP program to %s: %s",
+			    handle->opt.source, pcap_strerror(errno));
+		}
+		return -1;
+	}
+	return 0;
+}
+
+static int
+xdp_activate(pcap_t *handle)
+{
+	struct pcap_xdp *handlep = handle->priv;
+	const char *dev = handle->opt.source + sizeof XDP_IFACE_PREFIX - 1;
+	char ifname[IFNAMSIZ];
+	const char *cp;
+	char *end;
+	size_t len;
+	struct sockaddr_xdp sxdp;
+	struct packet_mreq mr;
+	__u64 *fill;
+	int key, ret;
+	u_int i;
+
+	handlep->map_fd = -1;
+	handlep->prog_fd = -1;
+	handlep->link_fd = -1;
+	handlep->promisc_fd = -1;
+
+	if (handle->opt.rfmon) {
+		/*
+		 * Monitor mode doesn't apply to XDP devices.
+		 */
+		return PCAP_ERROR_RFMON_NOTSUP;
+	}
+
+	/* Parse "{interface}[:{queue}]". */
+	cp = strrchr(dev, ':');
+	if (cp != NULL) {
+		len = cp - dev;
+		handlep->queue_id = strtol(cp + 1, &end, 10);
+		if (cp[1] == '\0' || *end != '\0' || handlep->queue_id < 0) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "Invalid XDP queue number in %s", handle->opt.source);
+			return PCAP_ERROR;
+		}
+	} else {
+		len = strlen(dev);
+		handlep->queue_id = 0;
+	}
+	if (len == 0 || len >= sizeof(ifname)) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "Invalid XDP device name %s", handle->opt.source);
+		return PCAP_ERROR;
+	}
+	memcpy(ifname, dev, len);
+	ifname[len] = '\0';
+	handlep->ifindex = if_nametoindex(ifname);
+	if (handlep->ifindex == 0) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: %s", ifname, pcap_strerror(errno));
+		return PCAP_ERROR_NO_SUCH_DEVICE;
+	}
+
+	/*
+	 * A packet has to fit in a frame, so we can't capture more
+	 * than that.
+	 */
+	if (handle->snapshot <= 0 || handle->snapshot > XDP_FRAME_SIZE)
+		handle->snapshot = XDP_FRAME_SIZE;
+
+	/* Initialize some components of the pcap structure. */
+	handle->linktype = DLT_EN10MB;
+	handle->offset = 0;
+	handle->read_op = xdp_read_linux;
+	handle->inject_op = xdp_inject_linux;
+	handle->setfilter_op = install_bpf_program; /* no kernel filtering */
+	handle->setdirection_op = NULL;
+	handle->set_datalink_op = NULL;
+	handle->getnonblock_op = xdp_getnonblock;
+	handle->setnonblock_op = xdp_setnonblock;
+	handle->stats_op = xdp_stats_linux;
+	handle->cleanup_op = xdp_cleanup_linux;
+	handle->oneshot_callback = xdp_oneshot;
+	handlep->timeout = handle->opt.timeout;
+
+	handlep->oneshot_buffer = malloc(handle->snapshot);
+	if (handlep->oneshot_buffer == NULL) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't allocate oneshot buffer: %s", pcap_strerror(errno));
+		goto fail;
+	}
+
+	handle->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (handle->fd == -1) {
+		if (errno == EAFNOSUPPORT) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "AF_XDP sockets aren't supported by this kernel");
+		} else {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "socket: %s", pcap_strerror(errno));
+		}
+		if (errno == EPERM || errno == EACCES) {
+			xdp_cleanup_linux(handle);
+			return PCAP_ERROR_PERM_DENIED;
+		}
+		goto fail;
+	}
+
+	if (xdp_setup_rings(handle) == -1)
+		goto fail;
+	if (xdp_setup_program(handle) == -1)
+		goto fail;
+
+	/*
+	 * Bind to the queue; try zero-copy mode if the driver does
+	 * XDP, and copy mode if that doesn't work.
+	 */
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = handlep->ifindex;
+	sxdp.sxdp_queue_id = handlep->queue_id;
+	sxdp.sxdp_flags = handlep->skb_mode ? XDP_COPY : XDP_ZEROCOPY;
+	ret = bind(handle->fd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+	if (ret == -1 && sxdp.sxdp_flags == XDP_ZEROCOPY) {
+		sxdp.sxdp_flags = XDP_COPY;
+		ret = bind(handle->fd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+	}
+	if (ret == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't bind XDP socket to queue %d of %s: %s",
+		    handlep->queue_id, ifname, pcap_strerror(errno));
+		goto fail;
+	}
+
+	/* Give all the frames to the kernel to receive packets into. */
+	fill = handlep->fill.descs;
+	for (i = 0; i < handlep->frame_nr; i++)
+		fill[i] = (__u64)i * XDP_FRAME_SIZE;
+	XDP_RING_BARRIER();
+	*handlep->fill.producer = handlep->frame_nr;
+
+	/* Now have the XDP program send the queue's packets to us. */
+	key = handlep->queue_id;
+	{
+		union bpf_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = handlep->map_fd;
+		attr.key = (__u64)(unsigned long)&key;
+		attr.value = (__u64)(unsigned long)&handle->fd;
+		if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't add XDP socket to XSKMAP: %s",
+			    pcap_strerror(errno));
+			goto fail;
+		}
+	}
+
+	if (handle->opt.promisc) {
+		/*
+		 * An unbound PF_PACKET socket with a protocol of 0
+		 * doesn't receive any packets, but can hold the
+		 * interface in promiscuous mode for as long as it's
+		 * open.
+		 */
+		handlep->promisc_fd = socket(PF_PACKET, SOCK_RAW, 0);
+		if (handlep->promisc_fd == -1) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "socket: %s", pcap_strerror(errno));
+			goto fail;
+		}
+		memset(&mr, 0, sizeof(mr));
+		mr.mr_ifindex = handlep->ifindex;
+		mr.mr_type = PACKET_MR_PROMISC;
+		if (setsockopt(handlep->promisc_fd, SOL_PACKET,
+		    PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) == -1) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "setsockopt: %s", pcap_strerror(errno));
+			goto fail;
+		}
+	}
+
+	handle->selectable_fd = handle->fd;
+	return 0;
+
+fail:
+	xdp_cleanup_linux(handle);
+	return PCAP_ERROR;
+}
+
+pcap_t *
+xdp_create(const char *device, char *ebuf, int *is_ours)
+{
+	pcap_t *p;
+
+	/* Does this look like an XDP device? */
+	if (strncmp(device, XDP_IFACE_PREFIX, sizeof XDP_IFACE_PREFIX - 1) != 0) {
+		/* Nope, doesn't begin with XDP_IFACE_PREFIX */
+		*is_ours = 0;
+		return NULL;
+	}
+
+	/* OK, it's ours. */
+	*is_ours = 1;
+
+	p = pcap_create_common(device, ebuf, sizeof (struct pcap_xdp));
+	if (p == NULL)
+		return (NULL);
+
+	p->activate_op = xdp_activate;
+	return (p);
+}
+
+int
+xdp_findalldevs(pcap_if_t **alldevsp _U_, char *err_str _U_)
+{
+	/*
+	 * XDP devices are named after whichever interface, and queue,
+	 * the user wants to capture on, so there's no list of them
+	 * to offer.
+	 */
+	return 0;
+}
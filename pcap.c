@@ -101,6 +101,10 @@
 #include "pcap-netfilter-linux.h"
 #endif
 
+#ifdef PCAP_SUPPORT_XDP
+#include "pcap-xdp-linux.h"
+#endif
+
 #ifdef PCAP_SUPPORT_DBUS
 #include "pcap-dbus.h"
 #endif
@@ -267,6 +271,128 @@ pcap_next_ex(pcap_t *p, struct pcap_pkthdr **pkt_header,
 	return (p->read_op(p, 1, p->oneshot_callback, (u_char *)&s));
 }
 
+/*
+ * Default callback for pcap_next_batch(); copies the packet data into
+ * the batch buffer, as the module might reuse the buffer the data is in
+ * for the next packet.  The copies are packed one after the other, so,
+ * if we have to grow the buffer, we can find the data for the packets
+ * we've already copied from the lengths in their headers.
+ */
+void
+pcap_batch(u_char *user, const struct pcap_pkthdr *h, const u_char *pkt)
+{
+	struct batch_userdata *sp = (struct batch_userdata *)user;
+	pcap_t *p = sp->pd;
+	u_char *bufp;
+	size_t newsize, off;
+	int i;
+
+	if (sp->nomem_errno != 0)
+		return;
+	if (sp->used + h->caplen > p->batch_bufsize) {
+		newsize = p->batch_bufsize != 0 ? p->batch_bufsize : 65536;
+		while (newsize < sp->used + h->caplen)
+			newsize *= 2;
+		bufp = realloc(p->batch_buffer, newsize);
+		if (bufp == NULL) {
+			/*
+			 * We can't report an error from a callback;
+			 * note it, and drop this and all remaining
+			 * packets, so pcap_next_batch() can report it.
+			 */
+			sp->nomem_errno = errno;
+			return;
+		}
+		p->batch_buffer = bufp;
+		p->batch_bufsize = newsize;
+		off = 0;
+		for (i = 0; i < sp->cnt; i++) {
+			sp->pkts[i] = p->batch_buffer + off;
+			off += sp->hdrs[i].caplen;
+		}
+	}
+	memcpy(p->batch_buffer + sp->used, pkt, h->caplen);
+	sp->hdrs[sp->cnt] = *h;
+	sp->pkts[sp->cnt] = p->batch_buffer + sp->used;
+	sp->used += h->caplen;
+	sp->cnt++;
+}
+
+/*
+ * Read up to "max" packets, handing back pointers to their headers in
+ * "hdrs" and to their data in "pkts"; the headers and data remain valid
+ * until the next attempt to read packets from "p".
+ *
+ * Returns the number of packets read, or the same error and "no
+ * packets" values as pcap_next_ex().
+ */
+int
+pcap_next_batch(pcap_t *p, struct pcap_pkthdr **hdrs, const u_char **pkts,
+    int max)
+{
+	struct batch_userdata s;
+	struct pcap_pkthdr *batch_hdrs;
+	int status, i;
+
+	if (max <= 0) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Batch size %d is not positive", max);
+		return (PCAP_ERROR);
+	}
+	if (max > p->batch_max) {
+		batch_hdrs = realloc(p->batch_hdrs,
+		    max * sizeof(struct pcap_pkthdr));
+		if (batch_hdrs == NULL) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			return (PCAP_ERROR);
+		}
+		p->batch_hdrs = batch_hdrs;
+		p->batch_max = max;
+	}
+
+	s.hdrs = p->batch_hdrs;
+	s.pkts = pkts;
+	s.cnt = 0;
+	s.used = 0;
+	s.nomem_errno = 0;
+	s.pd = p;
+
+	if (p->rfile != NULL) {
+		/*
+		 * We are on an offline capture; map EOF to -2, as
+		 * pcap_next_ex() does.
+		 */
+		status = pcap_offline_read(p, max, p->batch_callback,
+		    (u_char *)&s);
+		if (status == 0)
+			return (-2);
+	} else
+		status = p->read_batch_op(p, max, p->batch_callback,
+		    (u_char *)&s);
+	if (s.nomem_errno != 0) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(s.nomem_errno));
+		return (PCAP_ERROR);
+	}
+	if (status < 0)
+		return (status);
+
+	for (i = 0; i < s.cnt; i++)
+		hdrs[i] = &p->batch_hdrs[i];
+	return (s.cnt);
+}
+
+/*
+ * Hand the given packet, and all packets read before it, back to the
+ * module; if "pkt" is null, hand back all the packets read so far.
+ */
+int
+pcap_release(pcap_t *p, const u_char *pkt)
+{
+	return (p->release_op(p, pkt));
+}
+
 #if defined(DAG_ONLY)
 int
 pcap_findalldevs(pcap_if_t **alldevsp, char *errbuf)
@@ -336,6 +462,9 @@ struct capture_source_type {
 #ifdef PCAP_SUPPORT_NETFILTER
 	{ netfilter_findalldevs, netfilter_create },
 #endif
+#ifdef PCAP_SUPPORT_XDP
+	{ xdp_findalldevs, xdp_create },
+#endif
 #ifdef PCAP_SUPPORT_DBUS
 	{ dbus_findalldevs, dbus_create },
 #endif
@@ -442,6 +571,42 @@ pcap_create(const char *source, char *errbuf)
 }
 #endif
 
+/*
+ * Default routines for queueing packets to send and flushing the queue,
+ * for modules that have no transmit buffer of their own; packets are
+ * sent as soon as they're queued, so there's nothing to flush.
+ */
+static int
+pcap_inject_queue_unbuffered(pcap_t *p, const void *buf, size_t size)
+{
+	return (p->inject_op(p, buf, size));
+}
+
+static int
+pcap_inject_flush_unbuffered(pcap_t *p _U_)
+{
+	return (0);
+}
+
+/*
+ * Default routine for releasing packets, for modules that never hold
+ * on to packets; there's nothing to release.
+ */
+static int
+pcap_release_unheld(pcap_t *p _U_, const u_char *pkt _U_)
+{
+	return (0);
+}
+
+/*
+ * Default routine for reading packets for pcap_next_batch().
+ */
+static int
+pcap_read_batch_common(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
+{
+	return (p->read_op(p, cnt, callback, user));
+}
+
 static void
 initialize_ops(pcap_t *p)
 {
@@ -452,6 +617,9 @@ initialize_ops(pcap_t *p)
 	 */
 	p->read_op = (read_op_t)pcap_not_initialized;
 	p->inject_op = (inject_op_t)pcap_not_initialized;
+	p->inject_queue_op = pcap_inject_queue_unbuffered;
+	p->inject_flush_op = pcap_inject_flush_unbuffered;
+	p->release_op = pcap_release_unheld;
 	p->setfilter_op = (setfilter_op_t)pcap_not_initialized;
 	p->setdirection_op = (setdirection_op_t)pcap_not_initialized;
 	p->set_datalink_op = (set_datalink_op_t)pcap_not_initialized;
@@ -477,6 +645,14 @@ initialize_ops(pcap_t *p)
 	 * be used for pcap_next()/pcap_next_ex().
 	 */
 	p->oneshot_callback = pcap_oneshot;
+
+	/*
+	 * In most cases, the data for the packets in a batch has to
+	 * be copied, as the module reads each packet into the same
+	 * buffer.
+	 */
+	p->read_batch_op = pcap_read_batch_common;
+	p->batch_callback = pcap_batch;
 }
 
 static pcap_t *
@@ -554,9 +730,11 @@ pcap_create_common(const char *source, char *ebuf, size_t size)
  	pcap_set_snaplen(p, MAXIMUM_SNAPLEN);	/* max packet size */
 	p->opt.timeout = 0;			/* no timeout specified */
 	p->opt.buffer_size = 0;			/* use the platform's default */
+	p->opt.tx_buffer_size = 0;		/* no transmit buffer */
 	p->opt.promisc = 0;
 	p->opt.rfmon = 0;
 	p->opt.immediate = 0;
+	p->opt.hold_mode = 0;
 	p->opt.tstamp_type = -1;	/* default to not setting time stamp type */
 	p->opt.tstamp_precision = PCAP_TSTAMP_PRECISION_MICRO;
 
@@ -662,6 +840,15 @@ pcap_set_immediate_mode(pcap_t *p, int immediate)
 	return (0);
 }
 
+int
+pcap_set_hold_mode(pcap_t *p, int hold_mode)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.hold_mode = hold_mode;
+	return (0);
+}
+
 int
 pcap_set_buffer_size(pcap_t *p, int buffer_size)
 {
@@ -671,6 +858,15 @@ pcap_set_buffer_size(pcap_t *p, int buffer_size)
 	return (0);
 }
 
+int
+pcap_set_tx_buffer_size(pcap_t *p, int tx_buffer_size)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.tx_buffer_size = tx_buffer_size;
+	return (0);
+}
+
 int
 pcap_set_tstamp_precision(pcap_t *p, int tstamp_precision)
 {
@@ -734,6 +930,17 @@ pcap_activate(pcap_t *p)
 	if (pcap_check_activated(p))
 		return (PCAP_ERROR_ACTIVATED);
 	status = p->activate_op(p);
+	if (status >= 0 && p->opt.hold_mode &&
+	    p->release_op == pcap_release_unheld) {
+		/*
+		 * The module can't hold on to packets, so we can't
+		 * do what was asked.
+		 */
+		strlcpy(p->errbuf, "Hold mode isn't supported on this device",
+		    PCAP_ERRBUF_SIZE);
+		p->cleanup_op(p);
+		status = PCAP_ERROR;
+	}
 	if (status >= 0)
 		p->activated = 1;
 	else {
@@ -1791,7 +1998,7 @@ pcap_cleanup_live_common(pcap_t *p)
 		p->tstamp_precision_list = NULL;
 		p->tstamp_precision_count = 0;
 	}
-	pcap_freecode(&p->fcode);
+	free_bpf_program(p);
 #if !defined(WIN32) && !defined(MSDOS)
 	if (p->fd >= 0) {
 		close(p->fd);
@@ -1876,11 +2083,38 @@ pcap_inject(pcap_t *p, const void *buf, size_t size)
 	return (p->inject_op(p, buf, size));
 }
 
+/*
+ * Queue a packet to be sent by the next pcap_inject_flush(); returns
+ * -1 on error, 0 if there's no room to queue it in non-blocking mode,
+ * and the number of bytes queued otherwise.
+ *
+ * Platforms without a transmit buffer send the packet immediately.
+ */
+int
+pcap_inject_queue(pcap_t *p, const void *buf, size_t size)
+{
+	return (p->inject_queue_op(p, buf, size));
+}
+
+/*
+ * Send all packets queued with pcap_inject_queue(); returns -1 on error
+ * and 0 otherwise.
+ */
+int
+pcap_inject_flush(pcap_t *p)
+{
+	return (p->inject_flush_op(p));
+}
+
 void
 pcap_close(pcap_t *p)
 {
 	if (p->opt.source != NULL)
 		free(p->opt.source);
+	if (p->batch_hdrs != NULL)
+		free(p->batch_hdrs);
+	if (p->batch_buffer != NULL)
+		free(p->batch_buffer);
 	p->cleanup_op(p);
 	free(p);
 }
@@ -1903,6 +2137,122 @@ pcap_offline_filter(const struct bpf_program *fp, const struct pcap_pkthdr *h,
 		return (0);
 }
 
+/*
+ * A filter program prepared once for checking many batches of packets,
+ * such as those read with pcap_next_batch(), against it.
+ */
+struct pcap_batchfilter {
+	struct bpf_program fcode;	/* our copy of the program */
+	bpf_jit_filter_t fcode_jit;	/* native code for it, if any */
+	struct bpf_batch *fcode_batch;	/* else, form run in lockstep, if any */
+	struct bpf_prepared *fcode_prepared; /* else, decoded form, if any */
+};
+
+pcap_batchfilter_t *
+pcap_batchfilter_create(const struct bpf_program *fp, char *errbuf)
+{
+	pcap_batchfilter_t *bf;
+	size_t prog_size;
+
+	if (!bpf_validate(fp->bf_insns, fp->bf_len)) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "BPF program is not valid");
+		return (NULL);
+	}
+	bf = calloc(1, sizeof(*bf));
+	if (bf == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	prog_size = sizeof(*fp->bf_insns) * fp->bf_len;
+	bf->fcode.bf_len = fp->bf_len;
+	bf->fcode.bf_insns = malloc(prog_size);
+	if (bf->fcode.bf_insns == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		free(bf);
+		return (NULL);
+	}
+	memcpy(bf->fcode.bf_insns, fp->bf_insns, prog_size);
+
+	/*
+	 * As install_bpf_program() does, compile it to native code if
+	 * we can; that's worth doing here, as it's done once for all
+	 * batches.  If we can't, run it on several packets at once if
+	 * we can, and otherwise decode it for the threaded interpreter.
+	 * Native code comes first, as the gathers that load a field from
+	 * several packets at once cost more than its loads do.
+	 */
+	bf->fcode_jit = bpf_jit_compile(bf->fcode.bf_insns, bf->fcode.bf_len);
+	if (bf->fcode_jit == NULL)
+		bf->fcode_batch = bpf_batch_prepare(bf->fcode.bf_insns,
+		    bf->fcode.bf_len);
+	if (bf->fcode_jit == NULL && bf->fcode_batch == NULL)
+		bf->fcode_prepared = bpf_prepare(bf->fcode.bf_insns,
+		    bf->fcode.bf_len);
+	return (bf);
+}
+
+void
+pcap_batchfilter_close(pcap_batchfilter_t *bf)
+{
+	if (bf->fcode_jit != NULL)
+		bpf_jit_free(bf->fcode_jit);
+	if (bf->fcode_batch != NULL)
+		bpf_batch_free(bf->fcode_batch);
+	if (bf->fcode_prepared != NULL)
+		bpf_prepared_free(bf->fcode_prepared);
+	pcap_freecode(&bf->fcode);
+	free(bf);
+}
+
+/*
+ * Check "n" packets against the filter, putting the value the program
+ * returns for each in "results", if it's not null; returns the number
+ * of packets for which that's not zero.  We check how the program is
+ * to be run once for the batch, rather than once per packet.
+ */
+int
+pcap_batchfilter_run(pcap_batchfilter_t *bf, struct pcap_pkthdr **hdrs,
+    const u_char **pkts, int n, bpf_u_int32 *results)
+{
+	u_int ret;
+	int i, nmatch = 0;
+
+	if (bf->fcode_jit != NULL) {
+		for (i = 0; i < n; i++) {
+			ret = bf->fcode_jit(pkts[i], hdrs[i]->len,
+			    hdrs[i]->caplen, NULL);
+			if (results != NULL)
+				results[i] = ret;
+			if (ret != 0)
+				nmatch++;
+		}
+	} else if (bf->fcode_batch != NULL) {
+		nmatch = bpf_filter_batch(bf->fcode_batch, hdrs, pkts, n,
+		    results);
+	} else if (bf->fcode_prepared != NULL) {
+		for (i = 0; i < n; i++) {
+			ret = bpf_filter_prepared(bf->fcode_prepared, pkts[i],
+			    hdrs[i]->len, hdrs[i]->caplen, NULL);
+			if (results != NULL)
+				results[i] = ret;
+			if (ret != 0)
+				nmatch++;
+		}
+	} else {
+		for (i = 0; i < n; i++) {
+			ret = bpf_filter(bf->fcode.bf_insns, pkts[i],
+			    hdrs[i]->len, hdrs[i]->caplen);
+			if (results != NULL)
+				results[i] = ret;
+			if (ret != 0)
+				nmatch++;
+		}
+	}
+	return (nmatch);
+}
+
 /*
  * We make the version string static, and return a pointer to it, rather
  * than exporting the version string directly.  On at least some UNIXes,
@@ -282,7 +282,9 @@ int	pcap_set_rfmon(pcap_t *, int);
 int	pcap_set_timeout(pcap_t *, int);
 int	pcap_set_tstamp_type(pcap_t *, int);
 int	pcap_set_immediate_mode(pcap_t *, int);
+int	pcap_set_hold_mode(pcap_t *, int);
 int	pcap_set_buffer_size(pcap_t *, int);
+int	pcap_set_tx_buffer_size(pcap_t *, int);
 int	pcap_set_tstamp_precision(pcap_t *, int);
 int	pcap_get_tstamp_precision(pcap_t *);
 int	pcap_activate(pcap_t *);
@@ -374,6 +376,8 @@ int	pcap_dispatch(pcap_t *, int, pcap_handler, u_char *);
 const u_char*
 	pcap_next(pcap_t *, struct pcap_pkthdr *);
 int 	pcap_next_ex(pcap_t *, struct pcap_pkthdr **, const u_char **);
+int	pcap_next_batch(pcap_t *, struct pcap_pkthdr **, const u_char **, int);
+int	pcap_release(pcap_t *, const u_char *);
 void	pcap_breakloop(pcap_t *);
 int	pcap_stats(pcap_t *, struct pcap_stat *);
 int	pcap_setfilter(pcap_t *, struct bpf_program *);
@@ -381,6 +385,8 @@ int 	pcap_setdirection(pcap_t *, pcap_direction_t);
 int	pcap_getnonblock(pcap_t *, char *);
 int	pcap_setnonblock(pcap_t *, int, char *);
 int	pcap_inject(pcap_t *, const void *, size_t);
+int	pcap_inject_queue(pcap_t *, const void *, size_t);
+int	pcap_inject_flush(pcap_t *);
 int	pcap_sendpacket(pcap_t *, const u_char *, int);
 const char *pcap_statustostr(int);
 const char *pcap_strerror(int);
@@ -393,6 +399,31 @@ int	pcap_compile_nopcap(int, int, struct bpf_program *,
 void	pcap_freecode(struct bpf_program *);
 int	pcap_offline_filter(const struct bpf_program *,
 	    const struct pcap_pkthdr *, const u_char *);
+
+/*
+ * Sets of filter programs, matched against a packet all at once.
+ */
+typedef struct pcap_filterset pcap_filterset_t;
+
+pcap_filterset_t *pcap_filterset_create(char *);
+void	pcap_filterset_close(pcap_filterset_t *);
+int	pcap_filterset_add(pcap_filterset_t *, const struct bpf_program *);
+int	pcap_filterset_compile(pcap_filterset_t *);
+int	pcap_filterset_match(const pcap_filterset_t *, const struct pcap_pkthdr *,
+	    const u_char *, bpf_u_int32 *);
+char	*pcap_filterset_geterr(pcap_filterset_t *);
+
+/*
+ * A filter program prepared once for checking batches of packets.
+ */
+typedef struct pcap_batchfilter pcap_batchfilter_t;
+
+pcap_batchfilter_t *pcap_batchfilter_create(const struct bpf_program *,
+	    char *);
+void	pcap_batchfilter_close(pcap_batchfilter_t *);
+int	pcap_batchfilter_run(pcap_batchfilter_t *, struct pcap_pkthdr **,
+	    const u_char **, int, bpf_u_int32 *);
+
 int	pcap_datalink(pcap_t *);
 int	pcap_datalink_ext(pcap_t *);
 int	pcap_list_datalinks(pcap_t *, int **);
@@ -474,6 +505,157 @@ u_long pcap_mac_packets (void);
  */
 
 int	pcap_get_selectable_fd(pcap_t *);
+pcap_t	*pcap_open_merge(pcap_t **, int, u_int, char *);
+
+#ifdef __linux__
+/*
+ * Linux definitions
+ */
+
+/*
+ * Fanout modes for pcap_set_fanout(); they select how the kernel
+ * picks the member of a fanout group that gets a given packet.
+ */
+#define PCAP_FANOUT_HASH	0	/* hash of the packet's flow */
+#define PCAP_FANOUT_LB		1	/* round-robin load balancing */
+#define PCAP_FANOUT_CPU		2	/* CPU on which the packet arrived */
+#define PCAP_FANOUT_ROLLOVER	3	/* fill one socket, then the next */
+#define PCAP_FANOUT_QM		4	/* receive queue the packet arrived on */
+
+/*
+ * Flags for pcap_set_fanout().
+ */
+#define PCAP_FANOUT_FLAG_DEFRAG		0x00000001	/* defragment IP before hashing */
+#define PCAP_FANOUT_FLAG_ROLLOVER	0x00000002	/* roll over to another socket if ours is full */
+
+int	pcap_set_fanout(pcap_t *, int, int, int);
+
+/*
+ * Busy-poll statistics, as returned by pcap_get_busy_poll_stats().
+ */
+struct pcap_busy_poll_stat {
+	u_int bp_spin_hits;	/* waits ended by a packet arriving while spinning */
+	u_int bp_sleeps;	/* waits that stopped spinning and blocked */
+};
+
+/*
+ * Value for the arguments of pcap_set_ring_geometry() asking that the
+ * value be chosen from the interface's link speed and the snapshot
+ * length.
+ */
+#define PCAP_RING_AUTO		(-1)
+
+int	pcap_set_ring_geometry(pcap_t *, int, int, int);
+int	pcap_set_busy_poll(pcap_t *, int);
+int	pcap_get_busy_poll_stats(pcap_t *, struct pcap_busy_poll_stat *);
+
+/*
+ * Special values for pcap_set_numa_node().
+ */
+#define PCAP_NUMA_NODE_ANY	(-1)	/* wherever the kernel puts it */
+#define PCAP_NUMA_NODE_DEVICE	(-2)	/* the node the device is attached to */
+
+/*
+ * Capture buffer placement, as returned by pcap_get_buffer_stats().
+ */
+struct pcap_buffer_stat {
+	int	pb_numa_node;	/* NUMA node of the buffer, or -1 if unknown */
+	u_long	pb_size;	/* size of the buffer, in bytes */
+	u_long	pb_huge_size;	/* bytes of the buffer in huge pages */
+};
+
+int	pcap_set_numa_node(pcap_t *, int);
+int	pcap_set_hugepages(pcap_t *, int);
+int	pcap_get_buffer_stats(pcap_t *, struct pcap_buffer_stat *);
+int	pcap_bind_numa_node(pcap_t *);
+
+/*
+ * Metadata for a packet that isn't in the packet data, as returned by
+ * pcap_get_pkt_meta() and handed to a pcap_meta_handler.
+ */
+struct pcap_pkt_meta {
+	u_int	pm_flags;	/* which of the fields below are valid */
+	u_short	pm_vlan_tci;	/* VLAN tag control information */
+	u_short	pm_vlan_tpid;	/* VLAN tag protocol identifier */
+	int	pm_ifindex;	/* index of the interface the packet was seen on */
+	u_short	pm_pkttype;	/* PACKET_ type of the packet */
+	u_short	pm_protocol;	/* link-layer protocol, in host byte order */
+	u_int	pm_rxhash;	/* flow hash computed by the adapter or kernel */
+	u_char	pm_vnet_flags;	/* PCAP_VNET_F_ flags */
+	u_char	pm_gso_type;	/* PCAP_GSO_ type of an aggregated packet */
+	u_short	pm_hdr_len;	/* length of the headers of an aggregated packet */
+	u_short	pm_gso_size;	/* payload bytes per segment of an aggregated packet */
+	u_short	pm_csum_start;	/* offset at which checksumming starts */
+	u_short	pm_csum_offset;	/* offset of the checksum from pm_csum_start */
+};
+
+#define PCAP_META_VLAN		0x00000001	/* pm_vlan_tci and pm_vlan_tpid are valid */
+#define PCAP_META_IFINFO	0x00000002	/* pm_ifindex, pm_pkttype and pm_protocol are valid */
+#define PCAP_META_RXHASH	0x00000004	/* pm_rxhash is valid */
+#define PCAP_META_HWTSTAMP	0x00000008	/* time stamp came from the adapter */
+#define PCAP_META_LOSS		0x00000010	/* packets were dropped before this one */
+#define PCAP_META_VNET		0x00000020	/* the pm_vnet_flags through pm_csum_offset fields are valid */
+
+/*
+ * Values for pm_gso_type; they're the same as the VIRTIO_NET_HDR_GSO_
+ * values.  PCAP_GSO_ECN may be ORed with the others.
+ */
+#define PCAP_GSO_NONE		0	/* not an aggregated packet */
+#define PCAP_GSO_TCPV4		1	/* TCP over IPv4 */
+#define PCAP_GSO_UDP		3	/* UDP, fragmented as IPv4 */
+#define PCAP_GSO_TCPV6		4	/* TCP over IPv6 */
+#define PCAP_GSO_UDP_L4		5	/* UDP, segmented into datagrams */
+#define PCAP_GSO_ECN		0x80	/* TCP segments have ECN set */
+
+/*
+ * Flags in pm_vnet_flags; they're the same as the VIRTIO_NET_HDR_F_
+ * values.
+ */
+#define PCAP_VNET_F_NEEDS_CSUM	0x01	/* checksum not yet computed; see pm_csum_start */
+#define PCAP_VNET_F_DATA_VALID	0x02	/* checksum already verified */
+
+typedef void (*pcap_meta_handler)(u_char *, const struct pcap_pkthdr *,
+			     const struct pcap_pkt_meta *, const u_char *);
+
+int	pcap_set_vlan_metadata(pcap_t *, int);
+int	pcap_set_vnet_hdr(pcap_t *, int);
+int	pcap_set_resegment(pcap_t *, int);
+int	pcap_get_pkt_meta(pcap_t *, struct pcap_pkt_meta *);
+int	pcap_dispatch_meta(pcap_t *, int, pcap_meta_handler, u_char *);
+int	pcap_next_batch_meta(pcap_t *, struct pcap_pkthdr **,
+	    struct pcap_pkt_meta **, const u_char **, int);
+
+int	pcap_set_multi_consumer(pcap_t *, int);
+
+/*
+ * Statistics gathered from the capture ring as packets are read, as
+ * returned by pcap_get_ring_stats().
+ */
+struct pcap_ring_stat {
+	u_int	rs_blocks;	/* blocks read from the ring */
+	u_int	rs_losing_blocks; /* blocks the kernel marked as following drops */
+	u_int	rs_loss_events;	/* times the kernel started dropping packets */
+	u_int	rs_full;	/* times the ring was found full */
+	u_int	rs_occupancy_max; /* most blocks seen waiting to be read */
+	u_int	rs_ring_blocks;	/* number of blocks in the ring */
+};
+
+int	pcap_get_ring_stats(pcap_t *, struct pcap_ring_stat *);
+
+/*
+ * Event sets, for reading from many capture handles in one thread.
+ */
+typedef struct pcap_evset pcap_evset_t;
+
+pcap_evset_t	*pcap_evset_create(char *);
+void	pcap_evset_close(pcap_evset_t *);
+int	pcap_evset_add(pcap_evset_t *, pcap_t *, pcap_handler, u_char *);
+int	pcap_evset_remove(pcap_evset_t *, pcap_t *);
+int	pcap_evset_dispatch(pcap_evset_t *, int);
+int	pcap_loop_many(pcap_evset_t *, int);
+void	pcap_evset_breakloop(pcap_evset_t *);
+char	*pcap_evset_geterr(pcap_evset_t *);
+#endif /* __linux__ */
 
 #endif /* WIN32/MSDOS/UN*X */
 
@@ -143,6 +143,23 @@ sf_inject(pcap_t *p, const void *buf _U_, size_t size _U_)
 	return (-1);
 }
 
+static int
+sf_inject_flush(pcap_t *p)
+{
+	strlcpy(p->errbuf, "Sending packets isn't supported on savefiles",
+	    PCAP_ERRBUF_SIZE);
+	return (-1);
+}
+
+static int
+sf_release(pcap_t *p _U_, const u_char *pkt _U_)
+{
+	/*
+	 * We never hold on to packets, so there's nothing to release.
+	 */
+	return (0);
+}
+
 /*
  * Set direction flag: Which packets do we accept on a forwarding
  * single device? IN, OUT or both?
@@ -162,7 +179,7 @@ sf_cleanup(pcap_t *p)
 		(void)fclose(p->rfile);
 	if (p->buffer != NULL)
 		free(p->buffer);
-	pcap_freecode(&p->fcode);
+	free_bpf_program(p);
 }
 
 pcap_t *
@@ -326,6 +343,9 @@ found:
 
 	p->read_op = pcap_offline_read;
 	p->inject_op = sf_inject;
+	p->inject_queue_op = sf_inject;
+	p->inject_flush_op = sf_inject_flush;
+	p->release_op = sf_release;
 	p->setfilter_op = install_bpf_program;
 	p->setdirection_op = sf_setdirection;
 	p->set_datalink_op = NULL;	/* we don't support munging link-layer headers */
@@ -343,6 +363,7 @@ found:
 	 * be used for pcap_next()/pcap_next_ex().
 	 */
 	p->oneshot_callback = pcap_oneshot;
+	p->batch_callback = pcap_batch;
 
 	/*
 	 * Savefiles never require special BPF code generation.
@@ -372,7 +393,6 @@ pcap_fopen_offline(FILE *fp, char *errbuf)
 int
 pcap_offline_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 {
-	struct bpf_insn *fcode;
 	int status = 0;
 	int n = 0;
 	u_char *data;
@@ -404,8 +424,8 @@ pcap_offline_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 			return (status);
 		}
 
-		if ((fcode = p->fcode.bf_insns) == NULL ||
-		    bpf_filter(fcode, data, h.len, h.caplen)) {
+		if (p->fcode.bf_insns == NULL ||
+		    pcap_run_filter(p, data, h.len, h.caplen, NULL)) {
 			(*callback)(user, &h, data);
 			if (++n >= cnt && cnt > 0)
 				break;
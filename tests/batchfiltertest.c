@@ -0,0 +1,575 @@
+/*
+ * Copyright (c) 2026 The Tcpdump Group
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include <pcap.h>
+
+/*
+ * Check that pcap_batchfilter_run() gives the same results as
+ * pcap_offline_filter(), which interprets the program, for random
+ * filter programs run on batches of random packets, both with and
+ * without compiling them to native code; half of the programs have no
+ * indirect loads, so that, without native code, they're run on several
+ * packets at once where that can be done.  With -t, also time all of
+ * them on batches of Ethernet packets, with the programs for "tcp",
+ * which only loads from fixed offsets, and "tcp port 80", which
+ * doesn't.
+ */
+
+#define MAX_BATCH	1024
+#define MAX_PKTLEN	256
+#define MAX_INSNS	300
+
+static char *program_name;
+
+/* Forwards */
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...);
+static int parse_int(const char *, const char *, int);
+static u_int random_k(void);
+static u_int random_program(struct bpf_insn *, int);
+static void random_packet(u_char *, struct pcap_pkthdr *);
+static pcap_batchfilter_t *create_filter(struct bpf_program *, int,
+    char *);
+static int check_program(struct bpf_program *, int, int);
+static void time_program(struct bpf_program *, int, int);
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+static u_char pktbuf[MAX_BATCH][MAX_PKTLEN];
+static struct pcap_pkthdr hdrbuf[MAX_BATCH];
+static struct pcap_pkthdr *hdrs[MAX_BATCH];
+static const u_char *pkts[MAX_BATCH];
+
+/*
+ * Instructions from which the random programs are made.
+ */
+static const u_short codes[] = {
+	BPF_LD|BPF_W|BPF_ABS, BPF_LD|BPF_H|BPF_ABS, BPF_LD|BPF_B|BPF_ABS,
+	BPF_LD|BPF_W|BPF_IND, BPF_LD|BPF_H|BPF_IND, BPF_LD|BPF_B|BPF_IND,
+	BPF_LD|BPF_W|BPF_LEN, BPF_LDX|BPF_W|BPF_LEN, BPF_LDX|BPF_MSH|BPF_B,
+	BPF_LD|BPF_IMM, BPF_LDX|BPF_IMM, BPF_LD|BPF_MEM, BPF_LDX|BPF_MEM,
+	BPF_ST, BPF_STX,
+	BPF_JMP|BPF_JA,
+	BPF_JMP|BPF_JGT|BPF_K, BPF_JMP|BPF_JGE|BPF_K, BPF_JMP|BPF_JEQ|BPF_K,
+	BPF_JMP|BPF_JSET|BPF_K,
+	BPF_JMP|BPF_JGT|BPF_X, BPF_JMP|BPF_JGE|BPF_X, BPF_JMP|BPF_JEQ|BPF_X,
+	BPF_JMP|BPF_JSET|BPF_X,
+	BPF_ALU|BPF_ADD|BPF_K, BPF_ALU|BPF_SUB|BPF_K, BPF_ALU|BPF_MUL|BPF_K,
+	BPF_ALU|BPF_DIV|BPF_K, BPF_ALU|BPF_MOD|BPF_K, BPF_ALU|BPF_AND|BPF_K,
+	BPF_ALU|BPF_OR|BPF_K, BPF_ALU|BPF_XOR|BPF_K, BPF_ALU|BPF_LSH|BPF_K,
+	BPF_ALU|BPF_RSH|BPF_K,
+	BPF_ALU|BPF_ADD|BPF_X, BPF_ALU|BPF_SUB|BPF_X, BPF_ALU|BPF_MUL|BPF_X,
+	BPF_ALU|BPF_DIV|BPF_X, BPF_ALU|BPF_MOD|BPF_X, BPF_ALU|BPF_AND|BPF_X,
+	BPF_ALU|BPF_OR|BPF_X, BPF_ALU|BPF_XOR|BPF_X,
+	BPF_ALU|BPF_NEG, BPF_MISC|BPF_TAX, BPF_MISC|BPF_TXA,
+	BPF_RET|BPF_K, BPF_RET|BPF_A
+};
+#define NCODES	(sizeof(codes) / sizeof(codes[0]))
+
+/*
+ * "tcp", for Ethernet.
+ */
+static struct bpf_insn tcp[] = {
+	{ 0x28, 0, 0, 0x0000000c },
+	{ 0x15, 0, 5, 0x000086dd },
+	{ 0x30, 0, 0, 0x00000014 },
+	{ 0x15, 6, 0, 0x00000006 },
+	{ 0x15, 0, 6, 0x0000002c },
+	{ 0x30, 0, 0, 0x00000036 },
+	{ 0x15, 3, 4, 0x00000006 },
+	{ 0x15, 0, 3, 0x00000800 },
+	{ 0x30, 0, 0, 0x00000017 },
+	{ 0x15, 0, 1, 0x00000006 },
+	{ 0x6, 0, 0, 0x00040000 },
+	{ 0x6, 0, 0, 0x00000000 },
+};
+
+/*
+ * "tcp port 80", for Ethernet.
+ */
+static struct bpf_insn tcp_port_80[] = {
+	{ 0x28, 0, 0, 0x0000000c },
+	{ 0x15, 0, 6, 0x000086dd },
+	{ 0x30, 0, 0, 0x00000014 },
+	{ 0x15, 0, 15, 0x00000006 },
+	{ 0x28, 0, 0, 0x00000036 },
+	{ 0x15, 12, 0, 0x00000050 },
+	{ 0x28, 0, 0, 0x00000038 },
+	{ 0x15, 10, 11, 0x00000050 },
+	{ 0x15, 0, 10, 0x00000800 },
+	{ 0x30, 0, 0, 0x00000017 },
+	{ 0x15, 0, 8, 0x00000006 },
+	{ 0x28, 0, 0, 0x00000014 },
+	{ 0x45, 6, 0, 0x00001fff },
+	{ 0xb1, 0, 0, 0x0000000e },
+	{ 0x48, 0, 0, 0x0000000e },
+	{ 0x15, 2, 0, 0x00000050 },
+	{ 0x48, 0, 0, 0x00000010 },
+	{ 0x15, 0, 1, 0x00000050 },
+	{ 0x6, 0, 0, 0x00040000 },
+	{ 0x6, 0, 0, 0x00000000 },
+};
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	int nprograms = 10000;
+	int batch_size = 16;
+	int rounds = 0;
+	u_int seed = 1;
+	static struct bpf_insn insns[MAX_INSNS];
+	struct bpf_program fcode;
+	int i, status, tested, failed;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "b:n:S:t:")) != -1) {
+		switch (op) {
+
+		case 'b':
+			batch_size = parse_int(optarg, "Batch size", 1);
+			if (batch_size > MAX_BATCH)
+				error("Batch size %d is too large (> %d)",
+				    batch_size, MAX_BATCH);
+			break;
+
+		case 'n':
+			nprograms = parse_int(optarg, "Program count", 0);
+			break;
+
+		case 'S':
+			seed = parse_int(optarg, "Seed", 0);
+			break;
+
+		case 't':
+			rounds = parse_int(optarg, "Round count", 1);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	for (i = 0; i < MAX_BATCH; i++) {
+		hdrs[i] = &hdrbuf[i];
+		pkts[i] = pktbuf[i];
+	}
+
+	srandom(seed);
+	tested = 0;
+	failed = 0;
+	for (i = 0; i < nprograms; i++) {
+		fcode.bf_insns = insns;
+		fcode.bf_len = random_program(insns, i % 2);
+		status = check_program(&fcode, batch_size, 1);
+		if (status == 1)
+			status = check_program(&fcode, batch_size, 0);
+		switch (status) {
+
+		case -1:
+			/* not a valid program; try another */
+			continue;
+
+		case 0:
+			failed++;
+			break;
+		}
+		tested++;
+	}
+	printf("%d programs, %d failed\n", tested, failed);
+
+	if (rounds != 0) {
+		printf("tcp:\n");
+		fcode.bf_insns = tcp;
+		fcode.bf_len = sizeof(tcp) / sizeof(tcp[0]);
+		time_program(&fcode, batch_size, rounds);
+		printf("tcp port 80:\n");
+		fcode.bf_insns = tcp_port_80;
+		fcode.bf_len = sizeof(tcp_port_80) / sizeof(tcp_port_80[0]);
+		time_program(&fcode, batch_size, rounds);
+	}
+	exit(failed != 0 ? 1 : 0);
+}
+
+/*
+ * Make a batch filter for the program, compiling it to native code
+ * only if "native" is set.
+ */
+static pcap_batchfilter_t *
+create_filter(struct bpf_program *fp, int native, char *ebuf)
+{
+	pcap_batchfilter_t *bf;
+
+	if (!native)
+		setenv("PCAP_NO_BPF_JIT", "1", 1);
+	bf = pcap_batchfilter_create(fp, ebuf);
+	if (!native)
+		unsetenv("PCAP_NO_BPF_JIT");
+	return (bf);
+}
+
+/*
+ * Check the program on a few batches of random packets, with batch
+ * sizes up to "batch_size", compiling it to native code only if
+ * "native" is set; returns 1 if pcap_batchfilter_run() and
+ * pcap_offline_filter() agree, 0 if they don't, and -1 if the program
+ * isn't valid.
+ */
+static int
+check_program(struct bpf_program *fp, int batch_size, int native)
+{
+	pcap_batchfilter_t *bf;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	bpf_u_int32 results[MAX_BATCH];
+	int round, n, i, nmatch, expected_nmatch;
+	bpf_u_int32 expected;
+
+	bf = create_filter(fp, native, ebuf);
+	if (bf == NULL)
+		return (-1);
+	for (round = 0; round < 4; round++) {
+		n = random() % (batch_size + 1);
+		for (i = 0; i < n; i++)
+			random_packet(pktbuf[i], hdrs[i]);
+		nmatch = pcap_batchfilter_run(bf, hdrs, pkts, n, results);
+		expected_nmatch = 0;
+		for (i = 0; i < n; i++) {
+			expected = pcap_offline_filter(fp, hdrs[i], pkts[i]);
+			if (expected != 0)
+				expected_nmatch++;
+			if (results[i] != expected) {
+				fprintf(stderr,
+				    "packet %d: got %u, expected %u\n",
+				    i, results[i], expected);
+				pcap_batchfilter_close(bf);
+				return (0);
+			}
+		}
+		if (nmatch != expected_nmatch) {
+			fprintf(stderr, "got %d matches, expected %d\n",
+			    nmatch, expected_nmatch);
+			pcap_batchfilter_close(bf);
+			return (0);
+		}
+	}
+	pcap_batchfilter_close(bf);
+	return (1);
+}
+
+static double
+elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	return ((end->tv_sec - start->tv_sec) * 1e9 +
+	    (end->tv_nsec - start->tv_nsec));
+}
+
+/*
+ * Time checking "rounds" batches of "batch_size" packets against the
+ * program, with pcap_batchfilter_run(), with and without native code,
+ * and with pcap_offline_filter().
+ */
+static void
+time_program(struct bpf_program *fp, int batch_size, int rounds)
+{
+	pcap_batchfilter_t *bf;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	struct timespec start, end;
+	int native, round, i;
+	long matches;
+
+	for (i = 0; i < batch_size; i++) {
+		random_packet(pktbuf[i], hdrs[i]);
+
+		/*
+		 * Make them all unfragmented IPv4 TCP packets, half of
+		 * them to port 80.
+		 */
+		pktbuf[i][12] = 0x08;
+		pktbuf[i][13] = 0x00;
+		pktbuf[i][14] = 0x45;
+		pktbuf[i][20] = 0;
+		pktbuf[i][21] = 0;
+		pktbuf[i][23] = 6;
+		pktbuf[i][34] = 0;
+		pktbuf[i][35] = 1;
+		pktbuf[i][36] = 0;
+		pktbuf[i][37] = i % 2 ? 80 : 1;
+		if (hdrs[i]->caplen < 64)
+			hdrs[i]->caplen = hdrs[i]->len = 64;
+	}
+
+	for (native = 1; native >= 0; native--) {
+		bf = create_filter(fp, native, ebuf);
+		if (bf == NULL)
+			error("%s", ebuf);
+		matches = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (round = 0; round < rounds; round++)
+			matches += pcap_batchfilter_run(bf, hdrs, pkts,
+			    batch_size, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		printf("pcap_batchfilter_run%s: %.1f ns per packet (%ld matches)\n",
+		    native ? "" : " without native code",
+		    elapsed_ns(&start, &end) / ((double)rounds * batch_size),
+		    matches);
+		pcap_batchfilter_close(bf);
+	}
+
+	matches = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < batch_size; i++) {
+			if (pcap_offline_filter(fp, hdrs[i], pkts[i]) != 0)
+				matches++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("pcap_offline_filter: %.1f ns per packet (%ld matches)\n",
+	    elapsed_ns(&start, &end) / ((double)rounds * batch_size), matches);
+}
+
+/*
+ * Pick a constant, favoring small values, and values near the top of
+ * the range, as those are the ones most likely to find bugs in
+ * handling edge cases.
+ */
+static u_int
+random_k(void)
+{
+	u_int v = random();
+
+	switch (random() % 6) {
+
+	case 0:
+		return (v % 4);
+
+	case 1:
+		return (v % 64);
+
+	case 2:
+		return (v % 300);
+
+	case 3:
+		return (0xffffffffU - v % 4);
+
+	default:
+		return (v ^ ((u_int)random() << 16));
+	}
+}
+
+/*
+ * Make a random program, which may or may not be valid, with no
+ * indirect loads if "direct" is set; returns its length.  All the
+ * scratch memory words are stored into first, as pcap_offline_filter()
+ * doesn't initialize them.
+ */
+static u_int
+random_program(struct bpf_insn *insns, int direct)
+{
+	u_int len, i, room;
+	u_short code;
+
+	len = 2 * BPF_MEMWORDS + 1 +
+	    random() % (random() % 4 ? 30 : MAX_INSNS - 2 * BPF_MEMWORDS - 1);
+	for (i = 0; i < BPF_MEMWORDS; i++) {
+		insns[2 * i].code = BPF_LD|BPF_IMM;
+		insns[2 * i].jt = insns[2 * i].jf = 0;
+		insns[2 * i].k = random_k();
+		insns[2 * i + 1].code = BPF_ST;
+		insns[2 * i + 1].jt = insns[2 * i + 1].jf = 0;
+		insns[2 * i + 1].k = i;
+	}
+	for (i = 2 * BPF_MEMWORDS; i < len; i++) {
+		if (i == len - 1)
+			code = random() % 2 ? BPF_RET|BPF_A : BPF_RET|BPF_K;
+		else {
+			do
+				code = codes[random() % NCODES];
+			while (direct && (BPF_CLASS(code) == BPF_LD ||
+			    BPF_CLASS(code) == BPF_LDX) &&
+			    (BPF_MODE(code) == BPF_IND ||
+			    BPF_MODE(code) == BPF_MSH));
+		}
+		insns[i].code = code;
+		insns[i].jt = insns[i].jf = 0;
+		insns[i].k = random_k();
+		switch (BPF_CLASS(code)) {
+
+		case BPF_LD:
+		case BPF_LDX:
+			if (BPF_MODE(code) == BPF_MEM)
+				insns[i].k %= BPF_MEMWORDS;
+			else if (BPF_MODE(code) != BPF_IMM)
+				insns[i].k = random() % 8 ?
+				    random() % (MAX_PKTLEN - 60) :
+				    random() % 70000;
+			break;
+
+		case BPF_ST:
+		case BPF_STX:
+			insns[i].k %= BPF_MEMWORDS;
+			break;
+
+		case BPF_JMP:
+			room = len - 1 - (i + 1);
+			if (BPF_OP(code) == BPF_JA)
+				insns[i].k = random() % (room + 1);
+			else {
+				if (room > 255)
+					room = 255;
+				insns[i].jt = random() % (room + 1);
+				insns[i].jf = random() % (room + 1);
+			}
+			break;
+
+		case BPF_ALU:
+			/*
+			 * Shifts by 32 or more aren't defined in C, so
+			 * the interpreter's results for them aren't
+			 * either; there are no shifts by X for that
+			 * reason.  Division by a constant 0 is
+			 * rejected by bpf_validate().
+			 */
+			if (BPF_OP(code) == BPF_LSH || BPF_OP(code) == BPF_RSH)
+				insns[i].k %= 32;
+			else if ((BPF_OP(code) == BPF_DIV ||
+			    BPF_OP(code) == BPF_MOD) && insns[i].k == 0)
+				insns[i].k = 3;
+			break;
+		}
+	}
+	return (len);
+}
+
+/*
+ * Make a random packet, with, more often than not, enough of an IPv4
+ * or IPv6 TCP or UDP header for filters such as "tcp port 80" to look
+ * at.
+ */
+static void
+random_packet(u_char *pkt, struct pcap_pkthdr *h)
+{
+	int i;
+
+	for (i = 0; i < MAX_PKTLEN; i++)
+		pkt[i] = random();
+	switch (random() % 4) {
+
+	case 0:
+		pkt[12] = 0x08;
+		pkt[13] = 0x00;
+		pkt[14] = 0x45;
+		pkt[20] = 0;
+		pkt[23] = random() % 2 ? 6 : 17;
+		pkt[34] = 0;
+		pkt[35] = random() % 2 ? 80 : 3;
+		pkt[36] = 0;
+		pkt[37] = random() % 2 ? 80 : 1;
+		break;
+
+	case 1:
+		pkt[12] = 0x86;
+		pkt[13] = 0xdd;
+		pkt[20] = random() % 2 ? 6 : 17;
+		pkt[54] = 0;
+		pkt[55] = random() % 2 ? 80 : 5;
+		pkt[56] = 0;
+		pkt[57] = 80;
+		break;
+	}
+	h->ts.tv_sec = 0;
+	h->ts.tv_usec = 0;
+	h->caplen = random() % 4 ? 100 + random() % (MAX_PKTLEN - 100) :
+	    random() % 130;
+	h->len = h->caplen + random() % 50;
+}
+
+static int
+parse_int(const char *arg, const char *what, int min)
+{
+	long longarg;
+	char *p;
+
+	longarg = strtol(arg, &p, 10);
+	if (p == arg || *p != '\0')
+		error("%s \"%s\" is not a number", what, arg);
+	if (longarg < min)
+		error("%s %ld is too small (< %d)", what, longarg, min);
+	if (longarg > INT_MAX)
+		error("%s %ld is too large (> %d)", what, longarg, INT_MAX);
+	return (int)longarg;
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "Usage: %s [ -b batch_size ] [ -n programs ] [ -S seed ] [ -t rounds ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
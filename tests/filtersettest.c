@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2026 The Tcpdump Group
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include <pcap.h>
+
+/*
+ * Check that pcap_filterset_match() gives the same results as running
+ * each of the programs in the set with pcap_offline_filter(), for sets
+ * of programs like the ones pcap_compile() generates for port filters,
+ * mixed with random programs, both before and after the set is merged
+ * with pcap_filterset_compile(); also check a set that can't be merged
+ * without making too large a graph, which must be run one program at a
+ * time.
+ */
+
+#define MAX_PROGS	64
+#define MAX_PACKETS	500
+#define MAX_PKTLEN	256
+#define MAX_INSNS	100
+
+static char *program_name;
+
+/* Forwards */
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...);
+static int parse_int(const char *, const char *, int);
+static u_int random_k(void);
+static u_int random_program(struct bpf_insn *);
+static u_int port_program(struct bpf_insn *);
+static u_int branchy_program(struct bpf_insn *);
+static void random_packet(u_char *, struct pcap_pkthdr *);
+static int check_set(pcap_filterset_t *, int);
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+static struct bpf_insn insnbuf[MAX_PROGS][MAX_INSNS];
+static struct bpf_program progs[MAX_PROGS];
+static u_char pktbuf[MAX_PACKETS][MAX_PKTLEN];
+static struct pcap_pkthdr hdrs[MAX_PACKETS];
+
+/*
+ * Instructions from which the random programs are made.
+ */
+static const u_short codes[] = {
+	BPF_LD|BPF_W|BPF_ABS, BPF_LD|BPF_H|BPF_ABS, BPF_LD|BPF_B|BPF_ABS,
+	BPF_LD|BPF_W|BPF_IND, BPF_LD|BPF_H|BPF_IND, BPF_LD|BPF_B|BPF_IND,
+	BPF_LD|BPF_W|BPF_LEN, BPF_LDX|BPF_W|BPF_LEN, BPF_LDX|BPF_MSH|BPF_B,
+	BPF_LD|BPF_IMM, BPF_LDX|BPF_IMM, BPF_LD|BPF_MEM, BPF_LDX|BPF_MEM,
+	BPF_ST, BPF_STX,
+	BPF_JMP|BPF_JA,
+	BPF_JMP|BPF_JGT|BPF_K, BPF_JMP|BPF_JGE|BPF_K, BPF_JMP|BPF_JEQ|BPF_K,
+	BPF_JMP|BPF_JSET|BPF_K,
+	BPF_JMP|BPF_JGT|BPF_X, BPF_JMP|BPF_JGE|BPF_X, BPF_JMP|BPF_JEQ|BPF_X,
+	BPF_JMP|BPF_JSET|BPF_X,
+	BPF_ALU|BPF_ADD|BPF_K, BPF_ALU|BPF_SUB|BPF_K, BPF_ALU|BPF_MUL|BPF_K,
+	BPF_ALU|BPF_DIV|BPF_K, BPF_ALU|BPF_MOD|BPF_K, BPF_ALU|BPF_AND|BPF_K,
+	BPF_ALU|BPF_OR|BPF_K, BPF_ALU|BPF_XOR|BPF_K, BPF_ALU|BPF_LSH|BPF_K,
+	BPF_ALU|BPF_RSH|BPF_K,
+	BPF_ALU|BPF_ADD|BPF_X, BPF_ALU|BPF_SUB|BPF_X, BPF_ALU|BPF_MUL|BPF_X,
+	BPF_ALU|BPF_DIV|BPF_X, BPF_ALU|BPF_MOD|BPF_X, BPF_ALU|BPF_AND|BPF_X,
+	BPF_ALU|BPF_OR|BPF_X, BPF_ALU|BPF_XOR|BPF_X,
+	BPF_ALU|BPF_NEG, BPF_MISC|BPF_TAX, BPF_MISC|BPF_TXA,
+	BPF_RET|BPF_K, BPF_RET|BPF_A
+};
+#define NCODES	(sizeof(codes) / sizeof(codes[0]))
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	int nsets = 200;
+	u_int seed = 1;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_filterset_t *fs;
+	int set, nprogs, nmerged, failed, status, i;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "n:S:")) != -1) {
+		switch (op) {
+
+		case 'n':
+			nsets = parse_int(optarg, "Set count", 0);
+			break;
+
+		case 'S':
+			seed = parse_int(optarg, "Seed", 0);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	srandom(seed);
+	for (i = 0; i < MAX_PACKETS; i++)
+		random_packet(pktbuf[i], &hdrs[i]);
+
+	nmerged = 0;
+	failed = 0;
+	for (set = 0; set < nsets; set++) {
+		fs = pcap_filterset_create(ebuf);
+		if (fs == NULL)
+			error("%s", ebuf);
+
+		/*
+		 * Mostly port filters, which have a lot in common, with
+		 * the odd random program; the random programs aren't
+		 * necessarily valid, so keep going until one is.
+		 */
+		nprogs = 1 + random() % MAX_PROGS;
+		for (i = 0; i < nprogs; i++) {
+			progs[i].bf_insns = insnbuf[i];
+			do {
+				if (random() % 8 == 0)
+					progs[i].bf_len =
+					    random_program(insnbuf[i]);
+				else
+					progs[i].bf_len =
+					    port_program(insnbuf[i]);
+			} while (pcap_filterset_add(fs, &progs[i]) == PCAP_ERROR);
+		}
+
+		/*
+		 * Before it's merged, the set is run one program at a time.
+		 */
+		if (!check_set(fs, nprogs))
+			failed++;
+		status = pcap_filterset_compile(fs);
+		if (status < 0)
+			error("%s", pcap_filterset_geterr(fs));
+		if (status == 0)
+			nmerged++;
+		if (!check_set(fs, nprogs))
+			failed++;
+
+		/*
+		 * Adding a program after merging unmerges the set.
+		 */
+		if (nprogs < MAX_PROGS) {
+			progs[nprogs].bf_insns = insnbuf[nprogs];
+			progs[nprogs].bf_len = port_program(insnbuf[nprogs]);
+			if (pcap_filterset_add(fs, &progs[nprogs]) != nprogs)
+				error("%s", pcap_filterset_geterr(fs));
+			if (!check_set(fs, nprogs + 1))
+				failed++;
+		}
+		pcap_filterset_close(fs);
+	}
+	printf("%d sets, %d merged, %d failed\n", nsets, nmerged, failed);
+
+	/*
+	 * Programs that are all the same jumps, with different targets,
+	 * have their instructions in common at almost every pair of
+	 * instructions, so merging them would make a graph with a node
+	 * for almost every combination of positions in them.
+	 */
+	fs = pcap_filterset_create(ebuf);
+	if (fs == NULL)
+		error("%s", ebuf);
+	nprogs = 8;
+	for (i = 0; i < nprogs; i++) {
+		progs[i].bf_insns = insnbuf[i];
+		progs[i].bf_len = branchy_program(insnbuf[i]);
+		if (pcap_filterset_add(fs, &progs[i]) != i)
+			error("%s", pcap_filterset_geterr(fs));
+	}
+	status = pcap_filterset_compile(fs);
+	if (status != PCAP_WARNING) {
+		fprintf(stderr, "branchy set: compile returned %d, expected %d\n",
+		    status, PCAP_WARNING);
+		failed++;
+	}
+	if (!check_set(fs, nprogs))
+		failed++;
+	pcap_filterset_close(fs);
+
+	/*
+	 * If none of the sets were merged, only the one-at-a-time path
+	 * has been checked.
+	 */
+	if (nsets != 0 && nmerged == 0) {
+		fprintf(stderr, "no sets were merged\n");
+		failed++;
+	}
+	exit(failed != 0 ? 1 : 0);
+}
+
+/*
+ * Check the first "nprogs" programs in "progs", which are in the set,
+ * against every packet; returns 1 if pcap_filterset_match() and
+ * pcap_offline_filter() agree, and 0 if they don't.
+ */
+static int
+check_set(pcap_filterset_t *fs, int nprogs)
+{
+	bpf_u_int32 bitmap[(MAX_PROGS + 31) / 32];
+	int pkt, i, nmatch, expected_nmatch, got, expected;
+
+	for (pkt = 0; pkt < MAX_PACKETS; pkt++) {
+		nmatch = pcap_filterset_match(fs, &hdrs[pkt], pktbuf[pkt],
+		    bitmap);
+		expected_nmatch = 0;
+		for (i = 0; i < nprogs; i++) {
+			expected = pcap_offline_filter(&progs[i], &hdrs[pkt],
+			    pktbuf[pkt]) != 0;
+			got = (bitmap[i / 32] >> (i % 32)) & 1;
+			if (expected)
+				expected_nmatch++;
+			if (got != expected) {
+				fprintf(stderr,
+				    "packet %d, filter %d: got %d, expected %d\n",
+				    pkt, i, got, expected);
+				return (0);
+			}
+		}
+		if (nmatch != expected_nmatch) {
+			fprintf(stderr,
+			    "packet %d: got %d matches, expected %d\n",
+			    pkt, nmatch, expected_nmatch);
+			return (0);
+		}
+	}
+	return (1);
+}
+
+/*
+ * Pick a constant, favoring small values, and values near the top of
+ * the range, as those are the ones most likely to find bugs in
+ * handling edge cases.
+ */
+static u_int
+random_k(void)
+{
+	u_int v = random();
+
+	switch (random() % 6) {
+
+	case 0:
+		return (v % 4);
+
+	case 1:
+		return (v % 64);
+
+	case 2:
+		return (v % 300);
+
+	case 3:
+		return (0xffffffffU - v % 4);
+
+	default:
+		return (v ^ ((u_int)random() << 16));
+	}
+}
+
+/*
+ * Make a random program, which may or may not be valid; returns its
+ * length.  All the scratch memory words are stored into first, as
+ * pcap_offline_filter() doesn't initialize them.
+ */
+static u_int
+random_program(struct bpf_insn *insns)
+{
+	u_int len, i, room;
+	u_short code;
+
+	len = 2 * BPF_MEMWORDS + 1 + random() % (MAX_INSNS - 2 * BPF_MEMWORDS);
+	for (i = 0; i < BPF_MEMWORDS; i++) {
+		insns[2 * i].code = BPF_LD|BPF_IMM;
+		insns[2 * i].jt = insns[2 * i].jf = 0;
+		insns[2 * i].k = random_k();
+		insns[2 * i + 1].code = BPF_ST;
+		insns[2 * i + 1].jt = insns[2 * i + 1].jf = 0;
+		insns[2 * i + 1].k = i;
+	}
+	for (i = 2 * BPF_MEMWORDS; i < len; i++) {
+		if (i == len - 1)
+			code = random() % 2 ? BPF_RET|BPF_A : BPF_RET|BPF_K;
+		else
+			code = codes[random() % NCODES];
+		insns[i].code = code;
+		insns[i].jt = insns[i].jf = 0;
+		insns[i].k = random_k();
+		switch (BPF_CLASS(code)) {
+
+		case BPF_LD:
+		case BPF_LDX:
+			if (BPF_MODE(code) == BPF_MEM)
+				insns[i].k %= BPF_MEMWORDS;
+			else if (BPF_MODE(code) != BPF_IMM)
+				insns[i].k = random() % 8 ?
+				    random() % (MAX_PKTLEN - 60) :
+				    random() % 70000;
+			break;
+
+		case BPF_ST:
+		case BPF_STX:
+			insns[i].k %= BPF_MEMWORDS;
+			break;
+
+		case BPF_JMP:
+			room = len - 1 - (i + 1);
+			if (BPF_OP(code) == BPF_JA)
+				insns[i].k = random() % (room + 1);
+			else {
+				if (room > 255)
+					room = 255;
+				insns[i].jt = random() % (room + 1);
+				insns[i].jf = random() % (room + 1);
+			}
+			break;
+
+		case BPF_ALU:
+			/*
+			 * Shifts by 32 or more aren't defined in C, so
+			 * the interpreter's results for them aren't
+			 * either; there are no shifts by X for that
+			 * reason.  Division by a constant 0 is
+			 * rejected by bpf_validate().
+			 */
+			if (BPF_OP(code) == BPF_LSH || BPF_OP(code) == BPF_RSH)
+				insns[i].k %= 32;
+			else if ((BPF_OP(code) == BPF_DIV ||
+			    BPF_OP(code) == BPF_MOD) && insns[i].k == 0)
+				insns[i].k = 3;
+			break;
+		}
+	}
+	return (len);
+}
+
+/*
+ * Make the program pcap_compile() generates for "ip proto P and
+ * (src|dst) port N", for Ethernet, with a few protocols and ports, so
+ * that programs share their first few instructions and differ later;
+ * returns its length.
+ */
+static u_int
+port_program(struct bpf_insn *insns)
+{
+	static const u_int ports[] = { 1, 3, 5, 53, 80, 443 };
+	u_int proto, port, off;
+
+	proto = random() % 2 ? 6 : 17;
+	port = ports[random() % (sizeof(ports) / sizeof(ports[0]))];
+	off = random() % 2 ? 14 : 16;
+
+	insns[0] = (struct bpf_insn)BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12);
+	insns[1] = (struct bpf_insn)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x800, 0, 8);
+	insns[2] = (struct bpf_insn)BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 23);
+	insns[3] = (struct bpf_insn)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, proto, 0, 6);
+	insns[4] = (struct bpf_insn)BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 20);
+	insns[5] = (struct bpf_insn)BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1fff, 4, 0);
+	insns[6] = (struct bpf_insn)BPF_STMT(BPF_LDX|BPF_MSH|BPF_B, 14);
+	insns[7] = (struct bpf_insn)BPF_STMT(BPF_LD|BPF_H|BPF_IND, off);
+	insns[8] = (struct bpf_insn)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, port, 0, 1);
+	insns[9] = (struct bpf_insn)BPF_STMT(BPF_RET|BPF_K, 262144);
+	insns[10] = (struct bpf_insn)BPF_STMT(BPF_RET|BPF_K, 0);
+	return (11);
+}
+
+/*
+ * Make a program that's a load followed by the same jump over and
+ * over, each jumping a short random distance, so that the programs
+ * go through the jumps at different speeds; returns its length.
+ */
+static u_int
+branchy_program(struct bpf_insn *insns)
+{
+	u_int len, i;
+
+	len = MAX_INSNS;
+	insns[0] = (struct bpf_insn)BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 0);
+	for (i = 1; i < len - 3; i++)
+		insns[i] = (struct bpf_insn)BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K,
+		    1, random() % 2, random() % 2);
+	insns[len - 3] = (struct bpf_insn)BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 1);
+	insns[len - 2] = (struct bpf_insn)BPF_STMT(BPF_RET|BPF_A, 0);
+	insns[len - 1] = (struct bpf_insn)BPF_STMT(BPF_RET|BPF_K, 0);
+	return (len);
+}
+
+/*
+ * Make a random packet, with, more often than not, enough of an IPv4
+ * or IPv6 TCP or UDP header for port filters to look at.
+ */
+static void
+random_packet(u_char *pkt, struct pcap_pkthdr *h)
+{
+	int i;
+
+	for (i = 0; i < MAX_PKTLEN; i++)
+		pkt[i] = random();
+	switch (random() % 4) {
+
+	case 0:
+	case 1:
+		pkt[12] = 0x08;
+		pkt[13] = 0x00;
+		pkt[14] = 0x45;
+		pkt[20] = 0;
+		pkt[21] = 0;
+		pkt[23] = random() % 2 ? 6 : 17;
+		pkt[34] = 0;
+		pkt[35] = random() % 2 ? 80 : 53;
+		pkt[36] = random() % 2 ? 1 : 0;
+		pkt[37] = random() % 2 ? 187 : 3;
+		break;
+
+	case 2:
+		pkt[12] = 0x86;
+		pkt[13] = 0xdd;
+		pkt[20] = random() % 2 ? 6 : 17;
+		break;
+	}
+	h->ts.tv_sec = 0;
+	h->ts.tv_usec = 0;
+	h->caplen = random() % 4 ? 100 + random() % (MAX_PKTLEN - 100) :
+	    random() % 130;
+	h->len = h->caplen + random() % 50;
+}
+
+static int
+parse_int(const char *arg, const char *what, int min)
+{
+	long longarg;
+	char *p;
+
+	longarg = strtol(arg, &p, 10);
+	if (p == arg || *p != '\0')
+		error("%s \"%s\" is not a number", what, arg);
+	if (longarg < min)
+		error("%s %ld is too small (< %d)", what, longarg, min);
+	if (longarg > INT_MAX)
+		error("%s %ld is too large (> %d)", what, longarg, INT_MAX);
+	return (int)longarg;
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "Usage: %s [ -n sets ] [ -S seed ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
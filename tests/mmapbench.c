@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2026 The Tcpdump Group
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include <pcap.h>
+
+/*
+ * Measure how long it takes libpcap to hand packets that are already
+ * in the capture buffer to a callback that does nothing but count
+ * them.  Each round waits for traffic, which must be generated by
+ * some other program, to fill the buffer, and then times a single
+ * non-blocking pcap_dispatch() call that drains it.
+ *
+ * On x86 the time is reported in TSC cycles, elsewhere in nanoseconds.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TIME_UNIT	"cycles"
+
+static inline unsigned long long
+now(void)
+{
+	unsigned int lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long)hi << 32) | lo;
+}
+#else
+#define TIME_UNIT	"ns"
+
+static inline unsigned long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void countme(u_char *, const struct pcap_pkthdr *, const u_char *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...);
+static void warning(const char *, ...);
+static char *copy_argv(char **);
+static int parse_int(const char *, const char *, int);
+
+static pcap_t *pd;
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp, *cmdbuf, *device;
+	int rounds = 10;
+	int wait_ms = 100;
+	int snaplen = 65535;
+	int buffer_size = 0;
+	int direction = -1;
+	int vlan_metadata = 0;
+	bpf_u_int32 localnet, netmask;
+	struct bpf_program fcode;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	int status;
+	int i;
+	u_int packet_count, total_packets;
+	unsigned long long start, total_time;
+	struct timespec ts;
+	struct pcap_stat ps;
+
+	device = NULL;
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "B:c:i:Q:s:Vw:")) != -1) {
+		switch (op) {
+
+		case 'B':
+			buffer_size = parse_int(optarg, "Buffer size", 1);
+			break;
+
+		case 'c':
+			rounds = parse_int(optarg, "Round count", 1);
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 'Q':
+			if (strcmp(optarg, "in") == 0)
+				direction = PCAP_D_IN;
+			else if (strcmp(optarg, "out") == 0)
+				direction = PCAP_D_OUT;
+			else if (strcmp(optarg, "inout") == 0)
+				direction = PCAP_D_INOUT;
+			else
+				error("Unknown direction \"%s\"", optarg);
+			break;
+
+		case 's':
+			snaplen = parse_int(optarg, "Snapshot length", 1);
+			break;
+
+		case 'V':
+			vlan_metadata = 1;
+			break;
+
+		case 'w':
+			wait_ms = parse_int(optarg, "Wait time", 0);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+
+	if (device == NULL) {
+		device = pcap_lookupdev(ebuf);
+		if (device == NULL)
+			error("%s", ebuf);
+	}
+	*ebuf = '\0';
+	pd = pcap_create(device, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	status = pcap_set_snaplen(pd, snaplen);
+	if (status != 0)
+		error("%s: pcap_set_snaplen failed: %s",
+			    device, pcap_statustostr(status));
+	if (buffer_size != 0) {
+		status = pcap_set_buffer_size(pd, buffer_size);
+		if (status != 0)
+			error("%s: pcap_set_buffer_size failed: %s",
+			    device, pcap_statustostr(status));
+	}
+#ifdef __linux__
+	if (vlan_metadata) {
+		status = pcap_set_vlan_metadata(pd, 1);
+		if (status != 0)
+			error("%s: pcap_set_vlan_metadata failed: %s",
+			    device, pcap_statustostr(status));
+	}
+#endif
+	status = pcap_activate(pd);
+	if (status < 0) {
+		/*
+		 * pcap_activate() failed.
+		 */
+		error("%s: %s\n(%s)", device,
+		    pcap_statustostr(status), pcap_geterr(pd));
+	} else if (status > 0) {
+		/*
+		 * pcap_activate() succeeded, but it's warning us
+		 * of a problem it had.
+		 */
+		warning("%s: %s\n(%s)", device,
+		    pcap_statustostr(status), pcap_geterr(pd));
+	}
+	if (pcap_lookupnet(device, &localnet, &netmask, ebuf) < 0) {
+		localnet = 0;
+		netmask = 0;
+	}
+	cmdbuf = copy_argv(&argv[optind]);
+	if (cmdbuf != NULL) {
+		if (pcap_compile(pd, &fcode, cmdbuf, 1, netmask) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+	}
+	if (direction != -1 && pcap_setdirection(pd, direction) < 0)
+		error("%s", pcap_geterr(pd));
+	if (pcap_setnonblock(pd, 1, ebuf) == -1)
+		error("pcap_setnonblock failed: %s", ebuf);
+
+	ts.tv_sec = wait_ms / 1000;
+	ts.tv_nsec = (wait_ms % 1000) * 1000000L;
+	total_packets = 0;
+	total_time = 0;
+	for (i = 0; i < rounds; i++) {
+		nanosleep(&ts, NULL);
+		packet_count = 0;
+		start = now();
+		status = pcap_dispatch(pd, -1, countme,
+		    (u_char *)&packet_count);
+		total_time += now() - start;
+		if (status < 0)
+			error("%s: pcap_dispatch: %s", device, pcap_geterr(pd));
+		total_packets += packet_count;
+	}
+	if (pcap_stats(pd, &ps) < 0)
+		error("%s: pcap_stats: %s", device, pcap_geterr(pd));
+	printf("%u packets, %u dropped, ", total_packets, ps.ps_drop);
+	if (total_packets == 0)
+		printf("no packets seen\n");
+	else
+		printf("%.1f %s per packet\n",
+		    (double)total_time / total_packets, TIME_UNIT);
+	pcap_close(pd);
+	exit(0);
+}
+
+static void
+countme(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	u_int *counterp = (u_int *)user;
+
+	(*counterp)++;
+}
+
+static int
+parse_int(const char *arg, const char *what, int min)
+{
+	long longarg;
+	char *p;
+
+	longarg = strtol(arg, &p, 10);
+	if (p == arg || *p != '\0')
+		error("%s \"%s\" is not a number", what, arg);
+	if (longarg < min)
+		error("%s %ld is too small (< %d)", what, longarg, min);
+	if (longarg > INT_MAX)
+		error("%s %ld is too large (> %d)", what, longarg, INT_MAX);
+	return (int)longarg;
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "Usage: %s [ -V ] [ -Q in|out|inout ] [ -B buffer_size ] [ -c rounds ] [ -i interface ] [ -s snaplen ] [ -w wait ] [expression]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+
+/* VARARGS */
+static void
+warning(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: WARNING: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+}
+
+/*
+ * Copy arg vector into a new buffer, concatenating arguments with spaces.
+ */
+static char *
+copy_argv(register char **argv)
+{
+	register char **p;
+	register u_int len = 0;
+	char *buf;
+	char *src, *dst;
+
+	p = argv;
+	if (*p == 0)
+		return 0;
+
+	while (*p)
+		len += strlen(*p++) + 1;
+
+	buf = (char *)malloc(len);
+	if (buf == NULL)
+		error("copy_argv: malloc");
+
+	p = argv;
+	dst = buf;
+	while ((src = *p++) != NULL) {
+		while ((*dst++ = *src++) != '\0')
+			;
+		dst[-1] = ' ';
+	}
+	dst[-1] = '\0';
+
+	return buf;
+}